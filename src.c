@@ -4,222 +4,10136 @@
 // of blackjack against the computer as a dealer
 //
 // Author: Bakir Haljevac 
+//
+// Build: gcc -O2 -pthread src.c -o blackjack -lm
 //-----------------------------------------------------------------------------
 //
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <malloc.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <termios.h>
 #include <time.h>
+#include <unistd.h>
 
 #define DECK_SIZE 52
 #define ALLOC_SIZE 50
 #define PATH_LENGTH 100
-#define NUM_CARDS 13
+#define MAX_RANKS 16
+#define MAX_SHOE_SIZE (DECK_SIZE * MAX_DECKS)
+#define MIN_SHOE_SIZE 26
+#define RANK_NAME_LENGTH 8
 #define OPTION_INPUT_LENGTH 20
-#define FILE_NAME_LENGTH 10
+#define FILE_NAME_LENGTH 32
+#define DEFINITION_LINE_LENGTH 100
+#define DEFINITION_FILE "game.txt"
+#define DEFINITION_CACHE "game.bin"
+#define DEFINITION_MAGIC "BJG1"
+#define ATLAS_MAGIC "BJT1"
+#define ATLAS_EXTENSION ".atlas"
+#define EMBEDDED_ASSETS "@embedded"
+#define SHARED_ASSETS "@shm:"
+#define SHARED_ASSETS_NAME "/blackjack-%016llx"
+#define MAX_IMAGE_SIZE 4096
+#define EMBEDDED_WIDTH 13
+#define EMBEDDED_HEIGHT 9
+#define MARK_MAIN 0
+#define MARK_ARGS 1
+#define MARK_LOAD 2
+#define MARK_DECK 3
+#define MARK_SHUFFLE 4
+#define MARK_FRAME 5
+#define MARKS 6
+#define STARTUP_STRATEGIES 4
+#define MAX_STARTUP_RUNS 1000
+#define CORPUS_MAGIC "BJK1"
+#define HISTORY_MAGIC "BJH1"
+#define HISTORY_ROUND 1
+#define HISTORY_KEYFRAME 2
+#define HISTORY_INDEX_ROUNDS 1024
+#define DEFAULT_KEYFRAME_ROUNDS 64
+#define INDEX_EXTENSION ".idx"
+#define RAND_DEGREE 31
+#define RAND_RING 32
+#define RAND_WARMUP 344
+#define MAX_LANES 16
+#define MAX_BATCH 1024
+#define TUNE_ROUNDS 20000
+#define TUNE_WORKER_ROUNDS 4
+#define TUNE_REPEATS 3
+#define PROFILE_ENV "BLACKJACK_PROFILE"
+#define PROFILE_NAME ".blackjack-%s.profile"
+#define STARTUP_SEED "1"
 #define ARGUMENTS_ERROR -1
 #define MEMORY_ERROR -2
 #define FILE_ERROR -3
+#define SIMULATION_ERROR -4
+#define MAX_WORKERS 64
+#define MAX_WORKER_RETRIES 3
+#define PROGRESS_INTERVAL 4096
+#define ANALYSIS_NODES (1 << 19)
+#define DEALER_STATES 33
+#define ADVICE_WAIT_MS 250
+#define ANALYSIS_FRAME_SIZE (MAX_IMAGE_SIZE * 16)
+#define DEFAULT_STAND_ON 17
+#define OUTCOME_PLAYING -1
+#define PLAYERS_TURN_AGAIN 2
+#define OUTCOME_LOSE 0
+#define OUTCOME_PUSH 1
+#define OUTCOME_WIN 2
+#define OUTCOME_BLACKJACK 3
+#define SLOT_RUNNING 1
+#define SLOT_DONE 2
+#define CHUNK_ROUNDS 65536
+#define SWEEP_MIN_STAND 12
+#define SWEEP_MAX_STAND 21
+#define HEARTBEAT_MS 200
+#define HEARTBEAT_TIMEOUT_MS 2000
+#define MSG_REQUEST 1
+#define MSG_JOB 2
+#define MSG_HEARTBEAT 3
+#define MSG_RESULT 4
+#define MSG_DONE 5
+#define JOB_PENDING 0
+#define JOB_ASSIGNED 1
+#define JOB_DONE 2
+#define DEFAULT_TILT 1.5
+#define EVENT_DEALER_SIX 1
+#define EVENT_PLAYER_SEVEN 2
+#define EXPORT_MAGIC "BJC1"
+#define EXPORT_VERSION 1
+#define EXPORT_BLOCK_ROWS 4096
+#define EXPORT_BUFFERS 4
+#define MAX_COLUMNS 8
+#define COLUMN_INT 1
+#define COLUMN_FLOAT 2
+#define CONFIG_COLUMNS 7
+#define SNAPSHOT_MAGIC "BJS"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_SHOE 40
+#define SNAPSHOT_SIZE (SNAPSHOT_SHOE + MAX_SHOE_SIZE / 2)
+#define SNAPSHOT_HAND 16
+#define SNAPSHOT_FILE "blackjack.snap"
+#define LATENCY_SAMPLES 1024
+#define BROADCAST_LINGER_MS 1000
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+#define TIMER_TICK_MS 10
+#define SERVER_LINE_LENGTH 512
+#define DEFAULT_MAX_SESSIONS 65536
+#define LOAD_SAMPLES (1 << 21)
+#define LOAD_INTERVAL_SAMPLES (1 << 16)
+#define LOAD_DECISION 1
+#define LOAD_HAND 2
+#define LOAD_TIMEOUT 3
+#define DEFAULT_RAMP_SECONDS 1.0
+#define SOAK_SAMPLES (1 << 16)
+#define DEFAULT_SOAK_INTERVAL 10.0
+#define DEFAULT_SOAK_GROWTH_KB 1024
+#define DEFAULT_SOAK_DRIFT 50
+#define SESSION_ACTIONS (2 * DECK_SIZE)
+#define JOURNAL_MAGIC "BJJ2"
+#define JOURNAL_HEADER 128
+#define JOURNAL_RECORDS 65536
+#define JOURNAL_GROUP 256
+#define JOURNAL_DEAL 1
+#define JOURNAL_ACTION 2
+#define JOURNAL_RESULT 3
+#define JOURNAL_CLOSE 4
+#define OBSERVATION_SIZE 4
+#define ENV_RESHUFFLE 26
+#define ACTION_STAND 0
+#define ACTION_HIT 1
+#define STRATEGY_LINE_LENGTH 100
+#define Q_LEARNING_RATE 0.01f
+#define Q_EXPLORATION 0.1f
+#define ELITE_FRACTION 4
+#define MUTATION_CELLS 3
+#define MAX_STRATEGIES 16
+#define CONFIDENCE_Z 1.96
+#define DRILL_ANY 0
+#define DRILL_HARD 1
+#define DRILL_SOFT 2
+#define DRILL_PAIR 3
+#define DRILL_TRIPLES (MAX_RANKS * MAX_RANKS * MAX_RANKS)
+#define DRILLS_PER_SHOE 64
+#define DRILL_PRINT_LIMIT 10
+#define MAX_DECKS 8
+#define CHACHA_LANES 8
+#define CHACHA_WORDS (CHACHA_LANES * 16)
+#define CHACHA_KEY_WORDS 8
+#define CHACHA_ROUNDS 20
+#define SECURE_SEED "secure"
+#define SHA_LANES 8
+#define SHA256_SIZE 32
+#define SALT_SIZE 16
+#define SHA_MESSAGE (SALT_SIZE + MAX_SHOE_SIZE)
+#define AUDIT_MAGIC "BJA1"
+#define AUDIT_HEADER 16
+#define AUDIT_SHOE 56
+#define PERF_COUNTERS 5
+#define STAGE_OTHER 0
+#define STAGE_SHUFFLE 1
+#define STAGE_RENDER 2
+#define STAGE_SIMULATE 3
+#define STAGES 4
+#define STAGE_DEPTH 8
+#define ROUND_COLUMNS 6
 
 typedef struct _Card_ 
 {
   char* image_;
   int points_;
+  int rank_;
 } Card;
 
+//the ranks of a game, compiled from a definition file; a rank with 11
+//points is an ace
+typedef struct _GameDefinition_
+{
+  int ranks_;
+  int shoe_size_;
+  char names_[MAX_RANKS][RANK_NAME_LENGTH];
+  char files_[MAX_RANKS][FILE_NAME_LENGTH];
+  int points_[MAX_RANKS];
+  int copies_[MAX_RANKS];
+} GameDefinition;
+
+//the card image of every rank; the images are malloc'd (owned_), point
+//into one mapped atlas (map_) or are embedded in the executable
+typedef struct _CardAssets_
+{
+  char* images_[MAX_RANKS];
+  int width_;
+  int height_;
+  int owned_;
+  void* map_;
+  size_t map_size_;
+} CardAssets;
+
+//the start of a shoe corpus file; followed by shoes_ shoes of
+//(shoe_size_ + 1) / 2 bytes, two 4 bit rank codes per byte, the lower
+//nibble first
+typedef struct _CorpusHeader_
+{
+  char magic_[4];
+  int seed_;
+  int ranks_;
+  int shoe_size_;
+  long long shoes_;
+  int points_[MAX_RANKS];
+  int copies_[MAX_RANKS];
+} CorpusHeader;
+
+//a mapped shoe corpus that rounds are dealt from instead of shuffled; the
+//card of every rank code is in cards_
+typedef struct _ShoeCorpus_
+{
+  void* map_;
+  size_t size_;
+  unsigned char* codes_;
+  long long shoes_;
+  int shoe_bytes_;
+  Card cards_[MAX_RANKS];
+  atomic_int wrapped_; //set once a run needed more shoes than it holds
+} ShoeCorpus;
+
+//the start of an atlas file or shared memory segment; followed by the
+//width_ * height_ byte image of every rank of definition_
+typedef struct _AtlasHeader_
+{
+  char magic_[4];
+  int width_;
+  int height_;
+  GameDefinition definition_;
+} AtlasHeader;
+
+//word i of CHACHA_LANES ChaCha20 blocks
+typedef unsigned int ChaChaLanes
+ __attribute__((vector_size(CHACHA_LANES * sizeof(unsigned int))));
+
+//word i of SHA_LANES SHA-256 states or message schedules
+typedef unsigned int ShaLanes
+ __attribute__((vector_size(SHA_LANES * sizeof(unsigned int))));
+
+//a ChaCha20 keystream, generated CHACHA_LANES blocks at a time
+typedef struct _ChaCha_
+{
+  unsigned int state_[16];
+  unsigned long long counter_; //the next block
+  int position_; //the next word of words_
+  unsigned int words_[CHACHA_WORDS];
+} ChaCha;
+
+//counts of an instrumented stage, shared by all processes of a run;
+//counts_ are task clock ns, cycles, instructions, cache and branch misses
+typedef struct _StageTotals_
+{
+  atomic_llong calls_;
+  atomic_llong counts_[PERF_COUNTERS];
+} StageTotals;
+
+//the perf event counters of this process and its stack of stages
+typedef struct _Perf_
+{
+  int fds_[PERF_COUNTERS]; //-1 if unavailable; fds_[0] leads the group
+  int index_[PERF_COUNTERS]; //position in a group read
+  int members_;
+  long long last_[PERF_COUNTERS];
+  int stack_[STAGE_DEPTH];
+  int depth_;
+  StageTotals* totals_;
+} Perf;
+
+//complete state of an interactive game
+typedef struct _Game_
+{
+  Card cards_[MAX_SHOE_SIZE];
+  Card dealer_[DECK_SIZE];
+  Card player_[DECK_SIZE];
+  int card_count_;
+  int dealer_count_;
+  int player_count_;
+  int dealer_score_;
+  int player_score_;
+  int players_turn_;
+  int seed_;
+} Game;
+
+//one rendered table event; immutable once published and shared by every
+//viewer that is sending it
+typedef struct _Frame_
+{
+  atomic_int references_;
+  size_t length_;
+  char data_[];
+} Frame;
+
+//a spectator connection and how far it got into its frame
+typedef struct _Viewer_
+{
+  int socket_;
+  Frame* frame_;
+  size_t sent_;
+} Viewer;
+
+//a game broadcast to spectators on a Unix socket
+typedef struct _Broadcast_
+{
+  pthread_t thread_;
+  pthread_mutex_t lock_;
+  Frame* latest_; //guarded by lock_
+  int stop_; //guarded by lock_
+  int wake_[2];
+  int listener_;
+  int width_;
+  int height_;
+} Broadcast;
+
+//a pending timeout, linked into a timer wheel slot
+typedef struct _Timer_
+{
+  struct _Timer_* next_;
+  struct _Timer_* prev_;
+  long long expires_; //in ticks
+  int armed_;
+} Timer;
+
+//hierarchical timer wheel: TIMER_LEVELS wheels of TIMER_SLOTS slots, each
+//level TIMER_SLOTS times coarser than the one below; slots are list heads
+typedef struct _TimerWheel_
+{
+  long long now_;
+  int count_;
+  Timer slots_[TIMER_LEVELS][TIMER_SLOTS];
+  Timer expired_;
+} TimerWheel;
+
+//a client of the game server; a session restored from the journal has no
+//socket until its client resumes it
+typedef struct _Session_
+{
+  Timer timer_; //first, so an expired timer is its session
+  int socket_;
+  int closed_;
+  unsigned int id_;
+  unsigned int hand_;
+  int settled_;
+  int resuming_; //1 while reading the id of an 'r<id>' request
+  unsigned int resume_id_;
+  int action_count_;
+  unsigned char actions_[SESSION_ACTIONS];
+  Game game_;
+} Session;
+
+//one state transition of a session, as written to the journal
+typedef struct _JournalRecord_
+{
+  unsigned int session_;
+  unsigned int hand_;
+  unsigned char kind_;
+  unsigned char value_;
+  unsigned short reserved_;
+  unsigned int checksum_;
+} JournalRecord;
+
+//memory-mapped append log of session transitions: a JOURNAL_HEADER byte
+//header (magic, seed, hands dealt, next session id, shuffle mode and keys)
+//followed by records
+typedef struct _Journal_
+{
+  char* path_;
+  int fd_;
+  unsigned char* map_;
+  long long capacity_; //in records
+  long long count_;
+  long long synced_;
+  long long compact_at_;
+  int failed_;
+} Journal;
+
+typedef struct _Server_
+{
+  Card* deck_;
+  int seed_;
+  long long timeout_; //in ticks
+  TimerWheel wheel_;
+  Journal* journal_;
+  FILE* audit_;
+  Session** sessions_;
+  int count_;
+  unsigned int next_id_;
+  long long dealt_;
+  long long hands_;
+  long long timeouts_;
+  long long connected_;
+} Server;
+
+//a simulated player of the load generator (see runLoad)
+typedef struct _LoadClient_
+{
+  Timer timer_; //first, so an expired think time is its client
+  int socket_;
+  int length_; //of the partial line in line_
+  int score_;
+  int soft_;
+  int upcard_;
+  int dealer_; //dealer's score after his last turn, 0 before it
+  int again_; //on turn again after the dealer's turn (PLAYERS_TURN_AGAIN)
+  char acted_; //last action in this hand, 0 before the first
+  long long sent_; //when the unanswered decision was sent, or 0
+  char line_[SERVER_LINE_LENGTH];
+} LoadClient;
+
+//a uniform sample of at most capacity_ of the count_ samples added to it
+typedef struct _Reservoir_
+{
+  long long* samples_;
+  long long capacity_;
+  long long count_;
+  unsigned long long state_;
+} Reservoir;
+
+//memory and latency of one interval of a soak test (see runSoak)
+typedef struct _SoakInterval_
+{
+  long long rss_kb_;
+  long long heap_kb_; //in use by the allocator
+  long long blocks_; //allocated and not freed yet
+  long long p50_;
+  long long p99_;
+} SoakInterval;
+
+//keystroke to completed frame latencies of an interactive game
+typedef struct _Latency_
+{
+  int count_;
+  long long samples_[LATENCY_SAMPLES];
+} Latency;
+
+//speculative analysis of the player's next decision: a background thread
+//works on the latest decision point while the game waits for input and
+//drops it as soon as the generation moves on
+typedef struct _Analysis_
+{
+  pthread_t thread_;
+  pthread_mutex_t lock_;
+  pthread_cond_t changed_;
+  atomic_int generation_;
+  int stop_;
+  int width_;
+  int height_;
+  //the decision point, guarded by lock_
+  int counts_[12];
+  int player_score_;
+  int dealer_score_; //the upcard's points until the dealer has played
+  int dealer_count_; //1 until the dealer has played
+  int again_; //on turn again after the dealer's turn (PLAYERS_TURN_AGAIN)
+  Card hand_[DECK_SIZE];
+  int hand_count_;
+  Card next_;
+  //the results and the generation they belong to, guarded by lock_
+  int framed_;
+  char frame_[ANALYSIS_FRAME_SIZE];
+  size_t frame_length_; //0 if the frame did not fit
+
+  int finished_;
+  double stand_;
+  double hit_;
+  double bust_;
+  //used by the background thread only
+  long long nodes_;
+  long long budget_; //nodes_ beyond which the search estimates
+  char render_[ANALYSIS_FRAME_SIZE];
+  FILE* render_file_; //writes into render_, opened once so frames do not
+                      //allocate
+  int cancelled_;
+} Analysis;
+
+typedef struct _Round_
+{
+  int outcome_;
+  int player_score_;
+  int dealer_score_;
+  int player_count_;
+  int dealer_count_;
+} Round;
+
+//hit or stand decision for every player total, soft flag (an ace counted
+//as 11) and dealer upcard (2-11); 1 means hit
+typedef struct _Strategy_
+{
+  unsigned char hit_[2][22][12];
+} Strategy;
+
+//one round of an engine under the allocation check
+typedef void (*AllocationEngine)(void* context, long long round);
+
+//the engines of the allocation check and their state
+typedef struct _AllocationCheck_
+{
+  Card* deck_;
+  int seed_;
+  int width_;
+  int height_;
+  FILE* sink_;
+  Game game_;
+  Strategy strategy_;
+  Server* server_;
+  Session* session_;
+  int client_;
+  Analysis analysis_;
+} AllocationCheck;
+
+//importance sampling state of a lazily shuffled round
+typedef struct _Tilt_
+{
+  double player_;
+  double dealer_;
+  double weight_;
+} Tilt;
+
+typedef struct _Stats_
+{
+  long long rounds_;
+  long long wins_;
+  long long losses_;
+  long long pushes_;
+  long long blackjacks_;
+} Stats;
+
+//the start of a hand history file (see recordHistory); followed by
+//records, a keyframe record followed by its HistoryKeyframe
+typedef struct _HistoryHeader_
+{
+  char magic_[4];
+  int keyframe_rounds_;
+  long long start_time_; //CLOCK_REALTIME, in nanoseconds
+  GameDefinition definition_;
+  Strategy strategy_;
+} HistoryHeader;
+
+//a round (HISTORY_ROUND) or keyframe (HISTORY_KEYFRAME) of a hand history
+typedef struct _HistoryRecord_
+{
+  unsigned char type_;
+  unsigned char hits_;
+  unsigned char outcome_;
+  unsigned char cards_; //cards the round took from the shoe
+  unsigned int reserved_;
+  long long time_; //nanoseconds since the history started
+} HistoryRecord;
+
+//the table before round_: the position of the next card and the totals
+//of the rounds before; followed by the shoe (see packRanks)
+typedef struct _HistoryKeyframe_
+{
+  long long round_;
+  int position_;
+  int reserved_;
+  Stats stats_;
+} HistoryKeyframe;
+
+//an entry of the sparse index of a hand history: its first keyframe at
+//or after a multiple of HISTORY_INDEX_ROUNDS
+typedef struct _HistoryIndex_
+{
+  long long round_;
+  long long time_;
+  long long offset_;
+} HistoryIndex;
+
+//how simulations run on this machine (see tuneSimulation): the workers of
+//an automatic run, how many shoes are shuffled at once (0 for rand(), see
+//FisherYates) and how many rounds are shuffled before they are played
+typedef struct _Tuning_
+{
+  int workers_;
+  int lanes_;
+  int batch_;
+} Tuning;
+
+//work of one worker process over the rounds [begin, end)
+typedef int (*RangeTask)(void* context, int worker, long long begin,
+ long long end, void* slot);
+
+typedef struct _SimulationTask_
+{
+  Card* deck_;
+  int seed_;
+  Strategy* strategy_;
+  char* rounds_path_;
+} SimulationTask;
+
+typedef struct _TournamentTask_
+{
+  Card* deck_;
+  int seed_;
+  int count_;
+  Strategy* strategies_;
+} TournamentTask;
+
+//one slot per worker process in the shared result region, padded to a
+//cache line so workers never write to the same line
+typedef struct _WorkerSlot_
+{
+  atomic_int state_;
+  atomic_llong rounds_;
+  atomic_llong wins_;
+  atomic_llong losses_;
+  atomic_llong pushes_;
+  atomic_llong blackjacks_;
+} __attribute__((aligned(64))) WorkerSlot;
+
+typedef struct _AuditTask_
+{
+  unsigned char* records_;
+} AuditTask;
+
+//one slot per audit worker; first_failed_ is the first failed shoe + 1
+typedef struct _AuditSlot_
+{
+  atomic_int state_;
+  atomic_llong checked_;
+  atomic_llong failed_;
+  atomic_llong first_failed_;
+} __attribute__((aligned(64))) AuditSlot;
+
+typedef struct _Column_
+{
+  char* name_;
+  int type_;
+} Column;
+
+//rows of one export block, stored column by column; float values are
+//kept as their bit patterns
+typedef struct _ExportBlock_
+{
+  int rows_;
+  long long values_[MAX_COLUMNS][EXPORT_BLOCK_ROWS];
+} ExportBlock;
+
+//result file written by a background thread, or synchronously as CSV;
+//full blocks are queued in a ring of EXPORT_BUFFERS blocks
+typedef struct _Exporter_
+{
+  FILE* file_;
+  int csv_;
+  int columns_;
+  Column* schema_;
+  ExportBlock* blocks_;
+  unsigned char* scratch_;
+  int head_;
+  int queued_;
+  int closing_;
+  pthread_mutex_t lock_;
+  pthread_cond_t changed_;
+  pthread_t writer_;
+} Exporter;
+
+//one game of a vectorized environment; cards are kept as point values and
+//the shoe carries on across rounds so the count means something
+typedef struct _EnvGame_
+{
+  unsigned long long random_;
+  unsigned char shoe_[MAX_SHOE_SIZE];
+  unsigned short position_;
+  short running_count_; //up to MAX_SHOE_SIZE when every rank counts +1
+  unsigned char player_score_;
+  unsigned char player_cards_;
+  unsigned char soft_;
+  unsigned char upcard_;
+  unsigned char hole_;
+  unsigned char dealer_score_;
+} EnvGame;
+
+typedef struct _VecEnv_
+{
+  int count_;
+  EnvGame* games_;
+} VecEnv;
+
+//tournament results of one worker; products_ sums the product of the
+//round results of every pair of strategies, for paired confidence intervals
+typedef struct _TournamentSlot_
+{
+  atomic_int state_;
+  Stats stats_[MAX_STRATEGIES];
+  long long products_[MAX_STRATEGIES][MAX_STRATEGIES];
+} TournamentSlot;
+
+//what a drill deal has to show: the kind and total of the player's first
+//two cards (the pair's points for DRILL_PAIR, 0 for any pair) and the
+//dealer's upcard (0 for any)
+typedef struct _DrillSpec_
+{
+  int kind_;
+  int total_;
+  int upcard_;
+} DrillSpec;
+
+//every ordered (first, second, upcard) rank triple that matches a drill,
+//with the cumulative probability of drawing it from a shoe
+typedef struct _DrillTable_
+{
+  int count_;
+  double cumulative_[DRILL_TRIPLES];
+  short triple_[DRILL_TRIPLES];
+} DrillTable;
+
+//fixed size message of the sweep protocol, exchanged over a stream socket
+typedef struct _Message_
+{
+  int type_;
+  int job_;
+  int seed_;
+  int stand_on_;
+  long long begin_;
+  long long end_;
+  Stats stats_;
+} Message;
+
+typedef struct _Job_
+{
+  int stand_on_;
+  int state_;
+  int copies_;
+  long long begin_;
+  long long end_;
+} Job;
+
+typedef struct _Peer_
+{
+  int fd_;
+  int job_;
+  long long last_seen_;
+} Peer;
+
+//the game being played; a single deck of the classic ranks unless the
+//input folder holds a DEFINITION_FILE
+GameDefinition definition = {
+  13, DECK_SIZE,
+  { "A", "K", "Q", "J", "10", "9", "8", "7", "6", "5", "4", "3", "2" },
+  { "ace.txt", "king.txt", "queen.txt", "jack.txt", "10.txt", "9.txt",
+    "8.txt", "7.txt", "6.txt", "5.txt", "4.txt", "3.txt", "2.txt" },
+  { 11, 10, 10, 10, 10, 9, 8, 7, 6, 5, 4, 3, 2 },
+  { 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4 }
+};
+
+//the images of the ranks of the classic definition, for the input
+//EMBEDDED_ASSETS
+const char embedded_cards[][EMBEDDED_WIDTH * EMBEDDED_HEIGHT + 1] = {
+  "------------\n-A--------A-\n------------\n------------\n"
+  "------------\n------------\n------------\n-A--------A-\n"
+  "------------\n",
+  "------------\n-K--------K-\n------------\n------------\n"
+  "------------\n------------\n------------\n-K--------K-\n"
+  "------------\n",
+  "------------\n-Q--------Q-\n------------\n------------\n"
+  "------------\n------------\n------------\n-Q--------Q-\n"
+  "------------\n",
+  "------------\n-J--------J-\n------------\n------------\n"
+  "------------\n------------\n------------\n-J--------J-\n"
+  "------------\n",
+  "------------\n-10------10-\n------------\n------------\n"
+  "------------\n------------\n------------\n-10------10-\n"
+  "------------\n",
+  "------------\n-9--------9-\n------------\n------------\n"
+  "------------\n------------\n------------\n-9--------9-\n"
+  "------------\n",
+  "------------\n-8--------8-\n------------\n------------\n"
+  "------------\n------------\n------------\n-8--------8-\n"
+  "------------\n",
+  "------------\n-7--------7-\n------------\n------------\n"
+  "------------\n------------\n------------\n-7--------7-\n"
+  "------------\n",
+  "------------\n-6--------6-\n------------\n------------\n"
+  "------------\n------------\n------------\n-6--------6-\n"
+  "------------\n",
+  "------------\n-5--------5-\n------------\n------------\n"
+  "------------\n------------\n------------\n-5--------5-\n"
+  "------------\n",
+  "------------\n-4--------4-\n------------\n------------\n"
+  "------------\n------------\n------------\n-4--------4-\n"
+  "------------\n",
+  "------------\n-3--------3-\n------------\n------------\n"
+  "------------\n------------\n------------\n-3--------3-\n"
+  "------------\n",
+  "------------\n-2--------2-\n------------\n------------\n"
+  "------------\n------------\n------------\n-2--------2-\n"
+  "------------\n"
+};
+
+//the card images the deck was built from, see loadAssets
+CardAssets card_assets;
+
+//the corpus rounds are dealt from; none while codes_ is NULL (see
+//openCorpus)
+ShoeCorpus corpus;
+
+//the tuning of simulations, rand() one round at a time until a profile is
+//loaded (see loadProfile)
+Tuning tuning = { 1, 0, 1 };
+
+//monotonic clock at the startup phases of this process (MARK_MAIN ...),
+//see firstFrame
+long long startup_marks[MARKS];
+
+//set when dealt games are shuffled with ChaCha20 keyed with shuffle_key
+//(seed SECURE_SEED) instead of rand(); their shoes are then committed to
+//with salts derived from salt_key
+int secure_shuffle = 0;
+unsigned int shuffle_key[CHACHA_KEY_WORDS];
+unsigned int salt_key[CHACHA_KEY_WORDS];
+
+//calls of the interposed allocator, see malloc
+atomic_llong allocations = 0;
+atomic_llong frees = 0;
+atomic_llong resizes = 0;
+
+//glibc's allocator, which the interposed one forwards to
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void __libc_free(void* pointer);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+
+//per stage counters, on with the 'perf' command prefix
+int perf_enabled = 0;
+Perf perf;
+
+unsigned int sha256_initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+ 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+unsigned int sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 //-----------------------------------------------------------------------------
 ///
-/// The Fisher-Yates Shuffle algorithm to mix(shuffle) the deck.
-/// For every 'i' in range (0, size): swap element[i] and element 
-/// [random_i] where 'random_i' is a pseudo-random number in range [0, i).
+/// Counts @block, if there is one, as allocated (see malloc).
 ///
-/// @param deck The deck to shuffle.
-/// @param size Size of a deck.
-/// @param random_seed The number to initialize pseudo-random 
-///        number generator.
+//
+void* countBlock(void* block)
+{
+  if (block != NULL) 
+  {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  }
+  return block;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Interposed allocator: the program's own malloc, calloc, realloc, the
+/// aligned allocations and free (and the library calls that allocate
+/// through them) go through these, which count the blocks they hand out
+/// and take back and forward to glibc, so that allocations - frees is the
+/// number of live blocks. A realloc of a live block to a new size keeps
+/// the block live and counts as a resize instead; realloc(NULL, n) counts
+/// as an allocation and realloc(p, 0), which frees p, as a free.
 ///
 //
-void FisherYates(Card* deck, int size, int random_seed) 
+void* malloc(size_t size)
 {
-  srand(random_seed);
-  for (int i = size - 1; i > 0; i--) 
+  return countBlock(__libc_malloc(size));
+}
+
+void* calloc(size_t count, size_t size)
+{
+  return countBlock(__libc_calloc(count, size));
+}
+
+void* realloc(void* pointer, size_t size)
+{
+  if (pointer == NULL) 
   {
-    int swap_index = rand() % (i + 1);
-    Card tmp = deck[i];
-    deck[i] = deck[swap_index];
-    deck[swap_index] = tmp;
+    return countBlock(__libc_realloc(pointer, size));
+  }
+  void* block = __libc_realloc(pointer, size);
+  if (size == 0) 
+  {
+    atomic_fetch_add_explicit(&frees, 1, memory_order_relaxed);
+    return countBlock(block); //NULL, as glibc frees it
+  }
+  if (block != NULL) 
+  {
+    atomic_fetch_add_explicit(&resizes, 1, memory_order_relaxed);
+  }
+  return block;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  return countBlock(__libc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  return countBlock(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size)
+{
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 ||
+   alignment == 0) 
+  {
+    return EINVAL;
+  }
+  void* block = countBlock(__libc_memalign(alignment, size));
+  if (block == NULL) 
+  {
+    return ENOMEM;
+  }
+  *pointer = block;
+  return 0;
+}
+
+void* valloc(size_t size)
+{
+  return countBlock(__libc_valloc(size));
+}
+
+void* pvalloc(size_t size)
+{
+  return countBlock(__libc_pvalloc(size));
+}
+
+void free(void* pointer)
+{
+  if (pointer != NULL) 
+  {
+    atomic_fetch_add_explicit(&frees, 1, memory_order_relaxed);
   }
+  __libc_free(pointer);
 }
 
 //-----------------------------------------------------------------------------
 ///
-/// Writes player's or dealer's cards and score to stdout
+/// Opens the counters of the calling process as one group, so a single
+/// read returns all of them. The leader is the task clock, a software
+/// event that works where the hardware counters do not (virtual machines);
+/// hardware counters the machine lacks are left out. Without perf events
+/// at all, the thread CPU clock stands in for the task clock.
 ///
-/// @param cards The cards for printing.
-/// @param length The number of cards to be shown.
-/// @param score The score to be shown.
-/// @param width Width of single card image.
-/// @param height Height of single card image.
-/// @param player Value that can be 1(player's cards) or 0(dealer's cards).
+//
+void openCounters(void)
+{
+  int types[PERF_COUNTERS] = { PERF_TYPE_SOFTWARE, PERF_TYPE_HARDWARE,
+   PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+  int configs[PERF_COUNTERS] = { PERF_COUNT_SW_TASK_CLOCK,
+   PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+  perf.members_ = 0;
+  for (int c = 0; c < PERF_COUNTERS; c++) 
+  {
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = types[c];
+    attributes.config = configs[c];
+    attributes.read_format = PERF_FORMAT_GROUP;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    int leader = c == 0 ? -1 : perf.fds_[0];
+    perf.fds_[c] = c > 0 && leader < 0 ? -1 : syscall(SYS_perf_event_open,
+     &attributes, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+    perf.index_[c] = perf.fds_[c] >= 0 ? perf.members_++ : -1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Reads the current value of every counter; unavailable ones read zero.
 ///
 //
-void showCards(Card* cards, int length, int score,
- int width, int height, int player)
+void readCounters(long long* values)
 {
-  printf(player == 1 ? "YOUR CARDS:\n\n" : "DEALERS CARDS:\n\n");
-  printf("____________________________________________________________\n");
-  int offset = 0;
-  for (int j = 0; j < height; j++) 
+  unsigned long long group[1 + PERF_COUNTERS] = { 0 };
+  memset(values, 0, sizeof(long long) * PERF_COUNTERS);
+  if (perf.fds_[0] < 0) 
   {
-    for (int i = 0; i < length; i++) 
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    values[0] = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    return;
+  }
+  if (read(perf.fds_[0], group, sizeof(group)) <= 0) 
+  {
+    return;
+  }
+  for (int c = 0; c < PERF_COUNTERS; c++) 
+  {
+    if (perf.index_[c] >= 0) 
     {
-      char* img = cards[i].image_;
-      img += offset;
-      while (*img != '\n') 
-      {
-        printf("%c", *img);
-        img++;
-      }
-      printf("  ");
+      values[c] = group[1 + perf.index_[c]];
     }
-    printf("\n");
-    offset += width;
   }
-  printf("score:%d\n\n", score);
-  printf("____________________________________________________________\n");
 }
 
 //-----------------------------------------------------------------------------
 ///
-/// Transfers @amount of cards from @cards deck to @receiver deck.
-/// Increases receiver's @score for the value of the cards.
-/// Updates @card_count and @receiver_count.
+/// Charges what the counters counted since the last stage boundary to the
+/// stage on top of the stack, so nested stages are counted exclusively.
 ///
-/// @param cards The deck from which the cards are dealt.
-/// @param receiver The deck to which the cards are dealt.
-/// @param card_count The number of cards in first deck.
-/// @param receiver_count The number of cards in receiver deck.
-/// @param score The receiver's score.
-/// @param amount The number of cards to be dealt to receiver.
+//
+void chargeStage(void)
+{
+  if (!perf_enabled) 
+  {
+    return;
+  }
+  long long values[PERF_COUNTERS];
+  readCounters(values);
+  StageTotals* totals = &perf.totals_[perf.stack_[perf.depth_ - 1]];
+  for (int c = 0; c < PERF_COUNTERS; c++) 
+  {
+    atomic_fetch_add(&totals->counts_[c], values[c] - perf.last_[c]);
+    perf.last_[c] = values[c];
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Enters an instrumented stage. Costs one branch while counters are off.
 ///
 //
-void giveCards(Card* cards, Card* receiver, int* card_count,
- int* receiver_count, int* score, int amount) 
+void beginStage(int stage)
 {
-  for (int i = 0; i < amount; i++) 
+  if (!perf_enabled || perf.depth_ == STAGE_DEPTH) 
   {
-    receiver[*receiver_count] = cards[*card_count];
-    if (cards[*card_count].points_ == 11) //if it's ace
-    { 
-      int points_ace = *score > 10 ? 1 : 11;
-      *score += points_ace;
-    }
-    else 
-    {
-      *score += cards[*card_count].points_;
-    }
-    (*receiver_count)++;
-    (*card_count)++;
+    return;
   }
+  chargeStage();
+  perf.stack_[perf.depth_++] = stage;
+  atomic_fetch_add(&perf.totals_[stage].calls_, 1);
 }
 
 //-----------------------------------------------------------------------------
 ///
-/// Prints error message and terminates the program with error code.
+/// Leaves the innermost instrumented stage.
 ///
-/// @param executable The name of executable program.
-/// @return int The error code.
+//
+void endStage(void)
+{
+  if (!perf_enabled || perf.depth_ == 1) 
+  {
+    return;
+  }
+  chargeStage();
+  perf.depth_--;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Gives a freshly forked process counters of its own: inherited ones
+/// would keep counting the parent.
 ///
 //
-int argumentsError(char* executable) 
+void forkCounters(void)
 {
-  printf("usage: %s <input_folder>\n", executable);
+  if (!perf_enabled) 
+  {
+    return;
+  }
+  for (int c = 0; c < PERF_COUNTERS; c++) 
+  {
+    if (perf.fds_[c] >= 0) 
+    {
+      close(perf.fds_[c]);
+    }
+  }
+  openCounters();
+  perf.stack_[0] = STAGE_OTHER;
+  perf.depth_ = 1;
+  readCounters(perf.last_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// The Fisher-Yates Shuffle algorithm to mix(shuffle) the deck.
+/// For every 'i' in range (0, size): swap element[i] and element 
+/// [random_i] where 'random_i' is a pseudo-random number in range [0, i).
+///
+/// @param deck The deck to shuffle.
+/// @param size Size of a deck.
+/// @param random_seed The number to initialize pseudo-random 
+///        number generator.
+///
+//
+void FisherYates(Card* deck, int size, int random_seed) 
+{
+  beginStage(STAGE_SHUFFLE);
+  srand(random_seed);
+  for (int i = size - 1; i > 0; i--) 
+  {
+    int swap_index = rand() % (i + 1);
+    Card tmp = deck[i];
+    deck[i] = deck[swap_index];
+    deck[swap_index] = tmp;
+  }
+  endStage();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// One ChaCha quarter round on words @a, @b, @c and @d of CHACHA_LANES
+/// block states at once.
+///
+//
+void chachaQuarter(ChaChaLanes* x, int a, int b, int c, int d)
+{
+  x[a] += x[b];
+  x[d] ^= x[a];
+  x[d] = (x[d] << 16) | (x[d] >> 16);
+  x[c] += x[d];
+  x[b] ^= x[c];
+  x[b] = (x[b] << 12) | (x[b] >> 20);
+  x[a] += x[b];
+  x[d] ^= x[a];
+  x[d] = (x[d] << 8) | (x[d] >> 24);
+  x[c] += x[d];
+  x[b] ^= x[c];
+  x[b] = (x[b] << 7) | (x[b] >> 25);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Refills the keystream buffer with the next CHACHA_LANES ChaCha20 blocks,
+/// computed side by side: word i of every block lives in one vector, so
+/// each operation of the rounds works on all blocks (SSE2 or AVX2 lanes).
+///
+//
+void chachaBlocks(ChaCha* chacha)
+{
+  ChaChaLanes input[16];
+  ChaChaLanes x[16];
+  for (int i = 0; i < 16; i++) 
+  {
+    for (int lane = 0; lane < CHACHA_LANES; lane++) 
+    {
+      input[i][lane] = chacha->state_[i];
+    }
+  }
+  for (int lane = 0; lane < CHACHA_LANES; lane++) 
+  {
+    unsigned long long counter = chacha->counter_ + lane;
+    input[12][lane] = (unsigned int)counter;
+    input[13][lane] = (unsigned int)(counter >> 32);
+  }
+  chacha->counter_ += CHACHA_LANES;
+
+  memcpy(x, input, sizeof(x));
+  for (int round = 0; round < CHACHA_ROUNDS; round += 2) 
+  {
+    chachaQuarter(x, 0, 4, 8, 12);
+    chachaQuarter(x, 1, 5, 9, 13);
+    chachaQuarter(x, 2, 6, 10, 14);
+    chachaQuarter(x, 3, 7, 11, 15);
+    chachaQuarter(x, 0, 5, 10, 15);
+    chachaQuarter(x, 1, 6, 11, 12);
+    chachaQuarter(x, 2, 7, 8, 13);
+    chachaQuarter(x, 3, 4, 9, 14);
+  }
+  for (int i = 0; i < 16; i++) 
+  {
+    x[i] += input[i];
+    for (int lane = 0; lane < CHACHA_LANES; lane++) 
+    {
+      chacha->words_[lane * 16 + i] = x[i][lane];
+    }
+  }
+  chacha->position_ = 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Starts the ChaCha20 keystream of @key and @nonce at block zero.
+///
+//
+void chachaInit(ChaCha* chacha, unsigned int* key, unsigned long long nonce)
+{
+  chacha->state_[0] = 0x61707865; //"expand 32-byte k"
+  chacha->state_[1] = 0x3320646e;
+  chacha->state_[2] = 0x79622d32;
+  chacha->state_[3] = 0x6b206574;
+  memcpy(chacha->state_ + 4, key, CHACHA_KEY_WORDS * sizeof(unsigned int));
+  chacha->state_[12] = 0;
+  chacha->state_[13] = 0;
+  chacha->state_[14] = (unsigned int)nonce;
+  chacha->state_[15] = (unsigned int)(nonce >> 32);
+  chacha->counter_ = 0;
+  chacha->position_ = CHACHA_WORDS;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns a uniformly distributed number in range [0, @bound) from a
+/// ChaCha20 keystream, without modulo bias (multiply-shift with
+/// rejection of the few low products that would favour some results).
+///
+//
+unsigned int chachaBelow(ChaCha* chacha, unsigned int bound)
+{
+  unsigned int threshold = -bound % bound;
+  while (1) 
+  {
+    if (chacha->position_ == CHACHA_WORDS) 
+    {
+      chachaBlocks(chacha);
+    }
+    unsigned long long product =
+     (unsigned long long)chacha->words_[chacha->position_++] * bound;
+    if ((unsigned int)product >= threshold) 
+    {
+      return (unsigned int)(product >> 32);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// The Fisher-Yates shuffle driven by ChaCha20 keyed with shuffle_key
+/// instead of rand(). Every @nonce gives an independent, unpredictable
+/// order, and shuffles share no state, so any number of tables can shuffle
+/// at once.
+///
+/// @param deck The deck to shuffle.
+/// @param size Size of a deck.
+/// @param nonce The number of the shuffle; never reuse one under a key.
+///
+//
+void secureShuffle(Card* deck, int size, unsigned long long nonce)
+{
+  beginStage(STAGE_SHUFFLE);
+  ChaCha chacha;
+  chachaInit(&chacha, shuffle_key, nonce);
+  for (int i = size - 1; i > 0; i--) 
+  {
+    int swap_index = chachaBelow(&chacha, i + 1);
+    Card tmp = deck[i];
+    deck[i] = deck[swap_index];
+    deck[swap_index] = tmp;
+  }
+  endStage();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Switches dealt games to secureShuffle with fresh shuffle and salt keys
+/// from the kernel's random source (getrandom).
+///
+/// @return zero on success, otherwise SIMULATION_ERROR
+///
+//
+int enableSecureShuffle(void)
+{
+  if (getrandom(shuffle_key, sizeof(shuffle_key), 0) !=
+   (ssize_t)sizeof(shuffle_key) ||
+   getrandom(salt_key, sizeof(salt_key), 0) != (ssize_t)sizeof(salt_key)) 
+  {
+    printf("[ERR] No secure random source.\n");
+    return SIMULATION_ERROR;
+  }
+  secure_shuffle = 1;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// One SHA-256 compression of the next block of SHA_LANES messages at
+/// once: word i of every lane lives in one vector (multi-buffer hashing).
+///
+/// @param state The hash state of every lane.
+/// @param w The message schedule; the first 16 words hold the block.
+///
+//
+void sha256Compress(ShaLanes* state, ShaLanes* w)
+{
+  for (int i = 16; i < 64; i++) 
+  {
+    ShaLanes s0 = ((w[i - 15] >> 7) | (w[i - 15] << 25)) ^
+     ((w[i - 15] >> 18) | (w[i - 15] << 14)) ^ (w[i - 15] >> 3);
+    ShaLanes s1 = ((w[i - 2] >> 17) | (w[i - 2] << 15)) ^
+     ((w[i - 2] >> 19) | (w[i - 2] << 13)) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  ShaLanes a = state[0], b = state[1], c = state[2], d = state[3];
+  ShaLanes e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) 
+  {
+    ShaLanes s1 = ((e >> 6) | (e << 26)) ^ ((e >> 11) | (e << 21)) ^
+     ((e >> 25) | (e << 7));
+    ShaLanes t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+    ShaLanes s0 = ((a >> 2) | (a << 30)) ^ ((a >> 13) | (a << 19)) ^
+     ((a >> 22) | (a << 10));
+    ShaLanes t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Hashes up to SHA_LANES messages of the same length with SHA-256, all in
+/// the same pass through sha256Compress.
+///
+/// @param messages The messages.
+/// @param count The number of messages (1 to SHA_LANES).
+/// @param length The length of every message, at most SHA_MESSAGE bytes.
+/// @param digests Receive the SHA256_SIZE byte digest of each message.
+///
+//
+void sha256Lanes(unsigned char** messages, int count, size_t length,
+ unsigned char digests[][SHA256_SIZE])
+{
+  ShaLanes state[8];
+  for (int i = 0; i < 8; i++) 
+  {
+    for (int lane = 0; lane < SHA_LANES; lane++) 
+    {
+      state[i][lane] = sha256_initial[i];
+    }
+  }
+
+  //the message blocks are read in place; the padded tail (the last one or
+  //two blocks) is built per lane
+  size_t blocks = (length + 9 + 63) / 64;
+  size_t full = length / 64;
+  unsigned char tails[SHA_LANES][128];
+  for (int lane = 0; lane < count; lane++) 
+  {
+    size_t rest = length - full * 64;
+    memset(tails[lane], 0, sizeof(tails[lane]));
+    memcpy(tails[lane], messages[lane] + full * 64, rest);
+    tails[lane][rest] = 0x80;
+    unsigned long long bits = (unsigned long long)length * 8;
+    for (int k = 0; k < 8; k++) 
+    {
+      tails[lane][(blocks - full) * 64 - 1 - k] = bits >> (8 * k);
+    }
+  }
+
+  for (size_t block = 0; block < blocks; block++) 
+  {
+    ShaLanes w[64];
+    for (int lane = 0; lane < SHA_LANES; lane++) 
+    {
+      int source = lane < count ? lane : 0;
+      unsigned char* bytes = block < full ?
+       messages[source] + block * 64 : tails[source] + (block - full) * 64;
+      for (int i = 0; i < 16; i++) 
+      {
+        w[i][lane] = (unsigned int)bytes[4 * i] << 24 |
+         (unsigned int)bytes[4 * i + 1] << 16 |
+         (unsigned int)bytes[4 * i + 2] << 8 | bytes[4 * i + 3];
+      }
+    }
+    sha256Compress(state, w);
+  }
+
+  for (int lane = 0; lane < count; lane++) 
+  {
+    for (int i = 0; i < 8; i++) 
+    {
+      unsigned int word = state[i][lane];
+      digests[lane][4 * i] = word >> 24;
+      digests[lane][4 * i + 1] = word >> 16;
+      digests[lane][4 * i + 2] = word >> 8;
+      digests[lane][4 * i + 3] = word;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the salt of the shoe shuffled with @nonce: the first SALT_SIZE
+/// bytes of the ChaCha20 stream of salt_key and @nonce. Deriving it keeps
+/// a restarted server able to reveal the shoes it committed to.
+///
+//
+void shoeSalt(unsigned long long nonce, unsigned char* salt)
+{
+  ChaCha chacha;
+  chachaInit(&chacha, salt_key, nonce);
+  chachaBlocks(&chacha);
+  memcpy(salt, chacha.words_, SALT_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the rank index of each card of a shoe to @codes, one byte each.
+///
+//
+void shoeCodes(Card* cards, unsigned char* codes)
+{
+  for (int i = 0; i < definition.shoe_size_; i++) 
+  {
+    codes[i] = cards[i].rank_;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Computes the commitment to a shoe: SHA-256 of @salt followed by the
+/// rank codes of the cards, in the order they will be dealt.
+///
+/// @param cards The shuffled shoe.
+/// @param salt SALT_SIZE bytes of salt.
+/// @param commitment Receives the SHA256_SIZE byte hash.
+///
+//
+void commitShoe(Card* cards, unsigned char* salt, unsigned char* commitment)
+{
+  unsigned char message[SHA_MESSAGE];
+  unsigned char* messages[1] = { message };
+  memcpy(message, salt, SALT_SIZE);
+  shoeCodes(cards, message + SALT_SIZE);
+  sha256Lanes(messages, 1, SALT_SIZE + definition.shoe_size_,
+   (unsigned char (*)[SHA256_SIZE])commitment);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes @length bytes as lowercase hex to @out, which needs room for
+/// 2 * @length + 1 characters.
+///
+//
+void hexString(unsigned char* bytes, int length, char* out)
+{
+  for (int i = 0; i < length; i++) 
+  {
+    sprintf(out + 2 * i, "%02x", bytes[i]);
+  }
+  out[2 * length] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the rank codes of a shoe as one hex digit per card to @out,
+/// which needs room for shoe_size_ + 1 characters.
+///
+//
+void shoeString(Card* cards, char* out)
+{
+  for (int i = 0; i < definition.shoe_size_; i++) 
+  {
+    out[i] = "0123456789abcdef"[cards[i].rank_];
+  }
+  out[definition.shoe_size_] = '\0';
+}
+
+//-----------------------------------------------------------------------------
+///
+/// One step of a Fisher-Yates shuffle biased toward low cards, done lazily
+/// when the card at @position is about to be dealt. The card is picked from
+/// the not yet dealt ones with probability proportional to
+/// tilt^(10 - value) (aces count as 1), instead of uniformly, and the
+/// likelihood ratio of the pick (uniform probability / biased probability)
+/// is multiplied into @weight. A tilt of 1 is a plain uniform step.
+///
+/// @param deck The deck being shuffled.
+/// @param size Size of a deck.
+/// @param position The position to fill.
+/// @param tilt The bias toward low cards (1 or more).
+/// @param weight The likelihood ratio of the cards dealt so far.
+///
+//
+void tiltedDraw(Card* deck, int size, int position, double tilt,
+ double* weight)
+{
+  double value_weight[11];
+  value_weight[10] = 1.0;
+  for (int v = 9; v >= 1; v--) 
+  {
+    value_weight[v] = value_weight[v + 1] * tilt;
+  }
+
+  double weights[MAX_SHOE_SIZE];
+  double total = 0.0;
+  for (int i = position; i < size; i++) 
+  {
+    int value = deck[i].points_ == 11 ? 1 : deck[i].points_;
+    weights[i] = value_weight[value];
+    total += weights[i];
+  }
+
+  double target = (rand() + 0.5) / (RAND_MAX + 1.0) * total;
+  int pick = position;
+  while (pick < size - 1 && target >= weights[pick]) 
+  {
+    target -= weights[pick];
+    pick++;
+  }
+  *weight *= total / ((size - position) * weights[pick]);
+
+  Card tmp = deck[position];
+  deck[position] = deck[pick];
+  deck[pick] = tmp;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Draws the next @amount cards of a lazily shuffled deck with the tilt of
+/// their receiver. Does nothing for decks shuffled up front (@tilt NULL).
+///
+/// @param cards The deck.
+/// @param card_count The number of cards dealt so far.
+/// @param amount The number of cards about to be dealt.
+/// @param tilt The importance sampling state, or NULL.
+/// @param dealer Value that can be 1(dealer's cards) or 0(player's cards).
+///
+//
+void prepareCards(Card* cards, int card_count, int amount, Tilt* tilt,
+ int dealer)
+{
+  if (tilt == NULL) 
+  {
+    return;
+  }
+  for (int i = 0; i < amount; i++) 
+  {
+    tiltedDraw(cards, definition.shoe_size_, card_count + i,
+     dealer ? tilt->dealer_ : tilt->player_, &tilt->weight_);
+  }
+}
+
+//the terminal mode to restore after raw input
+struct termios terminal_mode;
+volatile sig_atomic_t terminal_raw = 0;
+
+//set by SIGINT or SIGTERM to stop the game server
+volatile sig_atomic_t server_stopped = 0;
+
+Column config_schema[CONFIG_COLUMNS] = {
+  { "stand_on", COLUMN_INT }, { "rounds", COLUMN_INT },
+  { "wins", COLUMN_INT }, { "losses", COLUMN_INT },
+  { "pushes", COLUMN_INT }, { "blackjacks", COLUMN_INT },
+  { "net", COLUMN_FLOAT }
+};
+
+Column round_schema[ROUND_COLUMNS] = {
+  { "round", COLUMN_INT }, { "outcome", COLUMN_INT },
+  { "player_score", COLUMN_INT }, { "dealer_score", COLUMN_INT },
+  { "player_cards", COLUMN_INT }, { "dealer_cards", COLUMN_INT }
+};
+
+//-----------------------------------------------------------------------------
+///
+/// Writes player's or dealer's cards and score to @out
+///
+/// @param out The stream to write to.
+/// @param cards The cards for printing.
+/// @param length The number of cards to be shown.
+/// @param score The score to be shown.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @param player Value that can be 1(player's cards) or 0(dealer's cards).
+///
+//
+void renderCards(FILE* out, Card* cards, int length, int score,
+ int width, int height, int player)
+{
+  fputs(player == 1 ? "YOUR CARDS:\n\n" : "DEALERS CARDS:\n\n", out);
+  fputs("____________________________________________________________\n",
+   out);
+  int offset = 0;
+  for (int j = 0; j < height; j++) 
+  {
+    for (int i = 0; i < length; i++) 
+    {
+      char* img = cards[i].image_;
+      img += offset;
+      while (*img != '\n') 
+      {
+        putc(*img, out);
+        img++;
+      }
+      fputs("  ", out);
+    }
+    putc('\n', out);
+    offset += width;
+  }
+  fprintf(out, "score:%d\n\n", score);
+  fputs("____________________________________________________________\n",
+   out);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes player's or dealer's cards and score to stdout (see renderCards).
+///
+//
+void showCards(Card* cards, int length, int score,
+ int width, int height, int player)
+{
+  beginStage(STAGE_RENDER);
+  renderCards(stdout, cards, length, score, width, height, player);
+  endStage();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Transfers @amount of cards from @cards deck to @receiver deck.
+/// Increases receiver's @score for the value of the cards.
+/// Updates @card_count and @receiver_count.
+///
+/// @param cards The deck from which the cards are dealt.
+/// @param receiver The deck to which the cards are dealt.
+/// @param card_count The number of cards in first deck.
+/// @param receiver_count The number of cards in receiver deck.
+/// @param score The receiver's score.
+/// @param amount The number of cards to be dealt to receiver.
+///
+//
+void giveCards(Card* cards, Card* receiver, int* card_count,
+ int* receiver_count, int* score, int amount) 
+{
+  for (int i = 0; i < amount; i++) 
+  {
+    receiver[*receiver_count] = cards[*card_count];
+    if (cards[*card_count].points_ == 11) //if it's ace
+    { 
+      int points_ace = *score > 10 ? 1 : 11;
+      *score += points_ace;
+    }
+    else 
+    {
+      *score += cards[*card_count].points_;
+    }
+    (*receiver_count)++;
+    (*card_count)++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the score of the first @count cards of a hand, counted the way
+/// giveCards counts them.
+///
+//
+int handScore(Card* cards, int count)
+{
+  int score = 0;
+  for (int i = 0; i < count; i++) 
+  {
+    score += cards[i].points_ == 11 && score > 10 ? 1 : cards[i].points_;
+  }
+  return score;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints error message and terminates the program with error code.
+///
+/// @param executable The name of executable program.
+/// @return int The error code.
+///
+//
+int argumentsError(char* executable) 
+{
+  printf("usage: %s <input_folder> [seed [command]]\n", executable);
+  printf("commands:\n");
+  printf("  perf [command]\n");
+  printf("  fromcorpus <corpus_file> [command]\n");
+  printf("  simulate <rounds> <workers> [strategy [results_file "
+   "[rounds_file]]]\n");
+  printf("  tune\n");
+  printf("  sweep <rounds> <local_workers> <socket_path> [results_file]\n");
+  printf("  worker <socket_path>\n");
+  printf("  rare <dealer6|player7> <rounds> [tilt] [stand_on]\n");
+  printf("  dump <results_file>\n");
+  printf("  resume <snapshot_file>\n");
+  printf("  broadcast <socket_path>\n");
+  printf("  watch <socket_path>\n");
+  printf("  serve <socket_path> <timeout_ms> [max_sessions "
+   "[journal_file [audit_file]]]\n");
+  printf("  load <socket_path> <sessions> <seconds> [think_ms [strategy "
+   "[ramp_seconds]]]\n");
+  printf("  snapbench <iterations>\n");
+  printf("  journalbench <journal_file> <records>\n");
+  printf("  shufflebench <tables> <shoes>\n");
+  printf("  alloccheck <rounds>\n");
+  printf("  soak <interactive|simulator|server> <seconds> [interval_seconds "
+   "[growth_kb [drift_percent]]]\n");
+  printf("  corpus <corpus_file> <shoes>\n");
+  printf("  record <history_file> <rounds> [strategy [keyframe_rounds]]\n");
+  printf("  seek <history_file> <round|time> <number|seconds>\n");
+  printf("  atlas <atlas_file>\n");
+  printf("  firstframe <spawn_ns>\n");
+  printf("  startbench <card_folder> <atlas_file> <runs>\n");
+  printf("  commitlog <audit_file> <shoes>\n");
+  printf("  audit <audit_file> <workers>\n");
+  printf("  rlbench <games> <steps>\n");
+  printf("  qlearn <games> <steps> <workers> <strategy_file>\n");
+  printf("  evolve <generations> <population> <rounds> <workers> "
+   "<strategy_file>\n");
+  printf("  tournament <rounds> <workers> <strategy> [strategy ...]\n");
+  printf("  drill <hand> <upcard> <count> [decks [min_true_count]]\n");
+  printf("seed: a number, or '%s' to shuffle dealt games with ChaCha20 "
+   "keyed from getrandom\n", SECURE_SEED);
+  printf("strategy: score to stand on or a strategy file\n");
+  printf("workers: 0 for the tuned count of this machine (see tune)\n");
+  printf("hand: hard<total>, soft<total>, pair, pair<points> or any\n");
+  printf("input_folder may hold a %s with 'decks <count>' and "
+   "'rank <name> <image_file> <points> <copies>' lines\n", DEFINITION_FILE);
+  printf("input_folder may also be an %s file (see atlas), %s or "
+   "%s<folder>\n", ATLAS_EXTENSION, EMBEDDED_ASSETS, SHARED_ASSETS);
+  return ARGUMENTS_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints error message and terminates the program with error code.
+///
+/// @return int The error code.
+///
+//
+int memoryError() 
+{
+  printf("[ERR] Out of memory.\n");
+  return MEMORY_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints error message and terminates the program with error code.
+///
+/// @return int The error code.
+///
+//
+int fileError() 
+{
+  printf("[ERR] Invalid File(s).\n");
+  return FILE_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Frees(deallocates) used space on the heap.
+///
+/// @param card_images The allocated memory used for card images, each set
+///        to NULL once freed.
+/// @param size The allocated space size.
+///
+//
+void deallocateMemory(char** card_images, int size) 
+{
+  for (int i = 0; i < size; i++) 
+  {
+    free(card_images[i]);
+    card_images[i] = NULL;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// The splitmix64 step: scrambles @z into a well mixed 64 bit value.
+///
+//
+unsigned long long mix64(unsigned long long z)
+{
+  z += 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Derives the shuffle seed of a single simulated round from the run seed.
+/// Every round gets its own substream, so any range of rounds can be played
+/// by any worker (or played again) and gives exactly the same cards.
+///
+/// @param seed The run seed (argv[2]).
+/// @param round The index of the round.
+/// @return int The seed for FisherYates.
+///
+//
+int roundSeed(int seed, long long round)
+{
+  unsigned long long z = ((unsigned long long)(unsigned)seed << 32) ^
+   (unsigned long long)round;
+  return (int)(mix64(z) & 0x7fffffff);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Packs the ranks of @count cards into 4-bit codes, two cards per byte.
+///
+//
+void packRanks(Card* cards, int count, unsigned char* out)
+{
+  for (int i = 0; i < count; i += 2) 
+  {
+    int high = i + 1 < count ? cards[i + 1].rank_ : 0;
+    out[i / 2] = cards[i].rank_ | high << 4;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Rebuilds @count cards from 4-bit rank codes.
+///
+/// @return 1 on success, 0 if a code is not a valid rank
+///
+//
+int unpackRanks(unsigned char* in, int count, Card* ranks, Card* cards)
+{
+  for (int i = 0; i < count; i++) 
+  {
+    int rank = (in[i / 2] >> (i % 2 * 4)) & 0xf;
+    if (rank >= definition.ranks_) 
+    {
+      return 0;
+    }
+    cards[i] = ranks[rank];
+  }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Fills @cards with shoe @shoe of the mapped corpus, wrapping around at
+/// its end (see writeCorpus).
+///
+//
+void corpusShoe(unsigned long long shoe, Card* cards)
+{
+  beginStage(STAGE_SHUFFLE);
+  unpackRanks(corpus.codes_ + (shoe % corpus.shoes_) * corpus.shoe_bytes_,
+   definition.shoe_size_, corpus.cards_, cards); //checked by openCorpus
+  endStage();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Warns once if a run of @rounds rounds needs more shoes than the mapped
+/// corpus holds, so that its rounds reuse shoes and are not independent.
+///
+//
+void checkCorpusRounds(long long rounds)
+{
+  if (corpus.codes_ != NULL && rounds > corpus.shoes_ &&
+   !atomic_exchange(&corpus.wrapped_, 1)) 
+  {
+    printf("[WARN] The run needs more than the %lld shoes of the corpus; "
+     "rounds reuse them and are not independent.\n", corpus.shoes_);
+    fflush(stdout); //simulation workers leave with _exit
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Fills @cards with the shoe of round @r: the round's shoe of the corpus
+/// when one is mapped, otherwise @deck shuffled with the round's seed.
+///
+/// @param cards The shoe.
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param r The index of the round.
+///
+//
+void roundShoe(Card* cards, Card* deck, int seed, long long r)
+{
+  if (corpus.codes_ != NULL) 
+  {
+    checkCorpusRounds(r + 1);
+    corpusShoe(r, cards);
+    return;
+  }
+  memcpy(cards, deck, sizeof(Card) * definition.shoe_size_);
+  FisherYates(cards, definition.shoe_size_, roundSeed(seed, r));
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Seeds the state of glibc's rand() the way srand(@seed) does: r[0] is
+/// the seed and r[1..30] follow by the Lehmer generator 16807 r mod
+/// (2^31 - 1), computed with Schrage's method as glibc computes it.
+///
+//
+void randState(int seed, unsigned int* state)
+{
+  int word = seed == 0 ? 1 : seed;
+  state[0] = word;
+  for (int i = 1; i < RAND_DEGREE; i++) 
+  {
+    int hi = word / 127773;
+    int lo = word % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if (word < 0) 
+    {
+      word += 2147483647;
+    }
+    state[i] = word;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Shuffles @lanes shoes exactly like FisherYates does with their seeds,
+/// generating the rand() streams of all of them together, one word of
+/// every lane per step. rand() is the additive feedback generator
+/// r[i] = r[i - 31] + r[i - 3], with r[31..33] copies of r[0..2], whose
+/// outputs r[i] >> 1 start at r[RAND_WARMUP]. Inlined with a constant
+/// @lanes, every step becomes SIMD instructions over the lanes.
+///
+/// @param shoes The shoes, one after the other, each a copy of the deck.
+/// @param size The number of cards of a shoe.
+/// @param seeds The seed of every shoe.
+/// @param lanes The number of shoes, at most MAX_LANES.
+///
+//
+static inline __attribute__((always_inline)) void shuffleLanes(Card* shoes,
+ int size, int* seeds, int lanes)
+{
+  unsigned int ring[RAND_RING][MAX_LANES];
+  unsigned int draws[MAX_SHOE_SIZE][MAX_LANES];
+  unsigned int state[RAND_DEGREE];
+  for (int lane = 0; lane < lanes; lane++) 
+  {
+    randState(seeds[lane], state);
+    for (int i = 0; i < RAND_DEGREE; i++) 
+    {
+      ring[i][lane] = state[i];
+    }
+    ring[31][lane] = state[0];
+    ring[0][lane] = state[1];
+    ring[1][lane] = state[2];
+  }
+  for (int i = 34; i < RAND_WARMUP; i++) 
+  {
+    for (int lane = 0; lane < lanes; lane++) 
+    {
+      ring[i & 31][lane] = ring[(i + 1) & 31][lane] +
+       ring[(i + 29) & 31][lane];
+    }
+  }
+  for (int k = 0; k < size - 1; k++) 
+  {
+    int i = RAND_WARMUP + k;
+    for (int lane = 0; lane < lanes; lane++) 
+    {
+      ring[i & 31][lane] = ring[(i + 1) & 31][lane] +
+       ring[(i + 29) & 31][lane];
+      draws[k][lane] = ring[i & 31][lane] >> 1;
+    }
+  }
+
+  for (int lane = 0; lane < lanes; lane++) 
+  {
+    Card* deck = shoes + lane * size;
+    for (int i = size - 1, k = 0; i > 0; i--, k++) 
+    {
+      int swap_index = draws[k][lane] % (i + 1);
+      Card tmp = deck[i];
+      deck[i] = deck[swap_index];
+      deck[swap_index] = tmp;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Fills @shoes with the shoes of the @count rounds from @first (see
+/// roundShoe), shuffling tuning.lanes_ of them at once (see shuffleLanes)
+/// unless rand() is tuned or a corpus is mapped.
+///
+/// @param shoes Room for @count shoes rounded up to MAX_LANES shoes.
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param first The first round.
+/// @param count The number of rounds.
+///
+//
+void shuffleBatch(Card* shoes, Card* deck, int seed, long long first,
+ int count)
+{
+  int size = definition.shoe_size_;
+  int lanes = tuning.lanes_;
+  if (lanes == 0 || corpus.codes_ != NULL) 
+  {
+    for (int b = 0; b < count; b++) 
+    {
+      roundShoe(shoes + b * size, deck, seed, first + b);
+    }
+    return;
+  }
+
+  beginStage(STAGE_SHUFFLE);
+  int seeds[MAX_LANES];
+  for (int b = 0; b < count; b += lanes) 
+  {
+    Card* group = shoes + b * size;
+    for (int lane = 0; lane < lanes; lane++) 
+    {
+      seeds[lane] = roundSeed(seed, first + b + lane);
+      memcpy(group + lane * size, deck, sizeof(Card) * size);
+    }
+    switch (lanes) 
+    {
+      case 1:
+        shuffleLanes(group, size, seeds, 1);
+        break;
+      case 4:
+        shuffleLanes(group, size, seeds, 4);
+        break;
+      case 8:
+        shuffleLanes(group, size, seeds, 8);
+        break;
+      default:
+        shuffleLanes(group, size, seeds, MAX_LANES);
+        break;
+    }
+  }
+  endStage();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Fills a strategy that hits every total below @stand_on.
+///
+/// @param strategy The strategy to fill.
+/// @param stand_on The score at which the player stands.
+///
+//
+void thresholdStrategy(Strategy* strategy, int stand_on)
+{
+  for (int soft = 0; soft < 2; soft++) 
+  {
+    for (int total = 0; total < 22; total++) 
+    {
+      memset(strategy->hit_[soft][total], total < stand_on, 12);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Plays one round without any output, following the same rules as the
+/// interactive game. The player hits as long as @strategy says so and the
+/// dealer draws while behind the player. When the dealer stops without 21 and
+/// without busting, the interactive game hands the turn back to the player;
+/// a player who stands again leaves the higher score as the winner.
+///
+/// @param cards The shuffled deck to deal from (unshuffled if @tilt is set).
+/// @param strategy The player's decisions.
+/// @param round The result of the round.
+/// @param tilt The importance sampling state, NULL for a shuffled deck.
+///
+//
+void playRound(Card* cards, Strategy* strategy, Round* round, Tilt* tilt)
+{
+  Card dealer[DECK_SIZE];
+  Card player[DECK_SIZE];
+  int card_count = 0;
+  int dealer_count = 0;
+  int player_count = 0;
+  int dealer_score = 0;
+  int player_score = 0;
+
+  prepareCards(cards, card_count, 2, tilt, 0);
+  giveCards(cards, player, &card_count, &player_count, &player_score, 2);
+  prepareCards(cards, card_count, 2, tilt, 1);
+  giveCards(cards, dealer, &card_count, &dealer_count, &dealer_score, 2);
+
+  int outcome;
+  if (player_score == 21) 
+  {
+    outcome = dealer_score == 21 ? OUTCOME_PUSH : OUTCOME_BLACKJACK;
+  }
+  else 
+  {
+    int soft = player[0].points_ == 11 ||
+     (player[1].points_ == 11 && player[0].points_ <= 10);
+    int upcard = dealer[0].points_;
+    while (player_score < 21 && strategy->hit_[soft][player_score][upcard]) 
+    {
+      prepareCards(cards, card_count, 1, tilt, 0);
+      soft |= cards[card_count].points_ == 11 && player_score <= 10;
+      giveCards(cards, player, &card_count, &player_count, &player_score, 1);
+    }
+
+    if (player_score > 21) 
+    {
+      outcome = OUTCOME_LOSE;
+    }
+    else if (dealer_score == 21) 
+    {
+      outcome = OUTCOME_LOSE;
+    }
+    else 
+    {
+      while (dealer_score < player_score) 
+      {
+        prepareCards(cards, card_count, 1, tilt, 1);
+        giveCards(cards, dealer, &card_count, &dealer_count, &dealer_score, 1);
+      }
+      if (dealer_score == 21) 
+      {
+        outcome = player_score == 21 ? OUTCOME_PUSH : OUTCOME_LOSE;
+      }
+      else if (dealer_score > 21) 
+      {
+        outcome = OUTCOME_WIN;
+      }
+      else 
+      {
+        outcome = dealer_score == player_score ? OUTCOME_PUSH : OUTCOME_LOSE;
+      }
+    }
+  }
+
+  round->outcome_ = outcome;
+  round->player_score_ = player_score;
+  round->dealer_score_ = dealer_score;
+  round->player_count_ = player_count;
+  round->dealer_count_ = dealer_count;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Adds the outcome of one round to the statistics.
+///
+/// @param stats The statistics to update.
+/// @param outcome The outcome of the round.
+///
+//
+void addOutcome(Stats* stats, int outcome)
+{
+  stats->rounds_++;
+  if (outcome == OUTCOME_WIN) 
+  {
+    stats->wins_++;
+  }
+  else if (outcome == OUTCOME_BLACKJACK) 
+  {
+    stats->wins_++;
+    stats->blackjacks_++;
+  }
+  else if (outcome == OUTCOME_LOSE) 
+  {
+    stats->losses_++;
+  }
+  else 
+  {
+    stats->pushes_++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Deals the shoe of round @r (see roundShoe) and plays it.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param r The index of the round.
+/// @param strategy The player's decisions.
+/// @param round The result of the round.
+///
+//
+void simulateRound(Card* deck, int seed, long long r, Strategy* strategy,
+ Round* round)
+{
+  Card cards[MAX_SHOE_SIZE];
+  roundShoe(cards, deck, seed, r);
+  playRound(cards, strategy, round, NULL);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Adds @from statistics to @to.
+///
+//
+void mergeStats(Stats* to, Stats* from)
+{
+  to->rounds_ += from->rounds_;
+  to->wins_ += from->wins_;
+  to->losses_ += from->losses_;
+  to->pushes_ += from->pushes_;
+  to->blackjacks_ += from->blackjacks_;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Copies local statistics into a worker's shared slot. Readers only look
+/// at the counters after the slot is marked done, so relaxed stores are
+/// enough while the worker is still running.
+///
+/// @param slot The shared slot of the worker.
+/// @param stats The worker's statistics.
+///
+//
+void publishStats(WorkerSlot* slot, Stats* stats)
+{
+  atomic_store_explicit(&slot->wins_, stats->wins_, memory_order_relaxed);
+  atomic_store_explicit(&slot->losses_, stats->losses_, memory_order_relaxed);
+  atomic_store_explicit(&slot->pushes_, stats->pushes_, memory_order_relaxed);
+  atomic_store_explicit(&slot->blackjacks_, stats->blackjacks_,
+   memory_order_relaxed);
+  atomic_store_explicit(&slot->rounds_, stats->rounds_, memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes @value as 4 little-endian bytes.
+///
+//
+void writeU32(FILE* file, unsigned value)
+{
+  unsigned char bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+  fwrite(bytes, 1, 4, file);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Compresses one column of a block into @out. Integer columns are stored
+/// as zigzag varints of the difference to the previous row, which keeps
+/// round numbers, scores and outcomes at about one byte per row. Float
+/// columns are stored as raw 8-byte values.
+///
+/// @param values The column values.
+/// @param rows The number of rows.
+/// @param type COLUMN_INT or COLUMN_FLOAT.
+/// @param out The output buffer (at least 10 bytes per row).
+/// @return int The compressed size in bytes.
+///
+//
+int encodeColumn(long long* values, int rows, int type, unsigned char* out)
+{
+  int size = 0;
+  long long previous = 0;
+  for (int i = 0; i < rows; i++) 
+  {
+    unsigned long long bits = values[i];
+    if (type == COLUMN_INT) 
+    {
+      long long delta = values[i] - previous;
+      previous = values[i];
+      bits = ((unsigned long long)delta << 1) ^
+       (unsigned long long)(delta >> 63);
+      while (bits >= 0x80) 
+      {
+        out[size++] = (bits & 0x7f) | 0x80;
+        bits >>= 7;
+      }
+      out[size++] = bits;
+    }
+    else 
+    {
+      for (int b = 0; b < 8; b++) 
+      {
+        out[size++] = bits >> (8 * b);
+      }
+    }
+  }
+  return size;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Compresses and writes one block: the row count, then the byte length
+/// and data of every column.
+///
+//
+void writeBlock(Exporter* exporter, ExportBlock* block)
+{
+  writeU32(exporter->file_, block->rows_);
+  for (int c = 0; c < exporter->columns_; c++) 
+  {
+    int size = encodeColumn(block->values_[c], block->rows_,
+     exporter->schema_[c].type_, exporter->scratch_);
+    writeU32(exporter->file_, size);
+    fwrite(exporter->scratch_, 1, size, exporter->file_);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Background writer thread. Takes full blocks from the ring until the
+/// exporter is closed and every queued block is written.
+///
+//
+void* exportWriter(void* argument)
+{
+  Exporter* exporter = argument;
+  pthread_mutex_lock(&exporter->lock_);
+  while (1) 
+  {
+    while (exporter->queued_ == 0 && !exporter->closing_) 
+    {
+      pthread_cond_wait(&exporter->changed_, &exporter->lock_);
+    }
+    if (exporter->queued_ == 0) 
+    {
+      break;
+    }
+    ExportBlock* block = &exporter->blocks_[exporter->head_];
+    pthread_mutex_unlock(&exporter->lock_);
+
+    writeBlock(exporter, block);
+
+    pthread_mutex_lock(&exporter->lock_);
+    exporter->head_ = (exporter->head_ + 1) % EXPORT_BUFFERS;
+    exporter->queued_--;
+    pthread_cond_broadcast(&exporter->changed_);
+  }
+  pthread_mutex_unlock(&exporter->lock_);
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Opens a result file. Paths ending in ".csv" get a plain CSV file written
+/// as rows arrive; everything else gets the columnar format: the magic
+/// "BJC1", version, column count and the type and name of every column,
+/// then compressed blocks of up to EXPORT_BLOCK_ROWS rows written by a
+/// background thread, and a block with zero rows at the end.
+///
+/// @param exporter The exporter to open.
+/// @param path The file to write.
+/// @param schema The columns of the table.
+/// @param columns The number of columns.
+/// @return zero on success, otherwise error code
+///
+//
+int openExport(Exporter* exporter, char* path, Column* schema, int columns)
+{
+  memset(exporter, 0, sizeof(Exporter));
+  exporter->columns_ = columns;
+  exporter->schema_ = schema;
+  size_t length = strlen(path);
+  exporter->csv_ = length > 4 && strcmp(path + length - 4, ".csv") == 0;
+  exporter->file_ = fopen(path, exporter->csv_ ? "w" : "wb");
+  if (exporter->file_ == NULL) 
+  {
+    return fileError();
+  }
+
+  if (exporter->csv_) 
+  {
+    for (int c = 0; c < columns; c++) 
+    {
+      fprintf(exporter->file_, c == 0 ? "%s" : ",%s", schema[c].name_);
+    }
+    fprintf(exporter->file_, "\n");
+    return 0;
+  }
+
+  exporter->blocks_ = malloc(sizeof(ExportBlock) * EXPORT_BUFFERS);
+  exporter->scratch_ = malloc(EXPORT_BLOCK_ROWS * 10);
+  if (exporter->blocks_ == NULL || exporter->scratch_ == NULL) 
+  {
+    free(exporter->blocks_);
+    free(exporter->scratch_);
+    fclose(exporter->file_);
+    return memoryError();
+  }
+  exporter->blocks_[0].rows_ = 0;
+
+  fwrite(EXPORT_MAGIC, 1, 4, exporter->file_);
+  writeU32(exporter->file_, EXPORT_VERSION);
+  writeU32(exporter->file_, columns);
+  for (int c = 0; c < columns; c++) 
+  {
+    fputc(schema[c].type_, exporter->file_);
+    fputc(strlen(schema[c].name_), exporter->file_);
+    fputs(schema[c].name_, exporter->file_);
+  }
+
+  pthread_mutex_init(&exporter->lock_, NULL);
+  pthread_cond_init(&exporter->changed_, NULL);
+  pthread_create(&exporter->writer_, NULL, exportWriter, exporter);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Hands the block being filled to the writer thread. Only waits when the
+/// writer is a whole ring of blocks behind.
+///
+//
+void flushBlock(Exporter* exporter)
+{
+  pthread_mutex_lock(&exporter->lock_);
+  exporter->queued_++;
+  pthread_cond_broadcast(&exporter->changed_);
+  while (exporter->queued_ == EXPORT_BUFFERS) 
+  {
+    pthread_cond_wait(&exporter->changed_, &exporter->lock_);
+  }
+  int fill = (exporter->head_ + exporter->queued_) % EXPORT_BUFFERS;
+  pthread_mutex_unlock(&exporter->lock_);
+  exporter->blocks_[fill].rows_ = 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Adds one row to a result file.
+///
+/// @param exporter The exporter.
+/// @param values One value per column; floats as their bit pattern.
+///
+//
+void exportRow(Exporter* exporter, long long* values)
+{
+  if (exporter->csv_) 
+  {
+    for (int c = 0; c < exporter->columns_; c++) 
+    {
+      if (c > 0) 
+      {
+        fputc(',', exporter->file_);
+      }
+      if (exporter->schema_[c].type_ == COLUMN_FLOAT) 
+      {
+        double value;
+        memcpy(&value, &values[c], sizeof(double));
+        fprintf(exporter->file_, "%.10g", value);
+      }
+      else 
+      {
+        fprintf(exporter->file_, "%lld", values[c]);
+      }
+    }
+    fputc('\n', exporter->file_);
+    return;
+  }
+
+  //the producer owns the block right after the queued ones
+  int fill = (exporter->head_ + exporter->queued_) % EXPORT_BUFFERS;
+  ExportBlock* block = &exporter->blocks_[fill];
+  for (int c = 0; c < exporter->columns_; c++) 
+  {
+    block->values_[c][block->rows_] = values[c];
+  }
+  if (++block->rows_ == EXPORT_BLOCK_ROWS) 
+  {
+    flushBlock(exporter);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the remaining rows, waits for the writer thread and closes the
+/// result file.
+///
+/// @return zero on success, FILE_ERROR if a write failed
+///
+//
+int closeExport(Exporter* exporter)
+{
+  if (!exporter->csv_) 
+  {
+    pthread_mutex_lock(&exporter->lock_);
+    int fill = (exporter->head_ + exporter->queued_) % EXPORT_BUFFERS;
+    if (exporter->blocks_[fill].rows_ > 0) 
+    {
+      exporter->queued_++;
+    }
+    exporter->closing_ = 1;
+    pthread_cond_broadcast(&exporter->changed_);
+    pthread_mutex_unlock(&exporter->lock_);
+    pthread_join(exporter->writer_, NULL);
+
+    writeU32(exporter->file_, 0);
+    pthread_mutex_destroy(&exporter->lock_);
+    pthread_cond_destroy(&exporter->changed_);
+    free(exporter->blocks_);
+    free(exporter->scratch_);
+  }
+  int failed = ferror(exporter->file_);
+  if (fclose(exporter->file_) != 0 || failed) 
+  {
+    return fileError();
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes per-configuration statistics as rows of a result file.
+///
+/// @param path The file to write.
+/// @param stand_on The stand_on value of the first configuration.
+/// @param results The statistics, one per configuration.
+/// @param count The number of configurations.
+/// @return zero on success, otherwise error code
+///
+//
+int exportConfigs(char* path, int stand_on, Stats* results, int count)
+{
+  Exporter exporter;
+  int result = openExport(&exporter, path, config_schema, CONFIG_COLUMNS);
+  if (result != 0) 
+  {
+    return result;
+  }
+  for (int i = 0; i < count; i++) 
+  {
+    Stats* stats = &results[i];
+    double net = stats->rounds_ > 0 ?
+     (double)(stats->wins_ - stats->losses_) / stats->rounds_ : 0.0;
+    long long values[CONFIG_COLUMNS] = { stand_on + i, stats->rounds_,
+     stats->wins_, stats->losses_, stats->pushes_, stats->blackjacks_ };
+    memcpy(&values[6], &net, sizeof(double));
+    exportRow(&exporter, values);
+  }
+  return closeExport(&exporter);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Reads a little-endian 4 byte value.
+///
+/// @return 1 on success, 0 at the end of the file
+///
+//
+int readU32(FILE* file, unsigned* value)
+{
+  unsigned char bytes[4];
+  if (fread(bytes, 1, 4, file) != 4) 
+  {
+    return 0;
+  }
+  *value = bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
+   (unsigned)bytes[3] << 24;
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints a columnar result file as CSV to stdout.
+///
+/// @param path The file to read.
+/// @return zero on success, FILE_ERROR if the file is not valid
+///
+//
+int dumpExport(char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+
+  char magic[4];
+  unsigned version = 0;
+  unsigned columns = 0;
+  int valid = fread(magic, 1, 4, file) == 4 &&
+   memcmp(magic, EXPORT_MAGIC, 4) == 0 && readU32(file, &version) &&
+   version == EXPORT_VERSION && readU32(file, &columns) &&
+   columns > 0 && columns <= MAX_COLUMNS;
+
+  int types[MAX_COLUMNS];
+  for (unsigned c = 0; valid && c < columns; c++) 
+  {
+    char name[256];
+    types[c] = fgetc(file);
+    int length = fgetc(file);
+    valid = length != EOF && fread(name, 1, length, file) == (size_t)length;
+    name[valid ? length : 0] = '\0';
+    printf(c == 0 ? "%s" : ",%s", name);
+  }
+  printf("\n");
+
+  ExportBlock* block = malloc(sizeof(ExportBlock));
+  unsigned char* data = malloc(EXPORT_BLOCK_ROWS * 10);
+  unsigned rows = 0;
+  while (valid && block != NULL && data != NULL && readU32(file, &rows) &&
+   rows > 0 && rows <= EXPORT_BLOCK_ROWS) 
+  {
+    for (unsigned c = 0; valid && c < columns; c++) 
+    {
+      unsigned size = 0;
+      valid = readU32(file, &size) && size <= EXPORT_BLOCK_ROWS * 10 &&
+       fread(data, 1, size, file) == size;
+      long long previous = 0;
+      unsigned at = 0;
+      for (unsigned i = 0; valid && i < rows; i++) 
+      {
+        unsigned long long bits = 0;
+        if (types[c] == COLUMN_FLOAT) 
+        {
+          for (int b = 0; b < 8 && at < size; b++) 
+          {
+            bits |= (unsigned long long)data[at++] << (8 * b);
+          }
+          block->values_[c][i] = bits;
+          continue;
+        }
+        int shift = 0;
+        while (at < size && (data[at] & 0x80)) 
+        {
+          bits |= (unsigned long long)(data[at++] & 0x7f) << shift;
+          shift += 7;
+        }
+        bits |= (unsigned long long)(at < size ? data[at++] : 0) << shift;
+        previous += (long long)(bits >> 1) ^ -(long long)(bits & 1);
+        block->values_[c][i] = previous;
+      }
+    }
+    for (unsigned i = 0; valid && i < rows; i++) 
+    {
+      for (unsigned c = 0; c < columns; c++) 
+      {
+        double value;
+        memcpy(&value, &block->values_[c][i], sizeof(double));
+        if (types[c] == COLUMN_FLOAT) 
+        {
+          printf(c == 0 ? "%.10g" : ",%.10g", value);
+        }
+        else 
+        {
+          printf(c == 0 ? "%lld" : ",%lld", block->values_[c][i]);
+        }
+      }
+      printf("\n");
+    }
+  }
+  valid = valid && rows == 0;
+
+  free(block);
+  free(data);
+  fclose(file);
+  return valid ? 0 : fileError();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Plays the rounds [@begin, @end) and publishes the results to @slot.
+/// Runs inside a forked worker process. Rounds are shuffled
+/// tuning.batch_ at a time (see shuffleBatch) and then played.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param begin The first round of the range.
+/// @param end One past the last round of the range.
+/// @param strategy The player's decisions.
+/// @param slot The shared slot of the worker.
+/// @param exporter Receives a row per round, or NULL.
+/// @return zero on success, otherwise error code
+///
+//
+int simulateRange(Card* deck, int seed, long long begin, long long end,
+ Strategy* strategy, WorkerSlot* slot, Exporter* exporter)
+{
+  Stats stats = { 0 };
+  Round round;
+  int size = definition.shoe_size_;
+  int batch = tuning.batch_;
+  Card* shoes = malloc(sizeof(Card) * size * (batch + MAX_LANES));
+  if (shoes == NULL) 
+  {
+    return memoryError();
+  }
+
+  beginStage(STAGE_SIMULATE);
+  for (long long first = begin; first < end; first += batch) 
+  {
+    int count = end - first < batch ? end - first : batch;
+    shuffleBatch(shoes, deck, seed, first, count);
+    for (int b = 0; b < count; b++) 
+    {
+      long long r = first + b;
+      playRound(shoes + b * size, strategy, &round, NULL);
+      addOutcome(&stats, round.outcome_);
+      if (exporter != NULL) 
+      {
+        long long values[ROUND_COLUMNS] = { r, round.outcome_,
+         round.player_score_, round.dealer_score_, round.player_count_,
+         round.dealer_count_ };
+        exportRow(exporter, values);
+      }
+      if (stats.rounds_ % PROGRESS_INTERVAL == 0) 
+      {
+        publishStats(slot, &stats);
+      }
+    }
+  }
+  endStage();
+  publishStats(slot, &stats);
+  free(shoes);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Range task of runSimulation. With a rounds file set, the worker writes
+/// its rounds to its own part file '<rounds_path>.<worker>'
+/// ('<name>.<worker>.csv' for CSV), which a restarted worker overwrites.
+///
+/// @return zero on success, otherwise error code
+///
+//
+int simulationTask(void* context, int worker, long long begin, long long end,
+ void* slot)
+{
+  SimulationTask* task = context;
+  char* rounds_path = task->rounds_path_;
+  Exporter exporter;
+  Exporter* rounds_export = NULL;
+  if (rounds_path != NULL) 
+  {
+    char part_path[PATH_LENGTH + 8];
+    int length = strlen(rounds_path);
+    int csv = length > 4 && strcmp(rounds_path + length - 4, ".csv") == 0;
+    snprintf(part_path, sizeof(part_path), csv ? "%.*s.%d.csv" : "%.*s.%d",
+     csv ? length - 4 : length, rounds_path, worker);
+    int result = openExport(&exporter, part_path, round_schema,
+     ROUND_COLUMNS);
+    if (result != 0) 
+    {
+      return result;
+    }
+    rounds_export = &exporter;
+  }
+  int result = simulateRange(task->deck_, task->seed_, begin, end,
+   task->strategy_, slot, rounds_export);
+  int closed = rounds_export != NULL ? closeExport(rounds_export) : 0;
+  return result != 0 ? result : closed;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Forks a worker process that runs @task for the range [@begin, @end).
+/// The slot is marked done only if the task succeeds.
+///
+/// @return pid_t The pid of the worker, or -1 if fork failed.
+///
+//
+pid_t startWorker(RangeTask task, void* context, int worker,
+ long long begin, long long end, void* slot, size_t slot_size)
+{
+  memset(slot, 0, slot_size);
+  atomic_store((atomic_int*)slot, SLOT_RUNNING);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) 
+  {
+    forkCounters();
+    if (task(context, worker, begin, end, slot) != 0) 
+    {
+      _exit(1);
+    }
+    chargeStage();
+    atomic_store_explicit((atomic_int*)slot, SLOT_DONE, memory_order_release);
+    _exit(0);
+  }
+  return pid;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Splits @rounds into one disjoint range per worker and runs @task on
+/// each of them in a forked process. Workers report through their own
+/// slot of @slot_size bytes in the shared @slots region; every slot starts
+/// with its atomic state. A worker that dies before finishing has its
+/// slot cleared and its range handed to a new worker, so the results are
+/// the same as in a run without crashes.
+///
+/// @param rounds The number of rounds to play.
+/// @param workers The number of worker processes.
+/// @param task The work of one range.
+/// @param context Passed to @task.
+/// @param slots The shared region, @workers slots long.
+/// @param slot_size The size of one slot.
+/// @return zero on success, SIMULATION_ERROR if a range kept failing
+///
+//
+int runRanges(long long rounds, int workers, RangeTask task, void* context,
+ char* slots, size_t slot_size)
+{
+  pid_t pids[MAX_WORKERS];
+  int retries[MAX_WORKERS] = { 0 };
+  int running = 0;
+  int result = 0;
+  checkCorpusRounds(rounds); //once here rather than in every worker
+
+  for (int w = 0; w < workers; w++) 
+  {
+    long long begin = rounds * w / workers;
+    long long end = rounds * (w + 1) / workers;
+    pids[w] = startWorker(task, context, w, begin, end,
+     slots + w * slot_size, slot_size);
+    if (pids[w] < 0) 
+    {
+      result = SIMULATION_ERROR;
+      break;
+    }
+    running++;
+  }
+
+  while (running > 0) 
+  {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) 
+    {
+      result = SIMULATION_ERROR;
+      break;
+    }
+
+    int w = 0;
+    while (w < workers && pids[w] != pid) 
+    {
+      w++;
+    }
+    if (w == workers) 
+    {
+      continue;
+    }
+    running--;
+    pids[w] = 0;
+
+    int done = atomic_load_explicit((atomic_int*)(slots + w * slot_size),
+     memory_order_acquire) == SLOT_DONE;
+    if (done && WIFEXITED(status) && WEXITSTATUS(status) == 0) 
+    {
+      continue;
+    }
+    if (result != 0 || retries[w] == MAX_WORKER_RETRIES) 
+    {
+      result = SIMULATION_ERROR;
+      continue;
+    }
+
+    //reassign the range of the crashed worker
+    retries[w]++;
+    long long begin = rounds * w / workers;
+    long long end = rounds * (w + 1) / workers;
+    printf("[WARN] Worker %d died, restarting rounds %lld-%lld.\n",
+     w, begin, end - 1);
+    pids[w] = startWorker(task, context, w, begin, end,
+     slots + w * slot_size, slot_size);
+    if (pids[w] < 0) 
+    {
+      result = SIMULATION_ERROR;
+      continue;
+    }
+    running++;
+  }
+
+  if (result != 0) 
+  {
+    printf("[ERR] Simulation failed.\n");
+  }
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Runs @rounds simulated rounds on @workers forked processes. Every worker
+/// gets a disjoint range of round substreams and reports through its own
+/// slot in a shared memory region (see runRanges).
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param rounds The number of rounds to play.
+/// @param workers The number of worker processes.
+/// @param strategy The player's decisions.
+/// @param rounds_path Where workers write per-round results, or NULL.
+/// @param total The merged statistics of all workers.
+/// @return zero on success, otherwise error code
+///
+//
+int runSimulation(Card* deck, int seed, long long rounds, int workers,
+ Strategy* strategy, char* rounds_path, Stats* total)
+{
+  size_t region_size = sizeof(WorkerSlot) * workers;
+  WorkerSlot* slots = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (slots == MAP_FAILED) 
+  {
+    return memoryError();
+  }
+
+  SimulationTask task = { deck, seed, strategy, rounds_path };
+  int result = runRanges(rounds, workers, simulationTask, &task,
+   (char*)slots, sizeof(WorkerSlot));
+
+  memset(total, 0, sizeof(Stats));
+  for (int w = 0; w < workers && result == 0; w++) 
+  {
+    total->rounds_ += atomic_load(&slots[w].rounds_);
+    total->wins_ += atomic_load(&slots[w].wins_);
+    total->losses_ += atomic_load(&slots[w].losses_);
+    total->pushes_ += atomic_load(&slots[w].pushes_);
+    total->blackjacks_ += atomic_load(&slots[w].blackjacks_);
+  }
+
+  munmap(slots, region_size);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the monotonic clock in nanoseconds.
+///
+//
+long long nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the path of this machine's tuning profile: $BLACKJACK_PROFILE, or
+/// '.blackjack-<host>.profile' in the home folder.
+///
+//
+void profilePath(char* path, size_t size)
+{
+  char* configured = getenv(PROFILE_ENV);
+  if (configured != NULL) 
+  {
+    snprintf(path, size, "%s", configured);
+    return;
+  }
+  char host[FILE_NAME_LENGTH] = "localhost";
+  gethostname(host, sizeof(host) - 1);
+  char* home = getenv("HOME");
+  snprintf(path, size, "%s/" PROFILE_NAME, home != NULL ? home : ".", host);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Loads this machine's tuning profile into tuning. A profile tuned on a
+/// different number of CPUs is ignored.
+///
+/// @return 1 if the profile is loaded, otherwise 0
+///
+//
+int loadProfile(void)
+{
+  char path[2 * PATH_LENGTH];
+  profilePath(path, sizeof(path));
+  FILE* file = fopen(path, "r");
+  if (file == NULL) 
+  {
+    return 0;
+  }
+  Tuning tuned;
+  int cpus;
+  int valid = fscanf(file, "cpus %d workers %d lanes %d batch %d", &cpus,
+   &tuned.workers_, &tuned.lanes_, &tuned.batch_) == 4 &&
+   cpus == sysconf(_SC_NPROCESSORS_ONLN) && tuned.workers_ >= 1 &&
+   tuned.workers_ <= MAX_WORKERS && tuned.batch_ >= 1 &&
+   tuned.batch_ <= MAX_BATCH && (tuned.lanes_ == 0 || tuned.lanes_ == 1 ||
+   tuned.lanes_ == 4 || tuned.lanes_ == 8 || tuned.lanes_ == MAX_LANES);
+  fclose(file);
+  if (valid) 
+  {
+    tuning = tuned;
+  }
+  return valid;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Measures how fast simulations run on this machine with every shuffle
+/// kernel (rand() or shuffleLanes with 1, 4, 8 or MAX_LANES lanes) and
+/// batch size in one process, the best of TUNE_REPEATS runs, then with the
+/// fastest of them and every worker count up to the number of CPUs. The
+/// fastest configuration is put into tuning and saved as this machine's
+/// profile (see profilePath), which later simulations load. All
+/// configurations play the same cards.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @return zero on success, otherwise error code
+///
+//
+int tuneSimulation(Card* deck, int seed)
+{
+  int kernels[] = { 0, 1, 4, 8, MAX_LANES };
+  int batches[] = { 16, 64, 256, MAX_BATCH };
+  int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1) 
+  {
+    cpus = 1;
+  }
+  Strategy strategy;
+  thresholdStrategy(&strategy, DEFAULT_STAND_ON);
+  WorkerSlot slot;
+  Tuning best = { 1, 0, 1 };
+  double best_rate = 0;
+
+  printf("%-8s %6s %14s\n", "LANES", "BATCH", "ROUNDS/S");
+  for (int k = 0; k < (int)(sizeof(kernels) / sizeof(int)); k++) 
+  {
+    for (int b = 0; b < (int)(sizeof(batches) / sizeof(int)); b++) 
+    {
+      Tuning candidate = { 1, kernels[k], batches[b] };
+      tuning = candidate;
+      double rate = 0;
+      for (int repeat = 0; repeat < TUNE_REPEATS; repeat++) 
+      {
+        long long start = nowNs();
+        int result = simulateRange(deck, seed, 0, TUNE_ROUNDS, &strategy,
+         &slot, NULL);
+        if (result != 0) 
+        {
+          return result;
+        }
+        double repeat_rate = TUNE_ROUNDS * 1e9 / (nowNs() - start);
+        rate = repeat_rate > rate ? repeat_rate : rate;
+      }
+      char lanes[OPTION_INPUT_LENGTH] = "rand";
+      if (kernels[k] != 0) 
+      {
+        snprintf(lanes, sizeof(lanes), "%d", kernels[k]);
+      }
+      printf("%-8s %6d %14.0f\n", lanes, batches[b], rate);
+      if (rate > best_rate) 
+      {
+        best = candidate;
+        best_rate = rate;
+      }
+    }
+  }
+
+  printf("%-8s %14s\n", "WORKERS", "ROUNDS/S");
+  best_rate = 0;
+  int fastest = 1;
+  for (int workers = 1; workers <= cpus && workers <= MAX_WORKERS;
+   workers = workers < cpus && workers * 2 > cpus ? cpus : workers * 2) 
+  {
+    Stats stats;
+    tuning = best;
+    long long rounds = (long long)TUNE_ROUNDS * workers * TUNE_WORKER_ROUNDS;
+    long long start = nowNs();
+    int result = runSimulation(deck, seed, rounds, workers, &strategy, NULL,
+     &stats);
+    if (result != 0) 
+    {
+      return result;
+    }
+    double rate = rounds * 1e9 / (nowNs() - start);
+    printf("%-8d %14.0f\n", workers, rate);
+    if (rate > best_rate) 
+    {
+      fastest = workers;
+      best_rate = rate;
+    }
+  }
+  best.workers_ = fastest;
+  tuning = best;
+
+  char path[2 * PATH_LENGTH];
+  profilePath(path, sizeof(path));
+  FILE* file = fopen(path, "w");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+  fprintf(file, "cpus %d\nworkers %d\nlanes %d\nbatch %d\n", cpus,
+   tuning.workers_, tuning.lanes_, tuning.batch_);
+  if (fclose(file) != 0) 
+  {
+    return fileError();
+  }
+  printf("PROFILE: %s (WORKERS %d, LANES %d, BATCH %d)\n", path,
+   tuning.workers_, tuning.lanes_, tuning.batch_);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Opens a shoe audit log for appending, writing its header if it is new.
+/// An existing log must hold shoes of the current size.
+///
+/// @param path The log file.
+/// @return FILE* The log, or NULL on error.
+///
+//
+FILE* openAuditLog(char* path)
+{
+  FILE* file = fopen(path, "a+b");
+  if (file == NULL) 
+  {
+    return NULL;
+  }
+  unsigned char header[AUDIT_HEADER] = { 0 };
+  unsigned int shoe_size = definition.shoe_size_;
+  fseek(file, 0, SEEK_END);
+  if (ftell(file) == 0) 
+  {
+    memcpy(header, AUDIT_MAGIC, 4);
+    memcpy(header + 4, &shoe_size, sizeof(shoe_size));
+    if (fwrite(header, AUDIT_HEADER, 1, file) == 1) 
+    {
+      return file;
+    }
+  }
+  else 
+  {
+    rewind(file);
+    if (fread(header, AUDIT_HEADER, 1, file) == 1 &&
+     memcmp(header, AUDIT_MAGIC, 4) == 0 &&
+     memcmp(header + 4, &shoe_size, sizeof(shoe_size)) == 0) 
+    {
+      return file;
+    }
+  }
+  fclose(file);
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Appends a revealed shoe to an audit log: the hand number, the
+/// commitment, the salt and the rank codes of the cards (AUDIT_SHOE bytes
+/// before the codes, with the salt right before them, so the hashed
+/// message is contiguous).
+///
+/// @return zero on success, otherwise FILE_ERROR
+///
+//
+int logShoe(FILE* log, unsigned long long hand, Card* cards)
+{
+  unsigned char record[AUDIT_SHOE + MAX_SHOE_SIZE];
+  memcpy(record, &hand, sizeof(hand));
+  shoeSalt(hand, record + AUDIT_SHOE - SALT_SIZE);
+  commitShoe(cards, record + AUDIT_SHOE - SALT_SIZE, record + sizeof(hand));
+  shoeCodes(cards, record + AUDIT_SHOE);
+  return fwrite(record, AUDIT_SHOE + definition.shoe_size_, 1, log) == 1 ?
+   0 : FILE_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Tells whether rank codes hold exactly the cards of a shoe.
+///
+//
+int validShoe(unsigned char* codes)
+{
+  int copies[MAX_RANKS] = { 0 };
+  for (int i = 0; i < definition.shoe_size_; i++) 
+  {
+    if (codes[i] >= definition.ranks_) 
+    {
+      return 0;
+    }
+    copies[codes[i]]++;
+  }
+  for (int r = 0; r < definition.ranks_; r++) 
+  {
+    if (copies[r] != definition.copies_[r]) 
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Range task of runAudit: checks the shoes [@begin, @end) of the log,
+/// SHA_LANES at a time, against their commitments.
+///
+/// @return zero
+///
+//
+int auditTask(void* context, int worker, long long begin, long long end,
+ void* slot)
+{
+  (void)worker;
+  AuditTask* task = context;
+  AuditSlot* audit = slot;
+  size_t record_size = AUDIT_SHOE + definition.shoe_size_;
+  long long failed = 0;
+  long long first = 0;
+  for (long long r = begin; r < end; r += SHA_LANES) 
+  {
+    int count = end - r < SHA_LANES ? end - r : SHA_LANES;
+    unsigned char* messages[SHA_LANES];
+    unsigned char digests[SHA_LANES][SHA256_SIZE];
+    for (int lane = 0; lane < count; lane++) 
+    {
+      messages[lane] = task->records_ + (r + lane) * record_size +
+       AUDIT_SHOE - SALT_SIZE;
+    }
+    sha256Lanes(messages, count, SALT_SIZE + definition.shoe_size_, digests);
+    for (int lane = 0; lane < count; lane++) 
+    {
+      unsigned char* record = task->records_ + (r + lane) * record_size;
+      if (memcmp(digests[lane], record + sizeof(long long), SHA256_SIZE) !=
+       0 || !validShoe(record + AUDIT_SHOE)) 
+      {
+        failed++;
+        first = first == 0 ? r + lane + 1 : first;
+      }
+    }
+    if ((r - begin) % (PROGRESS_INTERVAL * SHA_LANES) == 0) 
+    {
+      atomic_store(&audit->checked_, r + count - begin);
+    }
+  }
+  atomic_store(&audit->checked_, end - begin);
+  atomic_store(&audit->failed_, failed);
+  atomic_store(&audit->first_failed_, first);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Audit mode: re-verifies every shoe of an audit log in @workers forked
+/// processes (see runRanges). A shoe passes if SHA-256 of its salt and
+/// cards matches the commitment made before it was dealt and the cards
+/// are exactly those of a shoe. The log is memory-mapped once and shared
+/// by all workers.
+///
+/// @param path The audit log.
+/// @param workers The number of worker processes.
+/// @return zero if every shoe passed, otherwise error code
+///
+//
+int runAudit(char* path, int workers)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < AUDIT_HEADER) 
+  {
+    if (fd >= 0) 
+    {
+      close(fd);
+    }
+    return fileError();
+  }
+  unsigned char* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  unsigned int shoe_size = definition.shoe_size_;
+  if (map == MAP_FAILED || memcmp(map, AUDIT_MAGIC, 4) != 0 ||
+   memcmp(map + 4, &shoe_size, sizeof(shoe_size)) != 0) 
+  {
+    if (map != MAP_FAILED) 
+    {
+      munmap(map, info.st_size);
+    }
+    return fileError();
+  }
+  madvise(map, info.st_size, MADV_SEQUENTIAL);
+  size_t record_size = AUDIT_SHOE + shoe_size;
+  long long shoes = (info.st_size - AUDIT_HEADER) / record_size;
+
+  size_t region_size = sizeof(AuditSlot) * workers;
+  AuditSlot* slots = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (slots == MAP_FAILED) 
+  {
+    munmap(map, info.st_size);
+    return memoryError();
+  }
+  AuditTask task = { map + AUDIT_HEADER };
+  long long start = nowNs();
+  int result = shoes > 0 ? runRanges(shoes, workers, auditTask, &task,
+   (char*)slots, sizeof(AuditSlot)) : 0;
+  double seconds = (nowNs() - start) / 1e9;
+
+  long long failed = 0;
+  long long first = 0;
+  for (int w = 0; w < workers && result == 0 && shoes > 0; w++) 
+  {
+    failed += atomic_load(&slots[w].failed_);
+    if (first == 0) 
+    {
+      first = atomic_load(&slots[w].first_failed_);
+    }
+  }
+  if (result == 0) 
+  {
+    printf("SHOES: %lld\n", shoes);
+    printf("FAILED: %lld\n", failed);
+    if (failed > 0) 
+    {
+      unsigned long long hand;
+      memcpy(&hand, map + AUDIT_HEADER + (first - 1) * record_size,
+       sizeof(hand));
+      printf("FIRST FAILED: shoe %lld (hand %llu)\n", first - 1, hand);
+    }
+    if (info.st_size - AUDIT_HEADER != shoes * (long long)record_size) 
+    {
+      printf("[WARN] Log ends in a partial shoe.\n");
+    }
+    printf("SHOES PER SECOND: %.0f\n", shoes / seconds);
+  }
+  munmap(slots, region_size);
+  munmap(map, info.st_size);
+  return result != 0 ? result : failed > 0 ? SIMULATION_ERROR : 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes an audit log of @shoes secure shuffles, each committed and
+/// revealed the way the server does it, for exercising the audit.
+///
+/// @param deck The unshuffled deck.
+/// @param path The audit log.
+/// @param shoes The number of shoes.
+/// @return zero on success, otherwise error code
+///
+//
+int writeCommitLog(Card* deck, char* path, long long shoes)
+{
+  if (!secure_shuffle && enableSecureShuffle() != 0) 
+  {
+    return SIMULATION_ERROR;
+  }
+  FILE* log = openAuditLog(path);
+  if (log == NULL) 
+  {
+    return fileError();
+  }
+  Card cards[MAX_SHOE_SIZE];
+  int result = 0;
+  for (long long h = 0; h < shoes && result == 0; h++) 
+  {
+    memcpy(cards, deck, sizeof(Card) * definition.shoe_size_);
+    secureShuffle(cards, definition.shoe_size_, h);
+    result = logShoe(log, h, cards);
+  }
+  if (fclose(log) != 0 || result != 0) 
+  {
+    return fileError();
+  }
+  printf("SHOES: %lld\n", shoes);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends one protocol message. Never raises SIGPIPE; a closed peer is
+/// reported as an error instead.
+///
+/// @return 1 on success, 0 on error
+///
+//
+int sendMessage(int fd, Message* msg)
+{
+  char* data = (char*)msg;
+  size_t left = sizeof(Message);
+  while (left > 0) 
+  {
+    ssize_t n = send(fd, data, left, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) 
+    {
+      continue;
+    }
+    if (n <= 0) 
+    {
+      return 0;
+    }
+    data += n;
+    left -= n;
+  }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Receives one protocol message.
+///
+/// @return 1 on success, 0 on error or when the peer closed the connection
+///
+//
+int receiveMessage(int fd, Message* msg)
+{
+  char* data = (char*)msg;
+  size_t left = sizeof(Message);
+  while (left > 0) 
+  {
+    ssize_t n = recv(fd, data, left, 0);
+    if (n < 0 && errno == EINTR) 
+    {
+      continue;
+    }
+    if (n <= 0) 
+    {
+      return 0;
+    }
+    data += n;
+    left -= n;
+  }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Creates a Unix stream socket and either binds it (@listening = 1) or
+/// connects it to @socket_path.
+///
+/// @return int The socket, or -1 on error.
+///
+//
+int openUnixSocket(char* socket_path, int listening)
+{
+  struct sockaddr_un addr;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) 
+  {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) 
+  {
+    return -1;
+  }
+  if (listening) 
+  {
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+     listen(fd, SOMAXCONN) < 0) 
+    {
+      close(fd);
+      return -1;
+    }
+  }
+  else if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) 
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sweep worker. Connects to the coordinator, then plays every job it is
+/// given and sends back the statistics. While playing it sends heartbeats
+/// so the coordinator can tell a slow worker from a dead one.
+///
+/// @param deck The unshuffled deck.
+/// @param socket_path The coordinator's socket.
+/// @return zero when the coordinator has no more work, otherwise error code
+///
+//
+int runWorker(Card* deck, char* socket_path)
+{
+  int fd = openUnixSocket(socket_path, 0);
+  if (fd < 0) 
+  {
+    printf("[ERR] Cannot connect to %s.\n", socket_path);
+    return SIMULATION_ERROR;
+  }
+
+  Message msg = { .type_ = MSG_REQUEST };
+  int ok = sendMessage(fd, &msg);
+  while (ok && receiveMessage(fd, &msg) && msg.type_ == MSG_JOB) 
+  {
+    Stats stats = { 0 };
+    Round round;
+    Strategy strategy;
+    thresholdStrategy(&strategy, msg.stand_on_);
+    long long last_beat = nowNs();
+    for (long long r = msg.begin_; r < msg.end_; r++) 
+    {
+      simulateRound(deck, msg.seed_, r, &strategy, &round);
+      addOutcome(&stats, round.outcome_);
+      if ((r & 1023) == 0 && nowNs() - last_beat > HEARTBEAT_MS * 1000000LL) 
+      {
+        Message beat = { .type_ = MSG_HEARTBEAT, .job_ = msg.job_ };
+        ok = sendMessage(fd, &beat);
+        last_beat = nowNs();
+      }
+    }
+    msg.type_ = MSG_RESULT;
+    msg.stats_ = stats;
+    ok = ok && sendMessage(fd, &msg);
+  }
+  close(fd);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Picks the next job for an idle worker. Pending jobs come first. When
+/// none are left, an idle worker steals a chunk that is still running on
+/// one other worker; both run it and the first result wins, so a slow or
+/// stalled worker does not hold up the end of the sweep.
+///
+/// @return int The index of the job, or -1 if there is nothing to do.
+///
+//
+int nextJob(Job* jobs, int job_count)
+{
+  int steal = -1;
+  for (int j = 0; j < job_count; j++) 
+  {
+    if (jobs[j].state_ == JOB_PENDING) 
+    {
+      return j;
+    }
+    if (steal == -1 && jobs[j].state_ == JOB_ASSIGNED && jobs[j].copies_ == 1) 
+    {
+      steal = j;
+    }
+  }
+  return steal;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Gives @peer its next job, or tells it to stop when the sweep is over.
+///
+//
+void assignJob(Peer* peer, Job* jobs, int job_count, int seed, int finished)
+{
+  Message msg = { .type_ = MSG_DONE };
+  int j = finished ? -1 : nextJob(jobs, job_count);
+  peer->job_ = j;
+  if (j >= 0) 
+  {
+    jobs[j].state_ = JOB_ASSIGNED;
+    jobs[j].copies_++;
+    msg.type_ = MSG_JOB;
+    msg.job_ = j;
+    msg.seed_ = seed;
+    msg.stand_on_ = jobs[j].stand_on_;
+    msg.begin_ = jobs[j].begin_;
+    msg.end_ = jobs[j].end_;
+  }
+  else if (!finished) 
+  {
+    return; //stays idle until a job is requeued or the sweep ends
+  }
+  if (!sendMessage(peer->fd_, &msg) || finished) 
+  {
+    close(peer->fd_);
+    peer->fd_ = -1;
+  }
+  peer->last_seen_ = nowNs();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Disconnects a dead or silent worker and puts its job back in the queue.
+///
+//
+void dropPeer(Peer* peer, Job* jobs)
+{
+  if (peer->job_ >= 0) 
+  {
+    Job* job = &jobs[peer->job_];
+    job->copies_--;
+    if (job->state_ != JOB_DONE && job->copies_ == 0) 
+    {
+      job->state_ = JOB_PENDING;
+    }
+  }
+  close(peer->fd_);
+  peer->fd_ = -1;
+  peer->job_ = -1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sweep coordinator. Splits every stand_on value between SWEEP_MIN_STAND
+/// and SWEEP_MAX_STAND into chunks of CHUNK_ROUNDS rounds, hands them out
+/// over a Unix socket and merges the results per configuration. Starts
+/// @workers local worker processes; more workers (from the 'worker'
+/// command) may connect at any time.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param rounds The number of rounds per configuration.
+/// @param workers The number of local worker processes.
+/// @param socket_path Where to listen for workers.
+/// @param results The merged statistics, one per configuration.
+/// @return zero on success, otherwise error code
+///
+//
+int runSweep(Card* deck, int seed, long long rounds, int workers,
+ char* socket_path, Stats* results)
+{
+  int configs = SWEEP_MAX_STAND - SWEEP_MIN_STAND + 1;
+  int chunks = (rounds + CHUNK_ROUNDS - 1) / CHUNK_ROUNDS;
+  int job_count = configs * chunks;
+  Job* jobs = malloc(sizeof(Job) * job_count);
+  if (jobs == NULL) 
+  {
+    return memoryError();
+  }
+  for (int j = 0; j < job_count; j++) 
+  {
+    jobs[j].stand_on_ = SWEEP_MIN_STAND + j / chunks;
+    jobs[j].state_ = JOB_PENDING;
+    jobs[j].copies_ = 0;
+    jobs[j].begin_ = (long long)(j % chunks) * CHUNK_ROUNDS;
+    jobs[j].end_ = jobs[j].begin_ + CHUNK_ROUNDS < rounds ?
+     jobs[j].begin_ + CHUNK_ROUNDS : rounds;
+  }
+  memset(results, 0, sizeof(Stats) * configs);
+
+  int listen_fd = openUnixSocket(socket_path, 1);
+  if (listen_fd < 0) 
+  {
+    free(jobs);
+    printf("[ERR] Cannot listen on %s.\n", socket_path);
+    return SIMULATION_ERROR;
+  }
+
+  int children = 0;
+  fflush(stdout);
+  for (int w = 0; w < workers; w++) 
+  {
+    pid_t pid = fork();
+    if (pid == 0) 
+    {
+      close(listen_fd);
+      forkCounters();
+      int result = runWorker(deck, socket_path);
+      chargeStage();
+      _exit(result == 0 ? 0 : 1);
+    }
+    children += pid > 0;
+  }
+
+  Peer peers[MAX_WORKERS];
+  struct pollfd fds[MAX_WORKERS + 1];
+  for (int p = 0; p < MAX_WORKERS; p++) 
+  {
+    peers[p].fd_ = -1;
+  }
+  int done = 0;
+  int result = 0;
+
+  while (done < job_count) 
+  {
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    int connected = 0;
+    for (int p = 0; p < MAX_WORKERS; p++) 
+    {
+      fds[p + 1].fd = peers[p].fd_;
+      fds[p + 1].events = POLLIN;
+      connected += peers[p].fd_ >= 0;
+    }
+    while (children > 0 && waitpid(-1, NULL, WNOHANG) > 0) 
+    {
+      children--;
+    }
+    if (connected == 0 && children == 0) 
+    {
+      printf("[ERR] No workers left.\n");
+      result = SIMULATION_ERROR;
+      break;
+    }
+
+    if (poll(fds, MAX_WORKERS + 1, HEARTBEAT_MS) < 0 && errno != EINTR) 
+    {
+      result = SIMULATION_ERROR;
+      break;
+    }
+    long long now = nowNs();
+
+    if (fds[0].revents & POLLIN) 
+    {
+      int fd = accept(listen_fd, NULL, NULL);
+      int p = 0;
+      while (p < MAX_WORKERS && peers[p].fd_ >= 0) 
+      {
+        p++;
+      }
+      if (p == MAX_WORKERS) 
+      {
+        close(fd);
+      }
+      else if (fd >= 0) 
+      {
+        peers[p].fd_ = fd;
+        peers[p].job_ = -1;
+        peers[p].last_seen_ = now;
+      }
+    }
+
+    for (int p = 0; p < MAX_WORKERS; p++) 
+    {
+      Peer* peer = &peers[p];
+      if (peer->fd_ < 0 || fds[p + 1].fd != peer->fd_) 
+      {
+        continue;
+      }
+      if (fds[p + 1].revents & (POLLIN | POLLHUP | POLLERR)) 
+      {
+        Message msg;
+        if (!receiveMessage(peer->fd_, &msg)) 
+        {
+          dropPeer(peer, jobs);
+          continue;
+        }
+        peer->last_seen_ = now;
+        if (msg.type_ == MSG_RESULT && msg.job_ == peer->job_) 
+        {
+          Job* job = &jobs[msg.job_];
+          job->copies_--;
+          if (job->state_ != JOB_DONE) 
+          {
+            job->state_ = JOB_DONE;
+            mergeStats(&results[job->stand_on_ - SWEEP_MIN_STAND],
+             &msg.stats_);
+            done++;
+          }
+          peer->job_ = -1;
+        }
+        if (msg.type_ != MSG_HEARTBEAT && peer->job_ == -1) 
+        {
+          assignJob(peer, jobs, job_count, seed, done == job_count);
+        }
+      }
+      else if (peer->job_ >= 0 &&
+       now - peer->last_seen_ > HEARTBEAT_TIMEOUT_MS * 1000000LL) 
+      {
+        printf("[WARN] Worker stopped responding, requeueing its chunk.\n");
+        dropPeer(peer, jobs);
+      }
+    }
+
+    //idle workers pick up requeued chunks or chunks they can steal
+    for (int p = 0; p < MAX_WORKERS; p++) 
+    {
+      if (peers[p].fd_ >= 0 && peers[p].job_ == -1) 
+      {
+        assignJob(&peers[p], jobs, job_count, seed, done == job_count);
+      }
+    }
+  }
+
+  for (int p = 0; p < MAX_WORKERS; p++) 
+  {
+    if (peers[p].fd_ >= 0) 
+    {
+      Message msg = { .type_ = MSG_DONE };
+      sendMessage(peers[p].fd_, &msg);
+      close(peers[p].fd_);
+    }
+  }
+  close(listen_fd);
+  unlink(socket_path);
+  while (children > 0 && waitpid(-1, NULL, 0) > 0) 
+  {
+    children--;
+  }
+  free(jobs);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the results of a sweep as a table to stdout.
+///
+/// @param results The statistics, one per stand_on value.
+///
+//
+void printSweep(Stats* results)
+{
+  printf("STAND ON     ROUNDS    WINS%%  LOSSES%%  PUSHES%%        NET\n");
+  for (int i = 0; i <= SWEEP_MAX_STAND - SWEEP_MIN_STAND; i++) 
+  {
+    Stats* stats = &results[i];
+    double n = stats->rounds_ > 0 ? (double)stats->rounds_ : 1.0;
+    printf("%8d %10lld %8.4f %8.4f %8.4f %+10.5f\n", SWEEP_MIN_STAND + i,
+     stats->rounds_, 100.0 * stats->wins_ / n, 100.0 * stats->losses_ / n,
+     100.0 * stats->pushes_ / n, (stats->wins_ - stats->losses_) / n);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes simulation statistics to stdout.
+///
+/// @param stats The statistics to print.
+///
+//
+void printStats(Stats* stats)
+{
+  double n = stats->rounds_ > 0 ? (double)stats->rounds_ : 1.0;
+  printf("ROUNDS: %lld\n", stats->rounds_);
+  printf("WINS: %lld (%.4f%%)\n", stats->wins_, 100.0 * stats->wins_ / n);
+  printf("BLACKJACKS: %lld (%.4f%%)\n", stats->blackjacks_,
+   100.0 * stats->blackjacks_ / n);
+  printf("LOSSES: %lld (%.4f%%)\n", stats->losses_,
+   100.0 * stats->losses_ / n);
+  printf("PUSHES: %lld (%.4f%%)\n", stats->pushes_,
+   100.0 * stats->pushes_ / n);
+  printf("NET PER ROUND: %+.5f\n", (stats->wins_ - stats->losses_) / n);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Estimates the probability of a rare event with importance sampling.
+/// Every round is shuffled lazily while it is dealt, with the cards of the
+/// hand the event is about drawn from a deal tilted toward low cards. A
+/// round that shows the event is weighted by the likelihood ratio of the
+/// cards it used, which keeps the estimate unbiased. The effective sample
+/// size tells how many plain rounds with a hit the weighted hits are worth.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param event EVENT_DEALER_SIX (dealer makes 21 with six cards) or
+///        EVENT_PLAYER_SEVEN (player holds seven cards).
+/// @param rounds The number of rounds to play.
+/// @param stand_on The score at which the player stands.
+/// @param tilt The bias toward low cards.
+///
+//
+void runRareEvent(Card* deck, int seed, int event, long long rounds,
+ int stand_on, double tilt)
+{
+  Strategy strategy;
+  thresholdStrategy(&strategy, stand_on);
+  Card cards[MAX_SHOE_SIZE];
+  Round round;
+  long long hits = 0;
+  double sum = 0.0;
+  double sum_squares = 0.0;
+
+  for (long long r = 0; r < rounds; r++) 
+  {
+    Tilt state = { 1.0, 1.0, 1.0 };
+    if (event == EVENT_DEALER_SIX) 
+    {
+      state.dealer_ = tilt;
+    }
+    else 
+    {
+      state.player_ = tilt;
+    }
+    memcpy(cards, deck, sizeof(Card) * definition.shoe_size_);
+    srand(roundSeed(seed, r));
+    playRound(cards, &strategy, &round, &state);
+
+    int hit = event == EVENT_DEALER_SIX ?
+     round.dealer_count_ == 6 && round.dealer_score_ == 21 :
+     round.player_count_ >= 7;
+    if (hit) 
+    {
+      hits++;
+      sum += state.weight_;
+      sum_squares += state.weight_ * state.weight_;
+    }
+  }
+
+  double estimate = sum / rounds;
+  double variance = (sum_squares / rounds - estimate * estimate) / rounds;
+  printf("ROUNDS: %lld\n", rounds);
+  printf("HITS: %lld\n", hits);
+  printf("ESTIMATE: %.6e\n", estimate);
+  printf("STD ERROR: %.6e\n", variance > 0.0 ? sqrt(variance) : 0.0);
+  printf("EFFECTIVE SAMPLE SIZE: %.1f\n",
+   sum_squares > 0.0 ? sum * sum / sum_squares : 0.0);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the size of a snapshot of a game with the current definition.
+///
+//
+int snapshotSize(void)
+{
+  return SNAPSHOT_SHOE + (definition.shoe_size_ + 1) / 2;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the complete state of a game into a snapshotSize() byte snapshot:
+///
+///   0  "BJS" and the format version
+///   4  shuffle seed (little-endian)
+///   8  dealt cards (two bytes), dealer's cards, player's cards, dealer's
+///      score, player's score and whose turn it is, one byte each
+///   16 shoe size (two bytes)
+///   24 the dealer's hand as 4-bit ranks (up to SNAPSHOT_HAND cards)
+///   32 the player's hand as 4-bit ranks (up to SNAPSHOT_HAND cards)
+///   40 the shoe as 4-bit ranks, two cards per byte
+///
+/// The seed is all the random state a game has: the shoe is shuffled once
+/// when the game is dealt.
+///
+/// @param game The game to save.
+/// @param out The snapshot, at least SNAPSHOT_SIZE bytes.
+/// @return int The size of the snapshot.
+///
+//
+int saveGame(Game* game, unsigned char* out)
+{
+  int size = snapshotSize();
+  memset(out, 0, size);
+  memcpy(out, SNAPSHOT_MAGIC, 3);
+  out[3] = SNAPSHOT_VERSION;
+  for (int b = 0; b < 4; b++) 
+  {
+    out[4 + b] = (unsigned)game->seed_ >> (8 * b);
+  }
+  out[8] = game->card_count_;
+  out[9] = game->card_count_ >> 8;
+  out[10] = game->dealer_count_;
+  out[11] = game->player_count_;
+  out[12] = game->dealer_score_;
+  out[13] = game->player_score_;
+  out[14] = game->players_turn_;
+  out[16] = definition.shoe_size_;
+  out[17] = definition.shoe_size_ >> 8;
+  packRanks(game->dealer_, game->dealer_count_, out + 24);
+  packRanks(game->player_, game->player_count_, out + 32);
+  packRanks(game->cards_, definition.shoe_size_, out + SNAPSHOT_SHOE);
+  return size;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Restores a game from a snapshot written by saveGame. The snapshot must
+/// come from a game with the same definition.
+///
+/// @param game The restored game.
+/// @param in The snapshot, snapshotSize() bytes.
+/// @param ranks One card of every rank, indexed by rank.
+/// @return zero on success, FILE_ERROR if the snapshot is not valid
+///
+//
+int restoreGame(Game* game, unsigned char* in, Card* ranks)
+{
+  int card_count = in[8] | in[9] << 8;
+  if (memcmp(in, SNAPSHOT_MAGIC, 3) != 0 || in[3] != SNAPSHOT_VERSION ||
+   (in[16] | in[17] << 8) != definition.shoe_size_ ||
+   card_count > definition.shoe_size_ || in[10] > SNAPSHOT_HAND ||
+   in[11] > SNAPSHOT_HAND || in[10] + in[11] != card_count ||
+   in[14] > PLAYERS_TURN_AGAIN) 
+  {
+    return FILE_ERROR;
+  }
+  game->seed_ = (int)(in[4] | in[5] << 8 | in[6] << 16 |
+   (unsigned)in[7] << 24);
+  game->card_count_ = card_count;
+  game->dealer_count_ = in[10];
+  game->player_count_ = in[11];
+  game->dealer_score_ = in[12];
+  game->player_score_ = in[13];
+  game->players_turn_ = in[14];
+  if (!unpackRanks(in + SNAPSHOT_SHOE, definition.shoe_size_, ranks,
+   game->cards_) ||
+   !unpackRanks(in + 24, game->dealer_count_, ranks, game->dealer_) ||
+   !unpackRanks(in + 32, game->player_count_, ranks, game->player_)) 
+  {
+    return FILE_ERROR;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Picks one card of every rank out of @deck.
+///
+/// @param deck The deck.
+/// @param ranks One card per rank, indexed by rank.
+///
+//
+void rankTable(Card* deck, Card* ranks)
+{
+  for (int i = 0; i < definition.shoe_size_; i++) 
+  {
+    ranks[deck[i].rank_] = deck[i];
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Shuffles a copy of @deck with @seed and deals two cards to the player
+/// and two to the dealer. The player is on turn.
+///
+/// @param game The game to start.
+/// @param deck The unshuffled deck.
+/// @param seed The shuffle seed; the nonce of a secure shuffle, or the
+///        shoe when dealing from a corpus.
+///
+//
+void dealGame(Game* game, Card* deck, int seed)
+{
+  memcpy(game->cards_, deck, sizeof(Card) * definition.shoe_size_);
+  if (secure_shuffle) 
+  {
+    secureShuffle(game->cards_, definition.shoe_size_, (unsigned int)seed);
+  }
+  else if (corpus.codes_ != NULL) 
+  {
+    corpusShoe((unsigned int)seed, game->cards_);
+  }
+  else 
+  {
+    FisherYates(game->cards_, definition.shoe_size_, seed);
+  }
+  game->seed_ = seed;
+  game->card_count_ = 0;
+  game->dealer_count_ = 0;
+  game->player_count_ = 0;
+  game->dealer_score_ = 0;
+  game->player_score_ = 0;
+  game->players_turn_ = 1; //player starts first
+
+  giveCards(game->cards_, game->player_, &game->card_count_,
+   &game->player_count_, &game->player_score_, 2);
+  giveCards(game->cards_, game->dealer_, &game->card_count_,
+   &game->dealer_count_, &game->dealer_score_, 2);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Tells whether the analysis of @generation should stop, checking the
+/// current generation every PROGRESS_INTERVAL search nodes.
+///
+//
+int analysisCancelled(Analysis* analysis, int generation)
+{
+  if (++analysis->nodes_ % PROGRESS_INTERVAL == 0 &&
+   atomic_load(&analysis->generation_) != generation) 
+  {
+    analysis->cancelled_ = 1;
+  }
+  return analysis->cancelled_;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Estimates standValue where the exact search would take too long: the
+/// dealer draws with replacement with the probabilities of @counts, as
+/// from an infinite shoe of that composition. His result then depends on
+/// his score and number of cards only, so one pass over those states
+/// gives it.
+///
+//
+double standEstimate(int* counts, int total, int player, int dealer,
+ int dealer_cards, double weight, double* bust)
+{
+  //by dealer's score and number of cards (1, 2, or 3 and more)
+  double values[DEALER_STATES][4];
+  double busts[DEALER_STATES][4];
+  if (total == 0) 
+  {
+    return 0.0;
+  }
+  for (int d = DEALER_STATES - 1; d >= 2; d--) 
+  {
+    for (int c = 1; c <= 3; c++) 
+    {
+      values[d][c] = 0.0;
+      busts[d][c] = 0.0;
+      if (c == 2 && d == 21) 
+      {
+        values[d][c] = -1.0;
+      }
+      else if (c >= 2 && d >= player) 
+      {
+        values[d][c] = d == 21 ? (player == 21 ? 0.0 : -1.0) :
+         d > 21 ? 1.0 : d == player ? 0.0 : -1.0;
+        busts[d][c] = d > 21;
+      }
+      else if (c >= 2 || d <= 11) //one card is at most an ace
+      {
+        for (int v = 2; v <= 11; v++) 
+        {
+          double p = (double)counts[v] / total;
+          int next = d + (v == 11 && d > 10 ? 1 : v);
+          values[d][c] += p * values[next][c < 3 ? c + 1 : 3];
+          busts[d][c] += p * busts[next][c < 3 ? c + 1 : 3];
+        }
+      }
+    }
+  }
+  int cards = dealer_cards < 3 ? dealer_cards : 3;
+  if (bust != NULL) 
+  {
+    *bust += weight * busts[dealer][cards];
+  }
+  return values[dealer][cards];
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Estimates hitValue like standEstimate: the player's best result on
+/// every score he can hit to, from 21 down to @player, each from the ones
+/// above it.
+///
+//
+double hitEstimate(int* counts, int total, int player, int dealer,
+ int dealer_cards)
+{
+  double best[22];
+  double hit = 0.0;
+  if (total == 0) 
+  {
+    return 0.0;
+  }
+  for (int score = 21; score >= player; score--) 
+  {
+    hit = 0.0;
+    for (int v = 2; v <= 11; v++) 
+    {
+      int next = score + (v == 11 && score > 10 ? 1 : v);
+      hit += (double)counts[v] / total * (next > 21 ? -1.0 : best[next]);
+    }
+    double stand = standEstimate(counts, total, score, dealer, dealer_cards,
+     0.0, NULL);
+    best[score] = score < 21 && hit > stand ? hit : stand;
+  }
+  return hit;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the player's expected result of standing on @player against a
+/// dealer holding @dealer in @dealer_cards cards, under the rules of
+/// playRound. The cards still to come are drawn without replacement from
+/// @counts (indexed by points), which includes the dealer's hole card.
+/// Past the node budget of the analysis the rest is estimated (see
+/// standEstimate), which bounds the search however big the shoe.
+///
+/// @param analysis The analysis, for cancellation.
+/// @param generation The generation being analysed.
+/// @param counts The number of unseen cards of every point value.
+/// @param total The number of unseen cards.
+/// @param player The player's score.
+/// @param dealer The dealer's score.
+/// @param dealer_cards The number of dealer's cards.
+/// @param weight The probability of getting here.
+/// @param bust Receives the probability that the dealer busts, or NULL.
+/// @return double +1 for a win, -1 for a loss, 0 for a push, on average
+///
+//
+double standValue(Analysis* analysis, int generation, int* counts, int total,
+ int player, int dealer, int dealer_cards, double weight, double* bust)
+{
+  if (dealer_cards >= 2) 
+  {
+    if (dealer_cards == 2 && dealer == 21) 
+    {
+      return -1.0;
+    }
+    if (dealer >= player) 
+    {
+      if (dealer > 21 && bust != NULL) 
+      {
+        *bust += weight;
+      }
+      return dealer == 21 ? (player == 21 ? 0.0 : -1.0) :
+       dealer > 21 ? 1.0 : dealer == player ? 0.0 : -1.0;
+    }
+  }
+  if (total == 0 || analysisCancelled(analysis, generation)) 
+  {
+    return 0.0;
+  }
+  if (analysis->nodes_ > analysis->budget_) 
+  {
+    return standEstimate(counts, total, player, dealer, dealer_cards, weight,
+     bust);
+  }
+
+  double value = 0.0;
+  for (int v = 2; v <= 11; v++) 
+  {
+    if (counts[v] == 0) 
+    {
+      continue;
+    }
+    double p = (double)counts[v] / total;
+    counts[v]--;
+    value += p * standValue(analysis, generation, counts, total - 1, player,
+     dealer + (v == 11 && dealer > 10 ? 1 : v), dealer_cards + 1, weight * p,
+     bust);
+    counts[v]++;
+  }
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the player's expected result of hitting on @player and then
+/// playing on optimally. See standValue; past the node budget it is
+/// estimated by hitEstimate.
+///
+//
+double hitValue(Analysis* analysis, int generation, int* counts, int total,
+ int player, int dealer, int dealer_cards)
+{
+  if (total == 0 || analysisCancelled(analysis, generation)) 
+  {
+    return 0.0;
+  }
+  if (analysis->nodes_ > analysis->budget_) 
+  {
+    return hitEstimate(counts, total, player, dealer, dealer_cards);
+  }
+
+  double value = 0.0;
+  for (int v = 2; v <= 11; v++) 
+  {
+    if (counts[v] == 0) 
+    {
+      continue;
+    }
+    double p = (double)counts[v] / total;
+    int next = player + (v == 11 && player > 10 ? 1 : v);
+    double best = -1.0;
+    counts[v]--;
+    if (next <= 21) 
+    {
+      best = standValue(analysis, generation, counts, total - 1, next, dealer,
+       dealer_cards, 0.0, NULL);
+      if (next < 21) 
+      {
+        double hit = hitValue(analysis, generation, counts, total - 1, next,
+         dealer, dealer_cards);
+        best = hit > best ? hit : best;
+      }
+    }
+    counts[v]++;
+    value += p * best;
+  }
+  return value;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// The background thread of an analysis. For every new decision point it
+/// first renders the frame a hit would show (the next card is already
+/// known) into render_ and copies it to frame_, so that nothing is
+/// allocated, then works out the dealer's bust probability and the value
+/// of standing and of hitting. Results of a generation that moved on in
+/// the meantime are thrown away.
+///
+//
+void* analysisWorker(void* argument)
+{
+  Analysis* analysis = argument;
+  int done = 0;
+  int counts[12];
+  Card hand[DECK_SIZE];
+
+  pthread_mutex_lock(&analysis->lock_);
+  while (!analysis->stop_) 
+  {
+    int generation = atomic_load(&analysis->generation_);
+    if (generation == done) 
+    {
+      pthread_cond_wait(&analysis->changed_, &analysis->lock_);
+      continue;
+    }
+    done = generation;
+    memcpy(counts, analysis->counts_, sizeof(counts));
+    int player = analysis->player_score_;
+    int dealer = analysis->dealer_score_;
+    int dealer_cards = analysis->dealer_count_;
+    int again = analysis->again_;
+    int hand_count = analysis->hand_count_;
+    memcpy(hand, analysis->hand_, sizeof(Card) * hand_count);
+    hand[hand_count] = analysis->next_;
+    pthread_mutex_unlock(&analysis->lock_);
+
+    FILE* out = analysis->render_file_;
+    int next = hand[hand_count].points_;
+    rewind(out);
+    renderCards(out, hand, hand_count + 1,
+     player + (next == 11 && player > 10 ? 1 : next),
+     analysis->width_, analysis->height_, 1);
+    long frame_length = fflush(out) == 0 && !ferror(out) ? ftell(out) : 0;
+    clearerr(out);
+    pthread_mutex_lock(&analysis->lock_);
+    if (atomic_load(&analysis->generation_) == generation) 
+    {
+      memcpy(analysis->frame_, analysis->render_, frame_length);
+      analysis->frame_length_ = frame_length;
+      analysis->framed_ = generation;
+      pthread_cond_broadcast(&analysis->changed_);
+    }
+    pthread_mutex_unlock(&analysis->lock_);
+
+    int total = 0;
+    for (int v = 2; v <= 11; v++) 
+    {
+      total += counts[v];
+    }
+    double bust = 0.0;
+    analysis->cancelled_ = 0;
+    analysis->budget_ = analysis->nodes_ + ANALYSIS_NODES;
+    //standing again while the dealer is not behind settles the hand
+    double stand = again && dealer >= player ?
+     (dealer == player ? 0.0 : -1.0) : standValue(analysis, generation,
+     counts, total, player, dealer, dealer_cards, 1.0, &bust);
+    analysis->budget_ = analysis->nodes_ + ANALYSIS_NODES;
+    double hit = hitValue(analysis, generation, counts, total, player,
+     dealer, dealer_cards);
+
+    pthread_mutex_lock(&analysis->lock_);
+    if (!analysis->cancelled_ &&
+     atomic_load(&analysis->generation_) == generation) 
+    {
+      analysis->stand_ = stand;
+      analysis->hit_ = hit;
+      analysis->bust_ = bust;
+      analysis->finished_ = generation;
+      pthread_cond_broadcast(&analysis->changed_);
+    }
+  }
+  pthread_mutex_unlock(&analysis->lock_);
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Starts the background thread of an analysis.
+///
+/// @param analysis The analysis.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @return zero on success, otherwise SIMULATION_ERROR
+///
+//
+int startAnalysis(Analysis* analysis, int width, int height)
+{
+  memset(analysis, 0, sizeof(Analysis));
+  analysis->width_ = width;
+  analysis->height_ = height;
+  analysis->render_file_ = fmemopen(analysis->render_, ANALYSIS_FRAME_SIZE,
+   "w");
+  if (analysis->render_file_ == NULL) 
+  {
+    return SIMULATION_ERROR;
+  }
+  pthread_mutex_init(&analysis->lock_, NULL);
+  pthread_cond_init(&analysis->changed_, NULL);
+  if (pthread_create(&analysis->thread_, NULL, analysisWorker, analysis) != 0) 
+  {
+    pthread_mutex_destroy(&analysis->lock_);
+    pthread_cond_destroy(&analysis->changed_);
+    fclose(analysis->render_file_);
+    return SIMULATION_ERROR;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Hands the decision point of @game to the background thread, cancelling
+/// whatever it was working on. Before the dealer's turn his hole card
+/// counts as unseen; once the turn is back with the player
+/// (PLAYERS_TURN_AGAIN) all his cards are known and he goes on from his
+/// score.
+///
+/// @param analysis The analysis.
+/// @param game The game, with the player on turn.
+///
+//
+void postDecision(Analysis* analysis, Game* game)
+{
+  pthread_mutex_lock(&analysis->lock_);
+  memset(analysis->counts_, 0, sizeof(analysis->counts_));
+  for (int i = game->card_count_; i < definition.shoe_size_; i++) 
+  {
+    analysis->counts_[game->cards_[i].points_]++;
+  }
+  analysis->again_ = game->players_turn_ == PLAYERS_TURN_AGAIN;
+  if (analysis->again_) 
+  {
+    analysis->dealer_score_ = game->dealer_score_;
+    analysis->dealer_count_ = game->dealer_count_;
+  }
+  else 
+  {
+    analysis->counts_[game->dealer_[1].points_]++;
+    analysis->dealer_score_ = game->dealer_[0].points_;
+    analysis->dealer_count_ = 1;
+  }
+  analysis->player_score_ = game->player_score_;
+  analysis->hand_count_ = game->player_count_;
+  memcpy(analysis->hand_, game->player_, sizeof(Card) * game->player_count_);
+  analysis->next_ = game->cards_[game->card_count_];
+  atomic_fetch_add(&analysis->generation_, 1);
+  pthread_cond_broadcast(&analysis->changed_);
+  pthread_mutex_unlock(&analysis->lock_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the frame of the card the player is about to hit to @out if the
+/// background thread already rendered it for the current decision point.
+///
+/// @return 1 if the frame was written, otherwise 0
+///
+//
+int takeFrame(Analysis* analysis, FILE* out)
+{
+  pthread_mutex_lock(&analysis->lock_);
+  int ready = analysis->framed_ == atomic_load(&analysis->generation_) &&
+   analysis->frame_length_ > 0;
+  if (ready) 
+  {
+    fwrite(analysis->frame_, 1, analysis->frame_length_, out);
+  }
+  pthread_mutex_unlock(&analysis->lock_);
+  return ready;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Waits until the background thread rendered, or failed to render, the
+/// frame of the current decision point (see takeFrame).
+///
+//
+void waitFrame(Analysis* analysis)
+{
+  pthread_mutex_lock(&analysis->lock_);
+  while (analysis->framed_ != atomic_load(&analysis->generation_)) 
+  {
+    pthread_cond_wait(&analysis->changed_, &analysis->lock_);
+  }
+  pthread_mutex_unlock(&analysis->lock_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints the analysis of the current decision point, waiting up to
+/// ADVICE_WAIT_MS for the background thread to finish it if it has not
+/// yet; after that the player is told to ask again rather than kept
+/// waiting.
+///
+//
+void showAdvice(Analysis* analysis)
+{
+  struct timespec until;
+  clock_gettime(CLOCK_REALTIME, &until); //the clock of changed_
+  until.tv_nsec += ADVICE_WAIT_MS * 1000000L;
+  until.tv_sec += until.tv_nsec / 1000000000L;
+  until.tv_nsec %= 1000000000L;
+  pthread_mutex_lock(&analysis->lock_);
+  while (analysis->finished_ != atomic_load(&analysis->generation_)) 
+  {
+    if (pthread_cond_timedwait(&analysis->changed_, &analysis->lock_,
+     &until) == ETIMEDOUT) 
+    {
+      printf("STILL ANALYSING, ASK AGAIN (a) IN A MOMENT\n");
+      pthread_mutex_unlock(&analysis->lock_);
+      return;
+    }
+  }
+  printf("DEALER BUSTS IF YOU STAND: %.1f%%\n", 100.0 * analysis->bust_);
+  printf("STAND: %+.3f  HIT: %+.3f  ADVICE: %s\n", analysis->stand_,
+   analysis->hit_, analysis->hit_ > analysis->stand_ ? "HIT" : "STAND");
+  pthread_mutex_unlock(&analysis->lock_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Stops the background thread of an analysis and frees its results.
+///
+//
+void stopAnalysis(Analysis* analysis)
+{
+  pthread_mutex_lock(&analysis->lock_);
+  analysis->stop_ = 1;
+  atomic_fetch_add(&analysis->generation_, 1);
+  pthread_cond_broadcast(&analysis->changed_);
+  pthread_mutex_unlock(&analysis->lock_);
+  pthread_join(analysis->thread_, NULL);
+  pthread_mutex_destroy(&analysis->lock_);
+  pthread_cond_destroy(&analysis->changed_);
+  fclose(analysis->render_file_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Puts the terminal back into the mode it was in before raw input, also
+/// when the game is interrupted.
+///
+/// @param signal_number The interrupting signal, or zero.
+///
+//
+void restoreTerminal(int signal_number)
+{
+  if (terminal_raw) 
+  {
+    tcsetattr(STDIN_FILENO, TCSANOW, &terminal_mode);
+    terminal_raw = 0;
+  }
+  if (signal_number != 0) 
+  {
+    _exit(128 + signal_number);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Switches the terminal to raw input, so options act on a single keystroke
+/// without waiting for Enter or echoing. Does nothing if stdin is not a
+/// terminal.
+///
+//
+void rawTerminal(void)
+{
+  if (!isatty(STDIN_FILENO) ||
+   tcgetattr(STDIN_FILENO, &terminal_mode) != 0) 
+  {
+    return;
+  }
+  struct termios raw = terminal_mode;
+  raw.c_lflag &= ~(ICANON | ECHO);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0) 
+  {
+    terminal_raw = 1;
+    signal(SIGINT, restoreTerminal);
+    signal(SIGTERM, restoreTerminal);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Reads the next keystroke, skipping white space.
+///
+/// @return int The key, or EOF at the end of input.
+///
+//
+int readKey(void)
+{
+  unsigned char key;
+  do 
+  {
+    if (read(STDIN_FILENO, &key, 1) != 1) 
+    {
+      return EOF;
+    }
+  } while (key == ' ' || key == '\n' || key == '\r' || key == '\t');
+  return key;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Completes the frame of the pending keystroke, if there is one, and
+/// records how long it took from the keystroke.
+///
+/// @param latency The latencies so far.
+/// @param pressed When the key was read, zero if nothing is pending.
+///
+//
+void finishFrame(Latency* latency, long long* pressed)
+{
+  if (*pressed == 0) 
+  {
+    return;
+  }
+  fflush(stdout);
+  if (latency->count_ < LATENCY_SAMPLES) 
+  {
+    latency->samples_[latency->count_++] = nowNs() - *pressed;
+  }
+  *pressed = 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Orders two long longs for qsort.
+///
+//
+int compareLongLong(const void* a, const void* b)
+{
+  long long x = *(const long long*)a;
+  long long y = *(const long long*)b;
+  return (x > y) - (x < y);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints the median and 99th percentile keystroke to frame latency to
+/// stderr, out of the way of the game.
+///
+//
+void printLatency(Latency* latency)
+{
+  if (latency->count_ == 0) 
+  {
+    return;
+  }
+  qsort(latency->samples_, latency->count_, sizeof(long long),
+   compareLongLong);
+  fprintf(stderr, "\nKEYSTROKES: %d  KEYSTROKE TO FRAME P50: %.1f us  "
+   "P99: %.1f us\n", latency->count_,
+   latency->samples_[latency->count_ / 2] / 1e3,
+   latency->samples_[latency->count_ * 99 / 100] / 1e3);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Drops one reference to a frame and frees it with the last one.
+///
+//
+void releaseFrame(Frame* frame)
+{
+  if (frame != NULL && atomic_fetch_sub(&frame->references_, 1) == 1) 
+  {
+    free(frame);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the latest frame of a broadcast with a reference for the caller,
+/// or NULL if nothing was published yet.
+///
+//
+Frame* latestFrame(Broadcast* broadcast)
+{
+  pthread_mutex_lock(&broadcast->lock_);
+  Frame* frame = broadcast->latest_;
+  if (frame != NULL) 
+  {
+    atomic_fetch_add(&frame->references_, 1);
+  }
+  pthread_mutex_unlock(&broadcast->lock_);
+  return frame;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Renders the table once into an immutable frame and makes it the latest
+/// frame of the broadcast. Each frame starts by clearing the viewer's
+/// screen, so any terminal attached to a viewer socket shows the table.
+///
+/// @param broadcast The broadcast, or NULL when not broadcasting.
+/// @param game The game.
+/// @param dealer_shown The number of dealer's cards shown.
+/// @param status What just happened at the table.
+///
+//
+void publishTable(Broadcast* broadcast, Game* game, int dealer_shown,
+ char* status)
+{
+  if (broadcast == NULL) 
+  {
+    return;
+  }
+  char* text = NULL;
+  size_t length = 0;
+  FILE* out = open_memstream(&text, &length);
+  if (out == NULL) 
+  {
+    return;
+  }
+  fprintf(out, "\033[H\033[2J%s\n\n", status);
+  renderCards(out, game->dealer_, dealer_shown,
+   handScore(game->dealer_, dealer_shown), broadcast->width_,
+   broadcast->height_, 0);
+  renderCards(out, game->player_, game->player_count_, game->player_score_,
+   broadcast->width_, broadcast->height_, 1);
+  fclose(out);
+
+  Frame* frame = malloc(sizeof(Frame) + length);
+  if (frame != NULL) 
+  {
+    atomic_init(&frame->references_, 1);
+    frame->length_ = length;
+    memcpy(frame->data_, text, length);
+    pthread_mutex_lock(&broadcast->lock_);
+    Frame* old = broadcast->latest_;
+    broadcast->latest_ = frame;
+    pthread_mutex_unlock(&broadcast->lock_);
+    releaseFrame(old);
+    char wake = 1;
+    if (write(broadcast->wake_[1], &wake, 1) < 0 && errno != EAGAIN) 
+    {
+      printf("[ERR] Broadcast wake-up failed.\n");
+    }
+  }
+  free(text);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends as much of its current frame to a viewer as the socket takes
+/// without blocking. A viewer that finished its frame moves straight to
+/// the latest one, so a slow viewer skips frames instead of queueing them.
+///
+/// @return 1 if the viewer is still connected, otherwise 0
+///
+//
+int feedViewer(Broadcast* broadcast, Viewer* viewer)
+{
+  while (1) 
+  {
+    if (viewer->frame_ == NULL || viewer->sent_ == viewer->frame_->length_) 
+    {
+      Frame* latest = latestFrame(broadcast);
+      if (latest == viewer->frame_) 
+      {
+        releaseFrame(latest);
+        return 1;
+      }
+      releaseFrame(viewer->frame_);
+      viewer->frame_ = latest;
+      viewer->sent_ = 0;
+      if (latest == NULL) 
+      {
+        return 1;
+      }
+    }
+    ssize_t n = send(viewer->socket_, viewer->frame_->data_ + viewer->sent_,
+     viewer->frame_->length_ - viewer->sent_, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) 
+    {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) 
+    {
+      return 1;
+    }
+    if (n <= 0) 
+    {
+      return 0;
+    }
+    viewer->sent_ += n;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Tells whether a viewer still has to be sent something.
+///
+//
+int viewerBehind(Broadcast* broadcast, Viewer* viewer)
+{
+  if (viewer->frame_ != NULL && viewer->sent_ < viewer->frame_->length_) 
+  {
+    return 1;
+  }
+  pthread_mutex_lock(&broadcast->lock_);
+  int behind = broadcast->latest_ != viewer->frame_;
+  pthread_mutex_unlock(&broadcast->lock_);
+  return behind;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// The broadcast thread. Accepts viewers and fans the latest frame out to
+/// all of them from the one shared buffer. After the game stops, viewers
+/// get up to BROADCAST_LINGER_MS to receive the final frame.
+///
+//
+void* broadcastWorker(void* argument)
+{
+  Broadcast* broadcast = argument;
+  Viewer* viewers = NULL;
+  struct pollfd* fds = NULL;
+  int count = 0;
+  int capacity = 0;
+  long long deadline = 0;
+
+  while (1) 
+  {
+    pthread_mutex_lock(&broadcast->lock_);
+    int stop = broadcast->stop_;
+    pthread_mutex_unlock(&broadcast->lock_);
+    int behind = 0;
+    for (int v = 0; v < count; v++) 
+    {
+      behind |= viewerBehind(broadcast, &viewers[v]);
+    }
+    if (stop && deadline == 0) 
+    {
+      deadline = nowNs() + BROADCAST_LINGER_MS * 1000000LL;
+    }
+    if (stop && (!behind || nowNs() > deadline)) 
+    {
+      break;
+    }
+
+    if (count + 2 > capacity) 
+    {
+      int grown = capacity == 0 ? ALLOC_SIZE : capacity * 2;
+      Viewer* more_viewers = realloc(viewers, sizeof(Viewer) * grown);
+      if (more_viewers != NULL) 
+      {
+        viewers = more_viewers;
+      }
+      struct pollfd* more_fds = realloc(fds,
+       sizeof(struct pollfd) * (grown + 2));
+      if (more_fds != NULL) 
+      {
+        fds = more_fds;
+      }
+      if (more_viewers == NULL || more_fds == NULL) 
+      {
+        memoryError();
+        break;
+      }
+      capacity = grown;
+    }
+
+    fds[0].fd = broadcast->wake_[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = stop ? -1 : broadcast->listener_;
+    fds[1].events = POLLIN;
+    for (int v = 0; v < count; v++) 
+    {
+      fds[2 + v].fd = viewers[v].socket_;
+      fds[2 + v].events = viewerBehind(broadcast, &viewers[v]) ? POLLOUT : 0;
+    }
+    if (poll(fds, count + 2, stop ? HEARTBEAT_MS : -1) < 0 && errno != EINTR) 
+    {
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) 
+    {
+      char drain[64];
+      while (read(broadcast->wake_[0], drain, sizeof(drain)) > 0) 
+      {
+      }
+    }
+    int kept = 0;
+    for (int v = 0; v < count; v++) 
+    {
+      short revents = fds[2 + v].revents;
+      if ((revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+       !feedViewer(broadcast, &viewers[v])) 
+      {
+        close(viewers[v].socket_);
+        releaseFrame(viewers[v].frame_);
+        continue;
+      }
+      viewers[kept++] = viewers[v];
+    }
+    count = kept;
+    if (fds[1].fd >= 0 && (fds[1].revents & POLLIN) && count < capacity) 
+    {
+      int fd = accept(broadcast->listener_, NULL, NULL);
+      if (fd >= 0) 
+      {
+        Viewer viewer = { fd, NULL, 0 };
+        viewers[count++] = viewer;
+        if (!feedViewer(broadcast, &viewers[count - 1])) 
+        {
+          close(fd);
+          releaseFrame(viewers[--count].frame_);
+        }
+      }
+    }
+  }
+
+  for (int v = 0; v < count; v++) 
+  {
+    close(viewers[v].socket_);
+    releaseFrame(viewers[v].frame_);
+  }
+  free(viewers);
+  free(fds);
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Opens the viewer socket of a broadcast and starts its thread.
+///
+/// @param broadcast The broadcast.
+/// @param socket_path Where viewers connect.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @return zero on success, otherwise error code
+///
+//
+int startBroadcast(Broadcast* broadcast, char* socket_path, int width,
+ int height)
+{
+  memset(broadcast, 0, sizeof(Broadcast));
+  broadcast->width_ = width;
+  broadcast->height_ = height;
+  broadcast->listener_ = openUnixSocket(socket_path, 1);
+  if (broadcast->listener_ < 0) 
+  {
+    printf("[ERR] Cannot listen on %s.\n", socket_path);
+    return SIMULATION_ERROR;
+  }
+  if (pipe2(broadcast->wake_, O_NONBLOCK | O_CLOEXEC) != 0) 
+  {
+    close(broadcast->listener_);
+    return SIMULATION_ERROR;
+  }
+  pthread_mutex_init(&broadcast->lock_, NULL);
+  if (pthread_create(&broadcast->thread_, NULL, broadcastWorker,
+   broadcast) != 0) 
+  {
+    close(broadcast->listener_);
+    close(broadcast->wake_[0]);
+    close(broadcast->wake_[1]);
+    pthread_mutex_destroy(&broadcast->lock_);
+    return SIMULATION_ERROR;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Lets viewers catch up with the final frame, then stops the broadcast
+/// thread and closes the viewer socket.
+///
+/// @param broadcast The broadcast.
+/// @param socket_path The viewer socket, removed afterwards.
+///
+//
+void stopBroadcast(Broadcast* broadcast, char* socket_path)
+{
+  pthread_mutex_lock(&broadcast->lock_);
+  broadcast->stop_ = 1;
+  pthread_mutex_unlock(&broadcast->lock_);
+  char wake = 1;
+  if (write(broadcast->wake_[1], &wake, 1) < 0 && errno != EAGAIN) 
+  {
+    printf("[ERR] Broadcast wake-up failed.\n");
+  }
+  pthread_join(broadcast->thread_, NULL);
+  close(broadcast->listener_);
+  close(broadcast->wake_[0]);
+  close(broadcast->wake_[1]);
+  unlink(socket_path);
+  releaseFrame(broadcast->latest_);
+  pthread_mutex_destroy(&broadcast->lock_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Connects to a broadcast and shows every frame it receives until the
+/// broadcast ends.
+///
+/// @param socket_path The viewer socket of the broadcast.
+/// @return zero on success, otherwise error code
+///
+//
+int watchBroadcast(char* socket_path)
+{
+  int fd = openUnixSocket(socket_path, 0);
+  if (fd < 0) 
+  {
+    printf("[ERR] Cannot connect to %s.\n", socket_path);
+    return SIMULATION_ERROR;
+  }
+  char buffer[BUFSIZ];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0 ||
+   (n < 0 && errno == EINTR)) 
+  {
+    if (n > 0) 
+    {
+      fwrite(buffer, 1, n, stdout);
+      fflush(stdout);
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Applies a player's decision to a game. A stand, or a hit to 21, hands
+/// the turn to the dealer, who draws while behind the player. A dealer who
+/// stops below 21 hands the turn back (PLAYERS_TURN_AGAIN); standing again
+/// while the dealer is not behind settles the hand, a tie being a push.
+/// This is the one place game rules are applied to interactive and served
+/// games.
+///
+/// @param game The game, with the player on turn.
+/// @param action ACTION_HIT or ACTION_STAND.
+/// @return int The outcome for the player, OUTCOME_PLAYING while undecided.
+///
+//
+int applyAction(Game* game, int action)
+{
+  if (action == ACTION_HIT) 
+  {
+    giveCards(game->cards_, game->player_, &game->card_count_,
+     &game->player_count_, &game->player_score_, 1);
+    if (game->player_score_ > 21) 
+    {
+      return OUTCOME_LOSE;
+    }
+    if (game->player_score_ < 21) 
+    {
+      return OUTCOME_PLAYING;
+    }
+  }
+
+  int again = game->players_turn_ == PLAYERS_TURN_AGAIN;
+  game->players_turn_ = 0;
+  if (game->dealer_score_ == 21 && game->dealer_count_ == 2) 
+  {
+    return OUTCOME_LOSE;
+  }
+  if (again && action == ACTION_STAND &&
+   game->dealer_score_ >= game->player_score_) 
+  {
+    return game->dealer_score_ == game->player_score_ ? OUTCOME_PUSH :
+     OUTCOME_LOSE;
+  }
+  while (game->dealer_score_ < game->player_score_) 
+  {
+    giveCards(game->cards_, game->dealer_, &game->card_count_,
+     &game->dealer_count_, &game->dealer_score_, 1);
+  }
+  if (game->dealer_score_ == 21) 
+  {
+    return game->player_score_ == 21 ? OUTCOME_PUSH : OUTCOME_LOSE;
+  }
+  if (game->dealer_score_ > 21) 
+  {
+    return OUTCOME_WIN;
+  }
+  game->players_turn_ = PLAYERS_TURN_AGAIN;
+  return OUTCOME_PLAYING;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Shows the dealer's turn that applyAction just played, card by card, and
+/// its result.
+///
+/// @param game The game.
+/// @param dealer_count The number of dealer's cards before the turn.
+/// @param outcome The outcome applyAction returned.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @param broadcast The spectator broadcast, or NULL.
+///
+//
+void showDealerTurn(Game* game, int dealer_count, int outcome, int width,
+ int height, Broadcast* broadcast)
+{
+  printf("DEALERS TURN\n");
+  showCards(game->dealer_, 2, handScore(game->dealer_, dealer_count),
+   width, height, 0);
+  publishTable(broadcast, game, dealer_count, "DEALERS TURN");
+  if (dealer_count == 2 && game->dealer_score_ == 21 &&
+   game->dealer_count_ == 2) 
+  {
+    printf("BLACKJACK! YOU LOOSE!");
+    return;
+  }
+  for (int k = dealer_count + 1; k <= game->dealer_count_; k++) 
+  {
+    printf("DEALER GETS ANOTHER CARD..\n");
+    showCards(game->dealer_, k, handScore(game->dealer_, k), width, height, 0);
+    publishTable(broadcast, game, k, "DEALER GETS ANOTHER CARD");
+  }
+  if (outcome == OUTCOME_PUSH) 
+  {
+    printf("PUSH!");
+  }
+  else if (outcome == OUTCOME_LOSE) 
+  {
+    printf("YOU LOOSE!");
+  }
+  else if (outcome == OUTCOME_WIN) 
+  {
+    printf("BUST! YOU WIN!");
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Plays an interactive game from its current state until it ends or the
+/// player saves it. Saving writes a snapshot to SNAPSHOT_FILE, which the
+/// 'resume' command continues. While the player decides, an analysis runs
+/// in the background; it prepares the frame of a hit and the advice.
+/// Options are single keystrokes; the time from a keystroke to its
+/// completed frame is reported when the game ends. Every table event is
+/// also published to @broadcast.
+///
+/// @param game The game to play.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @param broadcast The spectator broadcast, or NULL.
+/// @return zero if the game ends without errors, otherwise error code
+///
+//
+int playGame(Game* game, int width, int height, Broadcast* broadcast)
+{
+  Analysis analysis;
+  int analysing = startAnalysis(&analysis, width, height) == 0;
+  int posted = -1;
+  Latency latency;
+  long long pressed = 0;
+  int result = 0;
+  int outcome = OUTCOME_PLAYING;
+  latency.count_ = 0;
+  rawTerminal();
+  publishTable(broadcast, game,
+   game->players_turn_ == 1 ? 1 : game->dealer_count_, "NEW HAND");
+  while (outcome == OUTCOME_PLAYING) 
+  {
+    int action = ACTION_STAND; //the dealer plays when the player is not on
+    if (game->players_turn_) 
+    {
+      //the dealer may hand the turn back without drawing
+      int point = game->card_count_ * 2 +
+       (game->players_turn_ == PLAYERS_TURN_AGAIN);
+      if (analysing && posted != point) 
+      {
+        postDecision(&analysis, game);
+        posted = point;
+      }
+      printf("HIT (h), STAND (s), ADVICE (a) or SAVE AND QUIT (q)\n");
+      finishFrame(&latency, &pressed);
+      int option = readKey();
+      if (option == EOF) 
+      {
+        break;
+      }
+      pressed = nowNs();
+      if (option == 'a' && analysing) 
+      {
+        showAdvice(&analysis);
+        pressed = 0; //waits for the analysis, not a frame
+        continue;
+      }
+      else if (option == 'q') 
+      {
+        unsigned char snapshot[SNAPSHOT_SIZE];
+        int size = saveGame(game, snapshot);
+        FILE* file = fopen(SNAPSHOT_FILE, "wb");
+        if (file == NULL) 
+        {
+          result = fileError();
+          break;
+        }
+        int written = fwrite(snapshot, 1, size, file);
+        if (fclose(file) != 0 || written != size) 
+        {
+          result = fileError();
+          break;
+        }
+        printf("GAME SAVED TO %s\n", SNAPSHOT_FILE);
+        break;
+      }
+      else if (option != 'h' && option != 's') 
+      {
+        printf("UNKNOWN OPTION '%c'\n", option);
+        continue;
+      }
+      action = option == 'h' ? ACTION_HIT : ACTION_STAND;
+    }
+
+    int dealer_count = game->dealer_count_;
+    int framed = action == ACTION_HIT && analysing && takeFrame(&analysis, stdout);
+    outcome = applyAction(game, action);
+    if (action == ACTION_HIT) 
+    {
+      if (!framed) 
+      {
+        showCards(game->player_, game->player_count_, game->player_score_,
+         width, height, 1);
+      }
+      publishTable(broadcast, game, 1, "PLAYER HITS");
+      if (game->player_score_ > 21) 
+      {
+        printf("BUST! YOU LOOSE!");
+        continue;
+      }
+      if (game->player_score_ < 21) 
+      {
+        continue;
+      }
+    }
+    showDealerTurn(game, dealer_count, outcome, width, height, broadcast);
+  }
+  finishFrame(&latency, &pressed);
+  publishTable(broadcast, game, game->dealer_count_, "GAME OVER");
+  restoreTerminal(0);
+  if (analysing) 
+  {
+    stopAnalysis(&analysis);
+  }
+  printLatency(&latency);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Loads a snapshot file and continues the saved game.
+///
+/// @param deck The unshuffled deck.
+/// @param path The snapshot file.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @return zero if the game ends without errors, otherwise error code
+///
+//
+int resumeGame(Card* deck, char* path, int width, int height)
+{
+  unsigned char snapshot[SNAPSHOT_SIZE];
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+  int length = fread(snapshot, 1, SNAPSHOT_SIZE, file);
+  fclose(file);
+
+  Card ranks[MAX_RANKS];
+  Game game;
+  rankTable(deck, ranks);
+  if (length != snapshotSize() || restoreGame(&game, snapshot, ranks) != 0) 
+  {
+    return fileError();
+  }
+
+  showCards(game.dealer_, game.players_turn_ == 1 ? 1 : game.dealer_count_,
+   game.players_turn_ == 1 ? game.dealer_[0].points_ : game.dealer_score_,
+   width, height, 0);
+  showCards(game.player_, game.player_count_, game.player_score_,
+   width, height, 1);
+  return playGame(&game, width, height, NULL);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints the salt and the cards of a securely shuffled game's shoe, which
+/// anyone can hash to check the commitment shown before the deal.
+///
+//
+void revealShoe(Game* game, int seed)
+{
+  if (!secure_shuffle) 
+  {
+    return;
+  }
+  unsigned char salt[SALT_SIZE];
+  char salt_hex[2 * SALT_SIZE + 1];
+  char shoe[MAX_SHOE_SIZE + 1];
+  shoeSalt((unsigned int)seed, salt);
+  hexString(salt, SALT_SIZE, salt_hex);
+  shoeString(game->cards_, shoe);
+  printf("\nSHOE SALT: %s\nSHOE: %s\n", salt_hex, shoe);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Deals a new game and plays it. With a secure shuffle the shoe is
+/// committed to before the deal and revealed after the game.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The shuffle seed.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @param broadcast The spectator broadcast, or NULL.
+/// @return zero if the game ends without errors, otherwise error code
+///
+//
+int startGame(Card* deck, int seed, int width, int height,
+ Broadcast* broadcast)
+{
+  //THE GAME STARTS...
+
+  Game game;
+  dealGame(&game, deck, seed);
+  if (secure_shuffle) 
+  {
+    unsigned char salt[SALT_SIZE];
+    unsigned char commitment[SHA256_SIZE];
+    char hex[2 * SHA256_SIZE + 1];
+    shoeSalt((unsigned int)seed, salt);
+    commitShoe(game.cards_, salt, commitment);
+    hexString(commitment, SHA256_SIZE, hex);
+    printf("SHOE COMMITMENT: %s\n", hex);
+  }
+
+  showCards(game.dealer_, 1, game.dealer_[0].points_, width, height, 0);
+  showCards(game.player_, game.player_count_, game.player_score_,
+   width, height, 1);
+
+  if (game.player_score_ == 21) 
+  {
+    printf("BLACKJACK! ");
+    showCards(game.dealer_, 2, game.dealer_score_, width, height, 0);
+    if (game.dealer_score_ != 21) 
+    {
+      printf("YOU WIN!");
+    }
+    else 
+    {
+      printf("BLACKJACK! PUSH!");
+    }
+    publishTable(broadcast, &game, game.dealer_count_, "BLACKJACK");
+    revealShoe(&game, seed);
+    return 0;
+  }
+
+  int result = playGame(&game, width, height, broadcast);
+  revealShoe(&game, seed);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Plays a new game while broadcasting it to spectators (see watchBroadcast).
+///
+/// @param deck The unshuffled deck.
+/// @param seed The shuffle seed.
+/// @param socket_path Where spectators connect.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @return zero if the game ends without errors, otherwise error code
+///
+//
+int broadcastGame(Card* deck, int seed, char* socket_path, int width,
+ int height)
+{
+  Broadcast broadcast;
+  int result = startBroadcast(&broadcast, socket_path, width, height);
+  if (result != 0) 
+  {
+    return result;
+  }
+  result = startGame(deck, seed, width, height, &broadcast);
+  stopBroadcast(&broadcast, socket_path);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the current time in timer wheel ticks.
+///
+//
+long long nowTick(void)
+{
+  return nowNs() / (TIMER_TICK_MS * 1000000LL);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Makes a timer list head point to itself.
+///
+//
+void emptyTimerList(Timer* head)
+{
+  head->next_ = head;
+  head->prev_ = head;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Starts an empty timer wheel at tick @now.
+///
+//
+void initWheel(TimerWheel* wheel, long long now)
+{
+  wheel->now_ = now;
+  wheel->count_ = 0;
+  for (int level = 0; level < TIMER_LEVELS; level++) 
+  {
+    for (int slot = 0; slot < TIMER_SLOTS; slot++) 
+    {
+      emptyTimerList(&wheel->slots_[level][slot]);
+    }
+  }
+  emptyTimerList(&wheel->expired_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Links a timer into the slot for its expiry: the finest level whose span
+/// still reaches it. O(1).
+///
+//
+void linkTimer(TimerWheel* wheel, Timer* timer)
+{
+  long long delta = timer->expires_ - wheel->now_;
+  int level = 0;
+  while (level < TIMER_LEVELS - 1 &&
+   delta >= 1LL << (TIMER_BITS * (level + 1))) 
+  {
+    level++;
+  }
+  long long limit = (1LL << (TIMER_BITS * TIMER_LEVELS)) - 1;
+  if (delta > limit) 
+  {
+    timer->expires_ = wheel->now_ + limit;
+  }
+  Timer* head = &wheel->slots_[level]
+   [(timer->expires_ >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1)];
+  timer->next_ = head->next_;
+  timer->prev_ = head;
+  head->next_->prev_ = timer;
+  head->next_ = timer;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Arms a timer to expire @ticks ticks from now. O(1).
+///
+/// @param wheel The timer wheel.
+/// @param timer The timer, not armed.
+/// @param ticks The delay, at least one tick.
+///
+//
+void addTimer(TimerWheel* wheel, Timer* timer, long long ticks)
+{
+  timer->expires_ = wheel->now_ + (ticks < 1 ? 1 : ticks);
+  timer->armed_ = 1;
+  wheel->count_++;
+  linkTimer(wheel, timer);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Disarms a timer if it is armed. O(1).
+///
+//
+void cancelTimer(TimerWheel* wheel, Timer* timer)
+{
+  if (!timer->armed_) 
+  {
+    return;
+  }
+  timer->prev_->next_ = timer->next_;
+  timer->next_->prev_ = timer->prev_;
+  timer->armed_ = 0;
+  wheel->count_--;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Moves every timer of a list into the wheel again, relative to the
+/// current tick, which puts it one level lower.
+///
+//
+void cascadeTimers(TimerWheel* wheel, Timer* head)
+{
+  Timer* timer = head->next_;
+  emptyTimerList(head);
+  while (timer != head) 
+  {
+    Timer* next = timer->next_;
+    linkTimer(wheel, timer);
+    timer = next;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the next timer that expired by tick @now and disarms it, or NULL.
+/// The wheel advances one tick at a time; when a level wraps around, the
+/// matching slot of the next level is cascaded down first. An empty wheel
+/// jumps straight to @now.
+///
+/// @param wheel The timer wheel.
+/// @param now The current tick.
+/// @return Timer* The expired timer, or NULL if none is due.
+///
+//
+Timer* nextExpired(TimerWheel* wheel, long long now)
+{
+  if (wheel->count_ == 0) 
+  {
+    wheel->now_ = now > wheel->now_ ? now : wheel->now_;
+    return NULL;
+  }
+  while (wheel->expired_.next_ == &wheel->expired_ && wheel->now_ < now) 
+  {
+    long long tick = ++wheel->now_;
+    int top = 0;
+    while (top < TIMER_LEVELS - 1 &&
+     (tick & ((1LL << (TIMER_BITS * (top + 1))) - 1)) == 0) 
+    {
+      top++;
+    }
+    for (int level = top; level > 0; level--) 
+    {
+      cascadeTimers(wheel, &wheel->slots_[level]
+       [(tick >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1)]);
+    }
+    Timer* head = &wheel->slots_[0][tick & (TIMER_SLOTS - 1)];
+    if (head->next_ != head) 
+    {
+      wheel->expired_.next_ = head->next_;
+      wheel->expired_.prev_ = head->prev_;
+      head->next_->prev_ = &wheel->expired_;
+      head->prev_->next_ = &wheel->expired_;
+      emptyTimerList(head);
+    }
+  }
+  Timer* timer = wheel->expired_.next_;
+  if (timer == &wheel->expired_) 
+  {
+    return NULL;
+  }
+  cancelTimer(wheel, timer);
+  return timer;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the checksum of a journal record at position @index. Mixing in
+/// the position keeps a record that is valid elsewhere from passing here,
+/// and the low bit is always set, so zeroed space never passes.
+///
+//
+unsigned int journalChecksum(JournalRecord* record, long long index)
+{
+  unsigned int hash = 2166136261u ^ (unsigned int)index;
+  unsigned char* bytes = (unsigned char*)record;
+  for (int i = 0; i < (int)offsetof(JournalRecord, checksum_); i++) 
+  {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash | 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Maps @records records of a journal file (plus its header) into memory,
+/// growing the file first if needed.
+///
+/// @return zero on success, otherwise FILE_ERROR
+///
+//
+int mapJournal(Journal* journal, long long records)
+{
+  size_t size = JOURNAL_HEADER + records * sizeof(JournalRecord);
+  if (ftruncate(journal->fd_, size) != 0) 
+  {
+    return FILE_ERROR;
+  }
+  unsigned char* map = journal->map_ == NULL ?
+   mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd_, 0) :
+   mremap(journal->map_, JOURNAL_HEADER +
+   journal->capacity_ * sizeof(JournalRecord), size, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED) 
+  {
+    return FILE_ERROR;
+  }
+  journal->map_ = map;
+  journal->capacity_ = records;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Unmaps and closes a journal.
+///
+//
+void closeJournal(Journal* journal)
+{
+  munmap(journal->map_,
+   JOURNAL_HEADER + journal->capacity_ * sizeof(JournalRecord));
+  close(journal->fd_);
+}
+
+
+//-----------------------------------------------------------------------------
+///
+/// Opens or creates a journal file. A new journal records @seed and the
+/// shuffle mode and keys in its header; an existing one keeps its own,
+/// which @seed, secure_shuffle, shuffle_key and salt_key receive, so
+/// replayed hands get their cards and commitments again. Valid records are
+/// counted up to the first one whose checksum fails, which drops a record
+/// torn by a crash.
+///
+/// @param journal The journal.
+/// @param path The journal file.
+/// @param seed The run seed; receives the seed of an existing journal.
+/// @return zero on success, otherwise FILE_ERROR
+///
+//
+int openJournal(Journal* journal, char* path, int* seed)
+{
+  memset(journal, 0, sizeof(Journal));
+  journal->path_ = path;
+  journal->fd_ = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  struct stat info;
+  if (journal->fd_ < 0 || fstat(journal->fd_, &info) != 0) 
+  {
+    if (journal->fd_ >= 0) 
+    {
+      close(journal->fd_);
+    }
+    return FILE_ERROR;
+  }
+  int existing = info.st_size >= JOURNAL_HEADER;
+  long long records = existing ?
+   (info.st_size - JOURNAL_HEADER) / (long long)sizeof(JournalRecord) : 0;
+  if (mapJournal(journal, records > JOURNAL_RECORDS ? records :
+   JOURNAL_RECORDS) != 0) 
+  {
+    close(journal->fd_);
+    return FILE_ERROR;
+  }
+  if (existing && memcmp(journal->map_, JOURNAL_MAGIC, 4) != 0) 
+  {
+    closeJournal(journal);
+    return FILE_ERROR;
+  }
+  if (!existing) 
+  {
+    memcpy(journal->map_, JOURNAL_MAGIC, 4);
+    memcpy(journal->map_ + 4, seed, sizeof(int));
+    journal->map_[20] = secure_shuffle;
+    memcpy(journal->map_ + 24, shuffle_key, sizeof(shuffle_key));
+    memcpy(journal->map_ + 56, salt_key, sizeof(salt_key));
+  }
+  memcpy(seed, journal->map_ + 4, sizeof(int));
+  secure_shuffle = journal->map_[20];
+  memcpy(shuffle_key, journal->map_ + 24, sizeof(shuffle_key));
+  memcpy(salt_key, journal->map_ + 56, sizeof(salt_key));
+
+  JournalRecord* record = (JournalRecord*)(journal->map_ + JOURNAL_HEADER);
+  while (journal->count_ < journal->capacity_ &&
+   record[journal->count_].checksum_ ==
+   journalChecksum(&record[journal->count_], journal->count_)) 
+  {
+    journal->count_++;
+  }
+  memset(&record[journal->count_], 0,
+   (journal->capacity_ - journal->count_) * sizeof(JournalRecord));
+  journal->synced_ = journal->count_;
+  journal->compact_at_ = JOURNAL_RECORDS;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Appends one state transition to a journal. The record is only written
+/// into the mapping; journalCommit makes a group of them durable. A full
+/// journal doubles first.
+///
+/// @param journal The journal, or NULL when not journaling.
+/// @param session The session.
+/// @param kind JOURNAL_DEAL, JOURNAL_ACTION, JOURNAL_RESULT or JOURNAL_CLOSE.
+/// @param hand The dealt hand for JOURNAL_DEAL.
+/// @param value The action or outcome.
+///
+//
+void journalAppend(Journal* journal, unsigned int session, int kind,
+ unsigned int hand, int value)
+{
+  if (journal == NULL) 
+  {
+    return;
+  }
+  if (journal->count_ == journal->capacity_ &&
+   mapJournal(journal, journal->capacity_ * 2) != 0) 
+  {
+    journal->failed_ = 1;
+    return;
+  }
+  JournalRecord* record =
+   (JournalRecord*)(journal->map_ + JOURNAL_HEADER) + journal->count_;
+  record->session_ = session;
+  record->hand_ = hand;
+  record->kind_ = kind;
+  record->value_ = value;
+  record->reserved_ = 0;
+  record->checksum_ = journalChecksum(record, journal->count_);
+  journal->count_++;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Group commit: flushes every record appended since the last commit to
+/// the file with one msync.
+///
+/// @return zero on success, otherwise FILE_ERROR
+///
+//
+int journalCommit(Journal* journal)
+{
+  if (journal == NULL || journal->count_ == journal->synced_) 
+  {
+    return journal != NULL && journal->failed_ ? FILE_ERROR : 0;
+  }
+  long page = sysconf(_SC_PAGESIZE);
+  size_t begin = JOURNAL_HEADER + journal->synced_ * sizeof(JournalRecord);
+  size_t end = JOURNAL_HEADER + journal->count_ * sizeof(JournalRecord);
+  begin -= begin % page;
+  if (msync(journal->map_ + begin, end - begin, MS_SYNC) != 0) 
+  {
+    journal->failed_ = 1;
+  }
+  journal->synced_ = journal->count_;
+  return journal->failed_ ? FILE_ERROR : 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Stops the game server at the next turn of its event loop.
+///
+//
+void stopServer(int signal_number)
+{
+  (void)signal_number;
+  server_stopped = 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the shuffle seed of the @hand th hand a server deals. A secure
+/// shuffle uses the hand itself as its nonce, so no two hands share one.
+///
+//
+int handSeed(Server* server, long long hand)
+{
+  return secure_shuffle ? (int)(unsigned int)hand :
+   roundSeed(server->seed_, hand);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends one line of the server protocol to a session without blocking. A
+/// client that lets its socket fill up is not reading and gets dropped.
+///
+//
+void sessionPrint(Session* session, const char* format, ...)
+{
+  char line[SERVER_LINE_LENGTH];
+  va_list arguments;
+  va_start(arguments, format);
+  int length = vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+  if (session->closed_ || length < 0 || length >= (int)sizeof(line)) 
+  {
+    return;
+  }
+  if (send(session->socket_, line, length, MSG_NOSIGNAL | MSG_DONTWAIT) !=
+   length) 
+  {
+    session->closed_ = 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends the dealer's whole hand and score to a session.
+///
+//
+void sessionDealer(Session* session)
+{
+  Game* game = &session->game_;
+  char line[SERVER_LINE_LENGTH];
+  int length = 0;
+  for (int i = 0; i < game->dealer_count_ && length < SERVER_LINE_LENGTH / 2;
+   i++) 
+  {
+    length += snprintf(line + length, sizeof(line) - length, "%s ",
+     definition.names_[game->dealer_[i].rank_]);
+  }
+  sessionPrint(session, "DEALER %s%d\n", line, game->dealer_score_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends the commitment to the shoe of a session's hand ('COMMIT <hash>')
+/// before any of its cards, when shoes are shuffled securely.
+///
+//
+void sessionCommit(Session* session)
+{
+  if (!secure_shuffle) 
+  {
+    return;
+  }
+  unsigned char salt[SALT_SIZE];
+  unsigned char commitment[SHA256_SIZE];
+  char hex[2 * SHA256_SIZE + 1];
+  shoeSalt(session->hand_, salt);
+  commitShoe(session->game_.cards_, salt, commitment);
+  hexString(commitment, SHA256_SIZE, hex);
+  sessionPrint(session, "COMMIT %s\n", hex);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends the result of a finished hand to a session, journals it and counts
+/// it. A committed shoe is revealed ('REVEAL <salt> <rank codes>') and
+/// appended to the audit log.
+///
+//
+void sessionResult(Server* server, Session* session, int outcome)
+{
+  char* names[] = { "LOSE", "PUSH", "WIN", "BLACKJACK" };
+  sessionPrint(session, "RESULT %s\n", names[outcome]);
+  if (secure_shuffle) 
+  {
+    unsigned char salt[SALT_SIZE];
+    char salt_hex[2 * SALT_SIZE + 1];
+    char shoe[MAX_SHOE_SIZE + 1];
+    shoeSalt(session->hand_, salt);
+    hexString(salt, SALT_SIZE, salt_hex);
+    shoeString(session->game_.cards_, shoe);
+    sessionPrint(session, "REVEAL %s %s\n", salt_hex, shoe);
+    if (server->audit_ != NULL) 
+    {
+      logShoe(server->audit_, session->hand_, session->game_.cards_);
+    }
+  }
+  journalAppend(server->journal_, session->id_, JOURNAL_RESULT, session->hand_,
+   outcome);
+  session->settled_ = 1;
+  server->hands_++;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends the first two cards of a session's hand and the dealer's upcard.
+///
+//
+void sessionHand(Session* session)
+{
+  Game* game = &session->game_;
+  sessionPrint(session, "DEAL %s %s %d %s\n",
+   definition.names_[game->player_[0].rank_],
+   definition.names_[game->player_[1].rank_],
+   handScore(game->player_, 2), definition.names_[game->dealer_[0].rank_]);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Deals the next hand of a session and arms its decision timeout. Hands
+/// that end at once (a player's blackjack) are settled and dealt again.
+///
+//
+void sessionDeal(Server* server, Session* session)
+{
+  Game* game = &session->game_;
+  while (1) 
+  {
+    session->hand_ = (unsigned int)server->dealt_;
+    session->settled_ = 0;
+    session->action_count_ = 0;
+    dealGame(game, server->deck_, handSeed(server, server->dealt_++));
+    journalAppend(server->journal_, session->id_, JOURNAL_DEAL, session->hand_,
+     0);
+    sessionCommit(session);
+    sessionHand(session);
+    if (game->player_score_ != 21) 
+    {
+      break;
+    }
+    sessionDealer(session);
+    sessionResult(server, session,
+     game->dealer_score_ == 21 ? OUTCOME_PUSH : OUTCOME_BLACKJACK);
+  }
+  addTimer(&server->wheel_, &session->timer_, server->timeout_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Applies a decision of a session's player through applyAction, the same
+/// path the interactive game takes, journals it and tells the client what
+/// happened.
+///
+/// @param server The server.
+/// @param session The session, with the player on turn.
+/// @param action ACTION_HIT or ACTION_STAND.
+///
+//
+void sessionAction(Server* server, Session* session, int action)
+{
+  Game* game = &session->game_;
+  cancelTimer(&server->wheel_, &session->timer_);
+  int outcome = applyAction(game, action);
+  journalAppend(server->journal_, session->id_, JOURNAL_ACTION, session->hand_,
+   action);
+  session->actions_[session->action_count_++] = action;
+  if (action == ACTION_HIT) 
+  {
+    sessionPrint(session, "CARD %s %d\n",
+     definition.names_[game->player_[game->player_count_ - 1].rank_],
+     game->player_score_);
+  }
+  if (action == ACTION_STAND || game->player_score_ == 21) 
+  {
+    sessionDealer(session);
+  }
+  if (outcome == OUTCOME_PLAYING) 
+  {
+    addTimer(&server->wheel_, &session->timer_, server->timeout_);
+  }
+  else 
+  {
+    sessionResult(server, session, outcome);
+    sessionDeal(server, session);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Hands the connection of @session to the restored session its client
+/// asked for ('r<id>'), which then continues where the journal left it:
+/// the client gets 'RESUMED <id>' and the hand so far, or a new hand if the
+/// last one was settled. The abandoned session is closed.
+///
+/// @param server The server.
+/// @param session The session the client connected as.
+/// @return Session* The session now owning the connection.
+///
+//
+Session* resumeSession(Server* server, Session* session)
+{
+  Session* restored = NULL;
+  for (int i = 0; i < server->count_ && restored == NULL; i++) 
+  {
+    if (server->sessions_[i]->socket_ < 0 && !server->sessions_[i]->closed_ &&
+     server->sessions_[i]->id_ == session->resume_id_) 
+    {
+      restored = server->sessions_[i];
+    }
+  }
+  if (restored == NULL) 
+  {
+    sessionPrint(session, "UNKNOWN SESSION\n");
+    return session;
+  }
+
+  cancelTimer(&server->wheel_, &session->timer_);
+  restored->socket_ = session->socket_;
+  session->socket_ = -1;
+  session->closed_ = 1;
+  sessionPrint(restored, "RESUMED %u\n", restored->id_);
+  if (restored->settled_) 
+  {
+    sessionDeal(server, restored);
+    return restored;
+  }
+  Game* game = &restored->game_;
+  sessionCommit(restored);
+  sessionHand(restored);
+  for (int i = 2; i < game->player_count_; i++) 
+  {
+    sessionPrint(restored, "CARD %s %d\n",
+     definition.names_[game->player_[i].rank_],
+     handScore(game->player_, i + 1));
+  }
+  if (game->players_turn_ == PLAYERS_TURN_AGAIN) 
+  {
+    sessionDealer(restored);
+  }
+  addTimer(&server->wheel_, &restored->timer_, server->timeout_);
+  return restored;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Rebuilds the sessions that were live when the journal was last written.
+/// Each one's hand is dealt again from its seed and its actions applied
+/// again; until its client resumes it, a restored session has no socket.
+///
+/// @param server The server, with its journal open and no sessions.
+/// @param max_sessions The most sessions to restore.
+/// @return zero on success, otherwise error code
+///
+//
+int replayJournal(Server* server, int max_sessions)
+{
+  Journal* journal = server->journal_;
+  JournalRecord* records = (JournalRecord*)(journal->map_ + JOURNAL_HEADER);
+  long long dealt = 0;
+  unsigned int ids = 0;
+  memcpy(&dealt, journal->map_ + 8, sizeof(dealt));
+  memcpy(&ids, journal->map_ + 16, sizeof(ids));
+  for (long long i = 0; i < journal->count_; i++) 
+  {
+    if (records[i].session_ >= ids) 
+    {
+      ids = records[i].session_ + 1;
+    }
+  }
+  int* slots = calloc((size_t)ids + 1, sizeof(int)); //session index + 1
+  if (slots == NULL) 
+  {
+    return memoryError();
+  }
+
+  for (long long i = 0; i < journal->count_; i++) 
+  {
+    JournalRecord* record = &records[i];
+    int slot = slots[record->session_];
+    Session* session = slot > 0 ? server->sessions_[slot - 1] : NULL;
+    if (record->kind_ == JOURNAL_DEAL) 
+    {
+      if (record->hand_ >= dealt) 
+      {
+        dealt = (long long)record->hand_ + 1;
+      }
+      if (session == NULL && server->count_ < max_sessions) 
+      {
+        session = malloc(sizeof(Session));
+        if (session == NULL) 
+        {
+          free(slots);
+          return memoryError();
+        }
+        memset(session, 0, sizeof(Session));
+        session->socket_ = -1;
+        session->id_ = record->session_;
+        server->sessions_[server->count_++] = session;
+        slots[record->session_] = server->count_;
+      }
+      if (session != NULL) 
+      {
+        session->hand_ = record->hand_;
+        session->settled_ = 0;
+        session->action_count_ = 0;
+      }
+    }
+    else if (session == NULL) 
+    {
+      continue;
+    }
+    else if (record->kind_ == JOURNAL_ACTION &&
+     session->action_count_ < SESSION_ACTIONS) 
+    {
+      session->actions_[session->action_count_++] = record->value_;
+    }
+    else if (record->kind_ == JOURNAL_RESULT) 
+    {
+      session->settled_ = 1;
+    }
+    else if (record->kind_ == JOURNAL_CLOSE) 
+    {
+      Session* last = server->sessions_[--server->count_];
+      server->sessions_[slot - 1] = last;
+      slots[last->id_] = slot;
+      slots[record->session_] = 0;
+      free(session);
+    }
+  }
+  free(slots);
+
+  for (int i = 0; i < server->count_; i++) 
+  {
+    Session* session = server->sessions_[i];
+    dealGame(&session->game_, server->deck_,
+     handSeed(server, session->hand_));
+    int outcome = OUTCOME_PLAYING;
+    for (int k = 0; k < session->action_count_ && outcome == OUTCOME_PLAYING;
+     k++) 
+    {
+      outcome = applyAction(&session->game_, session->actions_[k]);
+    }
+    if (outcome != OUTCOME_PLAYING) 
+    {
+      session->settled_ = 1;
+    }
+  }
+  server->dealt_ = dealt;
+  server->next_id_ = ids;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Rewrites the journal with only the live sessions (each one's current
+/// deal and actions) and atomically replaces the old file with it, so the
+/// journal stays proportional to the live sessions, not to the hands ever
+/// played.
+///
+/// @return zero on success, otherwise FILE_ERROR
+///
+//
+int compactJournal(Server* server)
+{
+  Journal* journal = server->journal_;
+  char path[PATH_LENGTH + 8];
+  snprintf(path, sizeof(path), "%s.tmp", journal->path_);
+  unlink(path);
+  Journal compacted;
+  int seed = server->seed_;
+  if (openJournal(&compacted, path, &seed) != 0) 
+  {
+    return FILE_ERROR;
+  }
+  for (int i = 0; i < server->count_; i++) 
+  {
+    Session* session = server->sessions_[i];
+    if (session->closed_) 
+    {
+      continue;
+    }
+    journalAppend(&compacted, session->id_, JOURNAL_DEAL, session->hand_, 0);
+    for (int k = 0; k < session->action_count_; k++) 
+    {
+      journalAppend(&compacted, session->id_, JOURNAL_ACTION, session->hand_,
+       session->actions_[k]);
+    }
+    if (session->settled_) 
+    {
+      journalAppend(&compacted, session->id_, JOURNAL_RESULT, session->hand_,
+       0);
+    }
+  }
+  memcpy(compacted.map_ + 8, &server->dealt_, sizeof(server->dealt_));
+  memcpy(compacted.map_ + 16, &server->next_id_, sizeof(server->next_id_));
+  if (msync(compacted.map_, JOURNAL_HEADER +
+   compacted.count_ * sizeof(JournalRecord), MS_SYNC) != 0 ||
+   rename(path, journal->path_) != 0) 
+  {
+    closeJournal(&compacted);
+    unlink(path);
+    return FILE_ERROR;
+  }
+  compacted.path_ = journal->path_;
+  compacted.synced_ = compacted.count_;
+  compacted.compact_at_ = compacted.count_ * 4 > JOURNAL_RECORDS ?
+   compacted.count_ * 4 : JOURNAL_RECORDS;
+  closeJournal(journal);
+  *journal = compacted;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Raises the limit of open files to its maximum, for a socket per client.
+///
+//
+void raiseFileLimit(void)
+{
+  struct rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 &&
+   files.rlim_cur < files.rlim_max) 
+  {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Game server. Every client connected to @socket_path plays hand after
+/// hand: the server sends 'SESSION <id>', then 'DEAL <card> <card> <score>
+/// <upcard>', 'CARD <card> <score>', 'DEALER <cards...> <score>', 'TIMEOUT'
+/// and 'RESULT <LOSE|PUSH|WIN|BLACKJACK>' lines; the client sends 'h', 's'
+/// or 'q' (quit) bytes, or 'r<id>\n' to resume a session restored from the
+/// journal. A player who does not decide within @timeout_ms stands. All
+/// decision timeouts live in one hierarchical timer wheel driven by the
+/// poll loop, so arming and cancelling them is O(1) however many sessions
+/// wait. Runs until SIGINT or SIGTERM.
+///
+/// With a @journal_path every deal, action, result and close is appended
+/// to a memory-mapped journal, and each turn of the event loop commits the
+/// transitions it made with a single msync (group commit), before the
+/// clients can act on them again. A restarted server replays the journal,
+/// so the sessions live at a crash survive it with the same cards.
+///
+/// With a secure shuffle every shoe is committed to before its first card
+/// ('COMMIT <sha256>') and revealed after the result ('REVEAL <salt>
+/// <rank codes>'), and with an @audit_path appended to that audit log.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed; every hand gets its own shuffle. An existing
+///             journal keeps the seed it was started with.
+/// @param socket_path Where clients connect.
+/// @param timeout_ms The decision timeout.
+/// @param max_sessions The most clients served at once.
+/// @param journal_path The journal file, or NULL.
+/// @param audit_path The audit log, or NULL.
+/// @return zero on success, otherwise error code
+///
+//
+int runServer(Card* deck, int seed, char* socket_path, int timeout_ms,
+ int max_sessions, char* journal_path, char* audit_path)
+{
+  raiseFileLimit();
+  Server* server = malloc(sizeof(Server));
+  Session** sessions = malloc(sizeof(Session*) * max_sessions);
+  struct pollfd* fds = malloc(sizeof(struct pollfd) * (max_sessions + 1));
+  Journal* journal = malloc(sizeof(Journal));
+  if (server == NULL || sessions == NULL || fds == NULL || journal == NULL) 
+  {
+    free(server);
+    free(sessions);
+    free(fds);
+    free(journal);
+    return memoryError();
+  }
+  memset(server, 0, sizeof(Server));
+  server->deck_ = deck;
+  server->timeout_ = (timeout_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  server->sessions_ = sessions;
+  initWheel(&server->wheel_, nowTick());
+  if (journal_path != NULL) 
+  {
+    if (openJournal(journal, journal_path, &seed) != 0) 
+    {
+      free(server);
+      free(sessions);
+      free(fds);
+      free(journal);
+      return fileError();
+    }
+    server->journal_ = journal;
+  }
+  server->seed_ = seed;
+  int result = 0;
+  if (audit_path != NULL) 
+  {
+    server->audit_ = openAuditLog(audit_path);
+    result = server->audit_ == NULL ? fileError() : 0;
+  }
+  if (result == 0 && server->journal_ != NULL) 
+  {
+    result = replayJournal(server, max_sessions);
+    if (result == 0 && compactJournal(server) != 0) 
+    {
+      result = fileError();
+    }
+    if (result == 0) 
+    {
+      printf("RESTORED SESSIONS: %d\n", server->count_);
+    }
+  }
+
+  int listener = result == 0 ? openUnixSocket(socket_path, 1) : -1;
+  if (result == 0 && listener < 0) 
+  {
+    printf("[ERR] Cannot listen on %s.\n", socket_path);
+    result = SIMULATION_ERROR;
+  }
+  if (listener >= 0) 
+  {
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  server_stopped = 0;
+  if (result == 0) 
+  {
+    printf("SERVING ON %s\n", socket_path);
+    fflush(stdout);
+  }
+
+  while (result == 0 && !server_stopped) 
+  {
+    int count = server->count_;
+    fds[0].fd = count < max_sessions ? listener : -1;
+    fds[0].events = POLLIN;
+    for (int i = 0; i < count; i++) 
+    {
+      fds[1 + i].fd = sessions[i]->socket_;
+      fds[1 + i].events = POLLIN;
+    }
+    if (poll(fds, count + 1, server->wheel_.count_ > 0 ? TIMER_TICK_MS : -1)
+     < 0 && errno != EINTR) 
+    {
+      result = SIMULATION_ERROR;
+      break;
+    }
+
+    Timer* timer;
+    long long now = nowTick();
+    while ((timer = nextExpired(&server->wheel_, now)) != NULL) 
+    {
+      Session* session = (Session*)timer;
+      server->timeouts_++;
+      sessionPrint(session, "TIMEOUT\n");
+      sessionAction(server, session, ACTION_STAND);
+    }
+
+    for (int i = 0; i < count; i++) 
+    {
+      Session* session = sessions[i];
+      if (fds[1 + i].fd < 0 ||
+       !(fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR))) 
+      {
+        continue;
+      }
+      char input[SERVER_LINE_LENGTH];
+      ssize_t n = recv(session->socket_, input, sizeof(input), MSG_DONTWAIT);
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) 
+      {
+        session->closed_ = 1;
+      }
+      for (ssize_t k = 0; k < n && !session->closed_; k++) 
+      {
+        if (session->resuming_ && input[k] >= '0' && input[k] <= '9') 
+        {
+          session->resume_id_ = session->resume_id_ * 10 + (input[k] - '0');
+        }
+        else if (session->resuming_) 
+        {
+          session->resuming_ = 0;
+          if (input[k] == '\n') 
+          {
+            session = resumeSession(server, session);
+          }
+        }
+        else if (input[k] == 'r') 
+        {
+          session->resuming_ = 1;
+          session->resume_id_ = 0;
+        }
+        else if (input[k] == 'h' || input[k] == 's') 
+        {
+          sessionAction(server, session,
+           input[k] == 'h' ? ACTION_HIT : ACTION_STAND);
+        }
+        else if (input[k] == 'q') 
+        {
+          session->closed_ = 1;
+        }
+      }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < count; i++) 
+    {
+      if (sessions[i]->closed_) 
+      {
+        journalAppend(server->journal_, sessions[i]->id_, JOURNAL_CLOSE,
+         sessions[i]->hand_, 0);
+        cancelTimer(&server->wheel_, &sessions[i]->timer_);
+        if (sessions[i]->socket_ >= 0) 
+        {
+          close(sessions[i]->socket_);
+        }
+        free(sessions[i]);
+        continue;
+      }
+      sessions[kept++] = sessions[i];
+    }
+    server->count_ = kept;
+
+    while (fds[0].fd >= 0 && (fds[0].revents & POLLIN) &&
+     server->count_ < max_sessions) 
+    {
+      int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) 
+      {
+        break;
+      }
+      Session* session = malloc(sizeof(Session));
+      if (session == NULL) 
+      {
+        close(fd);
+        break;
+      }
+      memset(session, 0, sizeof(Session));
+      session->socket_ = fd;
+      session->id_ = server->next_id_++;
+      sessions[server->count_++] = session;
+      server->connected_++;
+      sessionPrint(session, "SESSION %u\n", session->id_);
+      sessionDeal(server, session);
+    }
+
+    if (server->journal_ != NULL &&
+     ((server->journal_->count_ >= server->journal_->compact_at_ &&
+     compactJournal(server) != 0) || journalCommit(server->journal_) != 0)) 
+    {
+      result = fileError();
+    }
+    if (server->audit_ != NULL &&
+     (fflush(server->audit_) != 0 || ferror(server->audit_))) 
+    {
+      result = fileError();
+    }
+  }
+
+  for (int i = 0; i < server->count_; i++) 
+  {
+    if (sessions[i]->socket_ >= 0) 
+    {
+      close(sessions[i]->socket_);
+    }
+    free(sessions[i]);
+  }
+  if (listener >= 0) 
+  {
+    close(listener);
+    unlink(socket_path);
+  }
+  if (server->journal_ != NULL) 
+  {
+    journalCommit(server->journal_);
+    closeJournal(server->journal_);
+  }
+  if (server->audit_ != NULL) 
+  {
+    fclose(server->audit_);
+  }
+  printf("SESSIONS: %lld\n", server->connected_);
+  printf("HANDS: %lld\n", server->hands_);
+  printf("TIMEOUTS: %lld\n", server->timeouts_);
+  free(server);
+  free(sessions);
+  free(fds);
+  free(journal);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Checks that the interposed allocator counts blocks: a block grown by
+/// realloc and freed, and one freed by realloc(p, 0), leave no live block
+/// behind and the growth counts as a resize.
+///
+/// @return 1 if the counters work, otherwise 0
+///
+//
+int checkCounters(void)
+{
+  long long live = atomic_load(&allocations) - atomic_load(&frees);
+  long long resized = atomic_load(&resizes);
+  char* volatile block = malloc(16); //volatile, or the calls are elided
+  char* grown = block != NULL ? realloc(block, 1 << 20) : NULL;
+  if (grown == NULL) 
+  {
+    free(block);
+    return memoryError() == 0;
+  }
+  block = grown;
+  free(block);
+  block = malloc(16);
+  block = realloc(block, 0);
+  int passed = atomic_load(&allocations) - atomic_load(&frees) == live &&
+   atomic_load(&resizes) - resized == 1;
+  if (!passed) 
+  {
+    printf("[ERR] The allocation counters do not count blocks.\n");
+  }
+  return passed;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Runs @rounds rounds of @engine after @warmup rounds and reports the
+/// allocations, frees and resizes of the measured rounds.
+///
+/// @return 1 if the measured rounds did not allocate, otherwise 0
+///
+//
+int checkSteadyState(char* name, AllocationEngine engine, void* context,
+ long long warmup, long long rounds)
+{
+  for (long long r = 0; r < warmup; r++) 
+  {
+    engine(context, r);
+  }
+  long long allocated = atomic_load(&allocations);
+  long long freed = atomic_load(&frees);
+  long long resized = atomic_load(&resizes);
+  long long start = nowNs();
+  for (long long r = warmup; r < warmup + rounds; r++) 
+  {
+    engine(context, r);
+  }
+  long long elapsed = nowNs() - start;
+  allocated = atomic_load(&allocations) - allocated;
+  freed = atomic_load(&frees) - freed;
+  resized = atomic_load(&resizes) - resized;
+  int passed = allocated == 0 && freed == 0 && resized == 0;
+  printf("%-12s %10lld rounds %8.1f ns  ALLOCATIONS: %lld  FREES: %lld  "
+   "RESIZES: %lld  %s\n", name, rounds, (double)elapsed / rounds, allocated,
+   freed, resized, passed ? "PASS" : "FAIL");
+  return passed;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Allocation check round of the interactive engine: deals a game, plays
+/// it through applyAction hitting below 17 and renders every frame. As in
+/// playGame, every decision point goes to the speculative analysis, whose
+/// frame is waited for and shown for a hit.
+///
+//
+void interactiveRound(void* context, long long r)
+{
+  AllocationCheck* check = context;
+  Game* game = &check->game_;
+  dealGame(game, check->deck_, roundSeed(check->seed_, r));
+  renderCards(check->sink_, game->dealer_, 1, game->dealer_[0].points_,
+   check->width_, check->height_, 0);
+  int outcome = OUTCOME_PLAYING;
+  while (outcome == OUTCOME_PLAYING && game->player_score_ < 21) 
+  {
+    postDecision(&check->analysis_, game);
+    waitFrame(&check->analysis_);
+    renderCards(check->sink_, game->player_, game->player_count_,
+     game->player_score_, check->width_, check->height_, 1);
+    int action = game->player_score_ < DEFAULT_STAND_ON ? ACTION_HIT :
+     ACTION_STAND;
+    int framed = action == ACTION_HIT &&
+     takeFrame(&check->analysis_, check->sink_);
+    outcome = applyAction(game, action);
+    if (action == ACTION_HIT && !framed) 
+    {
+      renderCards(check->sink_, game->player_, game->player_count_,
+       game->player_score_, check->width_, check->height_, 1);
+    }
+  }
+  renderCards(check->sink_, game->dealer_, game->dealer_count_,
+   game->dealer_score_, check->width_, check->height_, 0);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Allocation check round of the simulator.
+///
+//
+void simulatorRound(void* context, long long r)
+{
+  AllocationCheck* check = context;
+  Round round;
+  simulateRound(check->deck_, check->seed_, r, &check->strategy_, &round);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Allocation check round of the server: a session connected through a
+/// socket pair decides (hit below 17, else stand) through sessionAction,
+/// with its timeout armed and cancelled in the timer wheel as in
+/// runServer, until a hand is settled; the client side is drained.
+///
+//
+void serverRound(void* context, long long r)
+{
+  (void)r;
+  AllocationCheck* check = context;
+  Session* session = check->session_;
+  long long hands = check->server_->hands_;
+  while (check->server_->hands_ == hands && !session->closed_) 
+  {
+    sessionAction(check->server_, session,
+     session->game_.player_score_ < DEFAULT_STAND_ON ?
+     ACTION_HIT : ACTION_STAND);
+    char output[SERVER_LINE_LENGTH];
+    while (recv(check->client_, output, sizeof(output), MSG_DONTWAIT) > 0) 
+    {
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sets up the engines of the allocation check and the soak test: a game
+/// rendered to /dev/null with its speculative analysis running, the
+/// default strategy and a server session with its client on a socket
+/// pair, dealt its first hand.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @return AllocationCheck* The engines, or NULL if they could not be set up.
+///
+//
+AllocationCheck* openAllocationCheck(Card* deck, int seed, int width,
+ int height)
+{
+  AllocationCheck* check = malloc(sizeof(AllocationCheck));
+  Server* server = malloc(sizeof(Server));
+  Session* session = malloc(sizeof(Session));
+  int sockets[2] = { -1, -1 };
+  FILE* sink = fopen("/dev/null", "w");
+  if (check == NULL || server == NULL || session == NULL || sink == NULL ||
+   socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) != 0) 
+  {
+    free(check);
+    free(server);
+    free(session);
+    if (sink != NULL) 
+    {
+      fclose(sink);
+    }
+    return NULL;
+  }
+  memset(check, 0, sizeof(AllocationCheck));
+  memset(server, 0, sizeof(Server));
+  memset(session, 0, sizeof(Session));
+  check->deck_ = deck;
+  check->seed_ = seed;
+  check->width_ = width;
+  check->height_ = height;
+  check->sink_ = sink;
+  if (startAnalysis(&check->analysis_, width, height) != 0) 
+  {
+    close(sockets[0]);
+    close(sockets[1]);
+    fclose(sink);
+    free(check);
+    free(server);
+    free(session);
+    return NULL;
+  }
+  thresholdStrategy(&check->strategy_, DEFAULT_STAND_ON);
+  server->deck_ = deck;
+  server->seed_ = seed;
+  server->timeout_ = 1000 / TIMER_TICK_MS;
+  initWheel(&server->wheel_, nowTick());
+  session->socket_ = sockets[0];
+  check->server_ = server;
+  check->session_ = session;
+  check->client_ = sockets[1];
+  sessionDeal(server, session);
+  return check;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Tears down what openAllocationCheck set up.
+///
+//
+void closeAllocationCheck(AllocationCheck* check)
+{
+  cancelTimer(&check->server_->wheel_, &check->session_->timer_);
+  close(check->session_->socket_);
+  close(check->client_);
+  stopAnalysis(&check->analysis_);
+  fclose(check->sink_);
+  free(check->server_);
+  free(check->session_);
+  free(check);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Allocation check mode: after a warm-up, plays @rounds rounds each of
+/// the interactive engine, the simulator and a server session, and fails
+/// if any of them allocates or frees memory in steady state. Allocations
+/// are counted by the interposed malloc and free.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param rounds The number of measured rounds per engine.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @return zero if nothing allocated, otherwise error code
+///
+//
+int checkAllocations(Card* deck, int seed, long long rounds, int width,
+ int height)
+{
+  printf("STARTUP ALLOCATIONS: %lld  FREES: %lld  RESIZES: %lld\n",
+   (long long)atomic_load(&allocations), (long long)atomic_load(&frees),
+   (long long)atomic_load(&resizes));
+  if (!checkCounters()) 
+  {
+    return SIMULATION_ERROR;
+  }
+  AllocationCheck* check = openAllocationCheck(deck, seed, width, height);
+  if (check == NULL) 
+  {
+    return memoryError();
+  }
+
+  long long warmup = rounds / 100 + 1;
+  int passed = checkSteadyState("INTERACTIVE", interactiveRound, check,
+   warmup, rounds);
+  passed &= checkSteadyState("SIMULATOR", simulatorRound, check, warmup,
+   rounds);
+  passed &= checkSteadyState("SERVER", serverRound, check, warmup, rounds);
+  if (check->session_->closed_) 
+  {
+    printf("[ERR] Server session closed during the check.\n");
+    passed = 0;
+  }
+
+  closeAllocationCheck(check);
+  return passed ? 0 : SIMULATION_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Measures how long shuffling a shoe takes with rand() (FisherYates) and
+/// with ChaCha20 (secureShuffle), dealing round robin to @tables tables so
+/// their shoes compete for the caches as they would on a busy server. With
+/// a corpus mapped, also how long dealing a shoe from it takes.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param tables The number of tables.
+/// @param shoes The number of shoes shuffled with each generator.
+/// @return zero on success, otherwise error code
+///
+//
+int benchmarkShuffles(Card* deck, int seed, int tables, long long shoes)
+{
+  int size = definition.shoe_size_;
+  Card* table_shoes = malloc(sizeof(Card) * size * tables);
+  if (table_shoes == NULL) 
+  {
+    return memoryError();
+  }
+  double costs[2];
+  for (int secure = 0; secure < 2; secure++) 
+  {
+    long long start = nowNs();
+    for (long long i = 0; i < shoes; i++) 
+    {
+      Card* shoe = table_shoes + (i % tables) * size;
+      memcpy(shoe, deck, sizeof(Card) * size);
+      if (secure) 
+      {
+        secureShuffle(shoe, size, i);
+      }
+      else 
+      {
+        FisherYates(shoe, size, roundSeed(seed, i));
+      }
+    }
+    costs[secure] = (double)(nowNs() - start) / shoes;
+  }
+  double corpus_cost = 0;
+  if (corpus.codes_ != NULL) 
+  {
+    long long start = nowNs();
+    for (long long i = 0; i < shoes; i++) 
+    {
+      corpusShoe(i, table_shoes + (i % tables) * size);
+    }
+    corpus_cost = (double)(nowNs() - start) / shoes;
+  }
+  free(table_shoes);
+  printf("SHOE SIZE: %d\n", size);
+  printf("RAND: %.1f ns\n", costs[0]);
+  printf("CHACHA20: %.1f ns (%d lanes)\n", costs[1], CHACHA_LANES);
+  printf("RATIO: %.2f\n", costs[1] / costs[0]);
+  if (corpus.codes_ != NULL) 
+  {
+    printf("CORPUS: %.1f ns (%lld shoes)\n", corpus_cost, corpus.shoes_);
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes a corpus of @shoes shoes: shoe i is @deck shuffled with the seed
+/// of round i, so dealing from the corpus (see openCorpus) plays the same
+/// cards as shuffling with @seed does. Shoes are stored as rank codes (see
+/// packRanks).
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param path The corpus file.
+/// @param shoes The number of shoes.
+/// @return zero on success, otherwise error code
+///
+//
+int writeCorpus(Card* deck, int seed, char* path, long long shoes)
+{
+  CorpusHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, CORPUS_MAGIC, 4);
+  header.seed_ = seed;
+  header.ranks_ = definition.ranks_;
+  header.shoe_size_ = definition.shoe_size_;
+  header.shoes_ = shoes;
+  memcpy(header.points_, definition.points_, sizeof(header.points_));
+  memcpy(header.copies_, definition.copies_, sizeof(header.copies_));
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+  int written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+  int size = definition.shoe_size_;
+  int shoe_bytes = (size + 1) / 2;
+  Card cards[MAX_SHOE_SIZE];
+  unsigned char codes[MAX_SHOE_SIZE / 2 + 1];
+  long long start = nowNs();
+  for (long long i = 0; i < shoes && written; i++) 
+  {
+    memcpy(cards, deck, sizeof(Card) * size);
+    FisherYates(cards, size, roundSeed(seed, i));
+    packRanks(cards, size, codes);
+    written = fwrite(codes, shoe_bytes, 1, file) == 1;
+  }
+  if (fclose(file) != 0 || !written) 
+  {
+    return fileError();
+  }
+  printf("CORPUS: %lld SHOES OF %d CARDS, %d BYTES EACH\n", shoes, size,
+   shoe_bytes);
+  printf("WRITTEN IN: %.1f ns PER SHOE\n",
+   (double)(nowNs() - start) / shoes);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the card of rank @rank.
+///
+//
+Card rankCard(int rank)
+{
+  Card card = { card_assets.images_[rank], definition.points_[rank], rank };
+  return card;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Maps a corpus written by writeCorpus, so that every round, tournament
+/// round and dealt game is dealt from it instead of shuffled (see
+/// roundShoe). The corpus must be of the loaded definition and every shoe
+/// must hold its cards.
+///
+/// @param path The corpus file.
+/// @return zero on success, otherwise error code
+///
+//
+int openCorpus(char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) 
+  {
+    return fileError();
+  }
+  struct stat status;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &status) == 0 &&
+   status.st_size >= (off_t)sizeof(CorpusHeader)) 
+  {
+    map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) 
+  {
+    return fileError();
+  }
+
+  CorpusHeader header;
+  memcpy(&header, map, sizeof(header));
+  long long shoe_bytes = (header.shoe_size_ + 1) / 2;
+  int valid = memcmp(header.magic_, CORPUS_MAGIC, 4) == 0 &&
+   header.shoe_size_ >= MIN_SHOE_SIZE &&
+   header.shoe_size_ <= MAX_SHOE_SIZE && header.shoes_ >= 1 &&
+   header.shoes_ <= (status.st_size - (off_t)sizeof(header)) / shoe_bytes &&
+   (off_t)sizeof(header) + header.shoes_ * shoe_bytes == status.st_size;
+  if (!valid) 
+  {
+    munmap(map, status.st_size);
+    return fileError();
+  }
+  if (header.ranks_ != definition.ranks_ ||
+   header.shoe_size_ != definition.shoe_size_ ||
+   memcmp(header.points_, definition.points_,
+    sizeof(int) * definition.ranks_) != 0 ||
+   memcmp(header.copies_, definition.copies_,
+    sizeof(int) * definition.ranks_) != 0) 
+  {
+    printf("[ERR] The corpus %s is of another game definition.\n", path);
+    munmap(map, status.st_size);
+    return FILE_ERROR;
+  }
+
+  unsigned char* codes = (unsigned char*)map + sizeof(header);
+  for (long long h = 0; h < header.shoes_; h++) 
+  {
+    int counts[16] = { 0 };
+    for (int c = 0; c < definition.shoe_size_; c++) 
+    {
+      counts[(codes[h * shoe_bytes + (c >> 1)] >> (4 * (c & 1))) & 0x0f]++;
+    }
+    if (memcmp(counts, definition.copies_,
+     sizeof(int) * definition.ranks_) != 0) 
+    {
+      printf("[ERR] Shoe %lld of the corpus %s is not a full shoe.\n", h,
+       path);
+      munmap(map, status.st_size);
+      return FILE_ERROR;
+    }
+  }
+
+  corpus.map_ = map;
+  corpus.size_ = status.st_size;
+  corpus.codes_ = codes;
+  corpus.shoes_ = header.shoes_;
+  corpus.shoe_bytes_ = shoe_bytes;
+  atomic_store(&corpus.wrapped_, 0);
+  for (int r = 0; r < definition.ranks_; r++) 
+  {
+    corpus.cards_[r] = rankCard(r);
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Unmaps the corpus; rounds are shuffled again.
+///
+//
+void closeCorpus(void)
+{
+  munmap(corpus.map_, corpus.size_);
+  memset(&corpus, 0, sizeof(corpus));
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Opens the index of the history @path for appending: '<path>.idx'.
+///
+//
+FILE* openHistoryIndex(char* path, char* mode)
+{
+  char index_path[PATH_LENGTH + sizeof(INDEX_EXTENSION)];
+  snprintf(index_path, sizeof(index_path), "%s%s", path, INDEX_EXTENSION);
+  return fopen(index_path, mode);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Plays @rounds rounds of @strategy at one table and writes its hand
+/// history. Rounds are dealt one after another from the same shoe, which
+/// is replaced by the next shuffled shoe (see roundShoe, shoes are counted
+/// like rounds) once fewer than a quarter of its cards, or MIN_SHOE_SIZE,
+/// are left. A round is a HistoryRecord with its hits, so it replays from
+/// the shoe and its position. Every new shoe, and every @keyframe_rounds
+/// rounds, a keyframe with the shoe, position and totals is written. The
+/// first keyframe of every HISTORY_INDEX_ROUNDS rounds is entered in the
+/// sparse index '<path>.idx' (see seekHistory).
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param path The history file.
+/// @param rounds The number of rounds.
+/// @param strategy The player's decisions.
+/// @param keyframe_rounds The most rounds between keyframes.
+/// @return zero on success, otherwise error code
+///
+//
+int recordHistory(Card* deck, int seed, char* path, long long rounds,
+ Strategy* strategy, int keyframe_rounds)
+{
+  HistoryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, HISTORY_MAGIC, 4);
+  header.keyframe_rounds_ = keyframe_rounds;
+  struct timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  header.start_time_ = wall.tv_sec * 1000000000LL + wall.tv_nsec;
+  header.definition_ = definition;
+  header.strategy_ = *strategy;
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+  FILE* index = openHistoryIndex(path, "wb");
+  if (index == NULL) 
+  {
+    fclose(file);
+    return fileError();
+  }
+  int written = fwrite(&header, sizeof(header), 1, file) == 1;
+  long long offset = sizeof(header);
+
+  int size = definition.shoe_size_;
+  int reserve = size / 4 > MIN_SHOE_SIZE ? size / 4 : MIN_SHOE_SIZE;
+  int shoe_bytes = (size + 1) / 2;
+  Card shoe[MAX_SHOE_SIZE];
+  unsigned char codes[MAX_SHOE_SIZE / 2 + 1];
+  HistoryKeyframe keyframe;
+  memset(&keyframe, 0, sizeof(keyframe));
+  int position = size;
+  long long shuffles = 0;
+  long long keyframes = 0;
+  long long entries = 0;
+  long long next_entry = 0;
+  int since_keyframe = 0;
+  Round round;
+  long long start = nowNs();
+  for (long long r = 0; r < rounds && written; r++) 
+  {
+    long long time = nowNs() - start;
+    int new_shoe = size - position < reserve;
+    if (new_shoe) 
+    {
+      roundShoe(shoe, deck, seed, shuffles++);
+      position = 0;
+    }
+    if (new_shoe || since_keyframe >= keyframe_rounds) 
+    {
+      if (r >= next_entry) 
+      {
+        HistoryIndex entry = { r, time, offset };
+        written = fwrite(&entry, sizeof(entry), 1, index) == 1;
+        next_entry = (r / HISTORY_INDEX_ROUNDS + 1) * HISTORY_INDEX_ROUNDS;
+        entries++;
+      }
+      HistoryRecord record = { HISTORY_KEYFRAME, 0, 0, 0, 0, time };
+      keyframe.round_ = r;
+      keyframe.position_ = position;
+      packRanks(shoe, definition.shoe_size_, codes);
+      written = written && fwrite(&record, sizeof(record), 1, file) == 1 &&
+       fwrite(&keyframe, sizeof(keyframe), 1, file) == 1 &&
+       fwrite(codes, shoe_bytes, 1, file) == 1;
+      offset += sizeof(record) + sizeof(keyframe) + shoe_bytes;
+      since_keyframe = 0;
+      keyframes++;
+    }
+
+    playRound(shoe + position, strategy, &round, NULL);
+    int cards = round.player_count_ + round.dealer_count_;
+    HistoryRecord record = {
+      HISTORY_ROUND, round.player_count_ - 2, round.outcome_, cards, 0, time
+    };
+    written = written && fwrite(&record, sizeof(record), 1, file) == 1;
+    offset += sizeof(record);
+    addOutcome(&keyframe.stats_, round.outcome_);
+    position += cards;
+    since_keyframe++;
+  }
+  double cost = (double)(nowNs() - start) / rounds;
+  if (fclose(index) != 0) 
+  {
+    written = 0;
+  }
+  if (fclose(file) != 0 || !written) 
+  {
+    return fileError();
+  }
+  printf("HISTORY: %lld ROUNDS, %lld SHOES, %lld KEYFRAMES, "
+   "%lld INDEX ENTRIES, %lld BYTES\n", rounds, shuffles, keyframes, entries,
+   offset);
+  printf("RECORDED IN: %.1f ns PER ROUND\n", cost);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Finds a round of a hand history (see recordHistory) and shows it: the
+/// index is binary searched for the last entry before the round (an index
+/// with an entry that is no keyframe of the file is ignored), the records
+/// after it are skipped to the last keyframe before the round and the
+/// rounds from that keyframe are replayed. Replayed rounds must take the
+/// hits and cards and have the outcomes that were recorded.
+///
+/// @param path The history file.
+/// @param by_time Whether @target is seconds since the history started
+///        (the last round started by then) instead of a round.
+/// @param target The round, or the seconds.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @return zero on success, otherwise error code
+///
+//
+int seekHistory(char* path, int by_time, double target, int width,
+ int height)
+{
+  long long start = nowNs();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) 
+  {
+    return fileError();
+  }
+  struct stat status;
+  char* map = MAP_FAILED;
+  if (fstat(fd, &status) == 0 &&
+   status.st_size >= (off_t)sizeof(HistoryHeader)) 
+  {
+    map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) 
+  {
+    return fileError();
+  }
+  HistoryHeader header;
+  memcpy(&header, map, sizeof(header));
+  if (memcmp(header.magic_, HISTORY_MAGIC, 4) != 0 ||
+   header.definition_.ranks_ != definition.ranks_ ||
+   header.definition_.shoe_size_ != definition.shoe_size_) 
+  {
+    printf("[ERR] %s is not a hand history of this game.\n", path);
+    munmap(map, status.st_size);
+    return FILE_ERROR;
+  }
+  long long size = status.st_size;
+  long long keyframe_size = sizeof(HistoryRecord) + sizeof(HistoryKeyframe) +
+   (definition.shoe_size_ + 1) / 2;
+  long long target_round = (long long)target;
+  long long target_time = (long long)(target * 1e9);
+
+  //the last index entry at or before the target
+  long long offset = sizeof(header);
+  FILE* index = openHistoryIndex(path, "rb");
+  if (index != NULL) 
+  {
+    HistoryIndex entry;
+    HistoryRecord indexed;
+    fseek(index, 0, SEEK_END);
+    long long low = 0;
+    long long high = ftell(index) / (long long)sizeof(entry) - 1;
+    while (low <= high) 
+    {
+      long long middle = (low + high) / 2;
+      fseek(index, middle * sizeof(entry), SEEK_SET);
+      if (fread(&entry, sizeof(entry), 1, index) != 1) 
+      {
+        break;
+      }
+      //a stale or corrupt entry that is no keyframe of this file
+      int valid = entry.offset_ >= (long long)sizeof(header) &&
+       entry.offset_ <= size - (long long)sizeof(indexed);
+      if (valid) 
+      {
+        memcpy(&indexed, map + entry.offset_, sizeof(indexed));
+      }
+      if (!valid || indexed.type_ != HISTORY_KEYFRAME) 
+      {
+        offset = sizeof(header);
+        break;
+      }
+      if (by_time ? entry.time_ <= target_time : entry.round_ <= target_round) 
+      {
+        offset = entry.offset_;
+        low = middle + 1;
+      }
+      else 
+      {
+        high = middle - 1;
+      }
+    }
+    fclose(index);
+  }
+
+  //skip to the last keyframe at or before the target
+  HistoryRecord record;
+  HistoryKeyframe keyframe;
+  long long keyframe_offset = -1;
+  long long round_number = -1;
+  long long found = -1;
+  while (offset + (long long)sizeof(record) <= size) 
+  {
+    memcpy(&record, map + offset, sizeof(record));
+    if (record.type_ == HISTORY_KEYFRAME) 
+    {
+      if (offset + keyframe_size > size) 
+      {
+        break;
+      }
+      memcpy(&keyframe, map + offset + sizeof(record), sizeof(keyframe));
+      if (by_time ? record.time_ > target_time :
+       keyframe.round_ > target_round) 
+      {
+        break;
+      }
+      keyframe_offset = offset;
+      round_number = keyframe.round_;
+      found = -1;
+      offset += keyframe_size;
+    }
+    else if (record.type_ == HISTORY_ROUND && round_number >= 0) 
+    {
+      if (by_time ? record.time_ > target_time : round_number > target_round) 
+      {
+        break;
+      }
+      found = round_number++;
+      offset += sizeof(record);
+    }
+    else 
+    {
+      break;
+    }
+  }
+  if (keyframe_offset < 0 || found < 0 ||
+   (!by_time && found != target_round)) 
+  {
+    printf("[ERR] The history %s has no such round.\n", path);
+    munmap(map, status.st_size);
+    return FILE_ERROR;
+  }
+
+  //replay from the keyframe
+  memcpy(&keyframe, map + keyframe_offset + sizeof(record), sizeof(keyframe));
+  Card ranks[MAX_RANKS];
+  Card shoe[MAX_SHOE_SIZE];
+  for (int r = 0; r < definition.ranks_; r++) 
+  {
+    ranks[r] = rankCard(r);
+  }
+  if (keyframe.position_ < 0 || keyframe.position_ > definition.shoe_size_ ||
+   !unpackRanks((unsigned char*)map + keyframe_offset + sizeof(record) +
+   sizeof(keyframe), definition.shoe_size_, ranks, shoe)) 
+  {
+    printf("[ERR] The keyframe of round %lld of %s is corrupt.\n",
+     keyframe.round_, path);
+    munmap(map, status.st_size);
+    return FILE_ERROR;
+  }
+  int position = keyframe.position_;
+  Stats stats = keyframe.stats_;
+  Round round = { 0 };
+  offset = keyframe_offset + keyframe_size;
+  long long replayed = 0;
+  for (long long r = keyframe.round_; r <= found; r++) 
+  {
+    memcpy(&record, map + offset, sizeof(record));
+    offset += sizeof(record);
+    int fits = position + record.cards_ <= definition.shoe_size_;
+    if (fits) 
+    {
+      playRound(shoe + position, &header.strategy_, &round, NULL);
+    }
+    if (!fits || record.hits_ != round.player_count_ - 2 ||
+     record.outcome_ != round.outcome_ ||
+     record.cards_ != round.player_count_ + round.dealer_count_) 
+    {
+      printf("[ERR] Round %lld of %s does not replay.\n", r, path);
+      munmap(map, status.st_size);
+      return FILE_ERROR;
+    }
+    addOutcome(&stats, round.outcome_);
+    if (r < found) 
+    {
+      position += record.cards_;
+    }
+    replayed++;
+  }
+  double seek_us = (nowNs() - start) / 1e3;
+
+  //the player got the first two cards and the hits, the dealer the rest
+  Card player[DECK_SIZE];
+  Card dealer[DECK_SIZE];
+  Card* cards = shoe + position;
+  player[0] = cards[0];
+  player[1] = cards[1];
+  dealer[0] = cards[2];
+  dealer[1] = cards[3];
+  memcpy(player + 2, cards + 4, sizeof(Card) * record.hits_);
+  memcpy(dealer + 2, cards + 4 + record.hits_,
+   sizeof(Card) * (round.dealer_count_ - 2));
+  char* names[] = { "LOSE", "PUSH", "WIN", "BLACKJACK" };
+  printf("ROUND %lld AT %.6f s (KEYFRAME OF ROUND %lld, %lld ROUNDS "
+   "REPLAYED IN %.1f us)\n", found, record.time_ / 1e9, keyframe.round_,
+   replayed, seek_us);
+  renderCards(stdout, dealer, round.dealer_count_, round.dealer_score_,
+   width, height, 0);
+  renderCards(stdout, player, round.player_count_, round.player_score_,
+   width, height, 1);
+  printf("RESULT: %s\n", names[round.outcome_]);
+  printf("AFTER %lld ROUNDS: NET %+lld\n", stats.rounds_,
+   stats.wins_ - stats.losses_);
+  munmap(map, status.st_size);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Measures what journaling a session transition costs: appending records
+/// alone, and appending with a group commit every JOURNAL_GROUP records.
+///
+/// @param path The journal file to write; it is removed afterwards.
+/// @param records The number of records per measurement.
+/// @return zero on success, otherwise error code
+///
+//
+int benchmarkJournal(char* path, long long records)
+{
+  Journal journal;
+  int seed = 0;
+  double costs[2];
+  for (int group = 0; group < 2; group++) 
+  {
+    unlink(path);
+    if (openJournal(&journal, path, &seed) != 0) 
+    {
+      return fileError();
+    }
+    long long start = nowNs();
+    for (long long i = 0; i < records; i++) 
+    {
+      journalAppend(&journal, (unsigned int)(i & 1023), JOURNAL_ACTION,
+       (unsigned int)i, (int)(i & 1));
+      if (group && i % JOURNAL_GROUP == JOURNAL_GROUP - 1) 
+      {
+        journalCommit(&journal);
+      }
+    }
+    journalCommit(&journal);
+    costs[group] = (double)(nowNs() - start) / records;
+    int failed = journal.failed_;
+    closeJournal(&journal);
+    if (failed) 
+    {
+      unlink(path);
+      return fileError();
+    }
+  }
+  unlink(path);
+  printf("APPEND: %.1f ns\n", costs[0]);
+  printf("APPEND + COMMIT EVERY %d: %.1f ns\n", JOURNAL_GROUP, costs[1]);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Measures how long saving and restoring a game snapshot takes.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The shuffle seed.
+/// @param iterations The number of save/restore pairs.
+///
+//
+void benchmarkSnapshots(Card* deck, int seed, long long iterations)
+{
+  Card ranks[MAX_RANKS];
+  Game game;
+  Game restored;
+  unsigned char snapshot[SNAPSHOT_SIZE];
+  rankTable(deck, ranks);
+  dealGame(&game, deck, seed);
+
+  long long start = nowNs();
+  for (long long i = 0; i < iterations; i++) 
+  {
+    game.seed_ = (int)i;
+    saveGame(&game, snapshot);
+  }
+  long long saved = nowNs();
+  int failures = 0;
+  for (long long i = 0; i < iterations; i++) 
+  {
+    snapshot[4] = (unsigned char)i;
+    failures += restoreGame(&restored, snapshot, ranks) != 0;
+  }
+  long long restored_at = nowNs();
+
+  printf("SNAPSHOT SIZE: %d bytes\n", snapshotSize());
+  printf("SAVE: %.1f ns\n", (double)(saved - start) / iterations);
+  printf("RESTORE: %.1f ns\n", (double)(restored_at - saved) / iterations);
+  printf("FAILURES: %d\n", failures);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the next number of a game's random stream, in range [0, bound).
+///
+//
+int envRandom(EnvGame* game, int bound)
+{
+  game->random_ += 0x9e3779b97f4a7c15ULL;
+  unsigned long long z = mix64(game->random_);
+  return (int)(((z >> 32) * (unsigned long long)bound) >> 32);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Deals the next card of a game's shoe and updates the running count
+/// (Hi-Lo: 2-6 count +1, tens and aces -1).
+///
+/// @param game The game.
+/// @param visible 1 if the player sees the card now.
+/// @return int The points of the card.
+///
+//
+int envDraw(EnvGame* game, int visible)
+{
+  int points = game->shoe_[game->position_++];
+  if (visible) 
+  {
+    game->running_count_ += points <= 6 ? 1 : points >= 10 ? -1 : 0;
+  }
+  return points;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Adds a card to a score with the same ace rule as giveCards.
+///
+/// @return int The new score.
+///
+//
+int envAdd(int score, int points)
+{
+  return score + (points == 11 && score > 10 ? 1 : points);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Starts the next round of a game, shuffling the shoe first once fewer
+/// than ENV_RESHUFFLE cards are left.
+///
+//
+void envDeal(EnvGame* game)
+{
+  if (game->position_ > definition.shoe_size_ - ENV_RESHUFFLE) 
+  {
+    for (int i = definition.shoe_size_ - 1; i > 0; i--) 
+    {
+      int j = envRandom(game, i + 1);
+      unsigned char tmp = game->shoe_[i];
+      game->shoe_[i] = game->shoe_[j];
+      game->shoe_[j] = tmp;
+    }
+    game->position_ = 0;
+    game->running_count_ = 0;
+  }
+
+  int first = envDraw(game, 1);
+  int second = envDraw(game, 1);
+  game->player_score_ = envAdd(first, second);
+  game->soft_ = first == 11 || (second == 11 && first <= 10);
+  game->player_cards_ = 2;
+  game->upcard_ = envDraw(game, 1);
+  game->hole_ = envDraw(game, 0);
+  game->dealer_score_ = envAdd(game->upcard_, game->hole_);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the observation of a game: hand total, soft flag (an ace counted
+/// as 11), dealer's upcard and the Hi-Lo true count.
+///
+//
+void envObserve(EnvGame* game, float* observation)
+{
+  int left = definition.shoe_size_ - game->position_;
+  observation[0] = game->player_score_;
+  observation[1] = game->soft_;
+  observation[2] = game->upcard_;
+  observation[3] = (float)game->running_count_ * DECK_SIZE / left;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Plays the dealer's turn the way the game does and returns the player's
+/// reward: +1 for a win, -1 for a loss and 0 for a push.
+///
+//
+float envDealer(EnvGame* game)
+{
+  int player = game->player_score_;
+  int dealer = game->dealer_score_;
+  int hole = game->hole_;
+  game->running_count_ += hole <= 6 ? 1 : hole >= 10 ? -1 : 0;
+
+  if (game->player_cards_ == 2 && player == 21) 
+  {
+    return dealer == 21 ? 0.0f : 1.0f;
+  }
+  if (dealer == 21) 
+  {
+    return -1.0f;
+  }
+  while (dealer < player) 
+  {
+    dealer = envAdd(dealer, envDraw(game, 1));
+  }
+  if (dealer == 21) 
+  {
+    return player == 21 ? 0.0f : -1.0f;
+  }
+  if (dealer > 21) 
+  {
+    return 1.0f;
+  }
+  return dealer == player ? 0.0f : -1.0f;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Creates @count independent games. Every game has its own random stream
+/// derived from @seed and its own shoe; all memory is allocated here, so
+/// stepping never allocates.
+///
+/// @param env The environment.
+/// @param deck The unshuffled deck.
+/// @param count The number of games.
+/// @param seed The run seed.
+/// @return zero on success, otherwise error code
+///
+//
+int createEnv(VecEnv* env, Card* deck, int count, int seed)
+{
+  env->count_ = count;
+  env->games_ = malloc(sizeof(EnvGame) * count);
+  if (env->games_ == NULL) 
+  {
+    return memoryError();
+  }
+  for (int i = 0; i < count; i++) 
+  {
+    EnvGame* game = &env->games_[i];
+    game->random_ = mix64(((unsigned long long)(unsigned)seed << 32) ^ i);
+    for (int c = 0; c < definition.shoe_size_; c++) 
+    {
+      game->shoe_[c] = deck[c].points_;
+    }
+    game->position_ = definition.shoe_size_;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Deals a new round in every game.
+///
+/// @param env The environment.
+/// @param observations OBSERVATION_SIZE floats per game.
+///
+//
+void resetEnv(VecEnv* env, float* observations)
+{
+  for (int i = 0; i < env->count_; i++) 
+  {
+    envDeal(&env->games_[i]);
+    envObserve(&env->games_[i], observations + i * OBSERVATION_SIZE);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Applies one action in every game. A round ends when the player busts,
+/// reaches 21, stands or was dealt a blackjack (which ends the round
+/// whatever the action). A finished game reports its reward with @dones
+/// set and is dealt the next round at once, so the observation written is
+/// already the first one of the new round.
+///
+/// @param env The environment.
+/// @param actions ACTION_STAND or ACTION_HIT per game.
+/// @param observations OBSERVATION_SIZE floats per game.
+/// @param rewards The reward per game.
+/// @param dones 1 per game whose round ended.
+///
+//
+void stepEnv(VecEnv* env, unsigned char* actions, float* observations,
+ float* rewards, unsigned char* dones)
+{
+  for (int i = 0; i < env->count_; i++) 
+  {
+    EnvGame* game = &env->games_[i];
+    float reward = 0.0f;
+    int done = 1;
+    int natural = game->player_cards_ == 2 && game->player_score_ == 21;
+
+    if (actions[i] == ACTION_HIT && !natural) 
+    {
+      int points = envDraw(game, 1);
+      game->soft_ |= points == 11 && game->player_score_ <= 10;
+      game->player_score_ = envAdd(game->player_score_, points);
+      game->player_cards_++;
+      if (game->player_score_ > 21) 
+      {
+        reward = -1.0f;
+        game->running_count_ += game->hole_ <= 6 ? 1 :
+         game->hole_ >= 10 ? -1 : 0;
+      }
+      else if (game->player_score_ == 21) 
+      {
+        reward = envDealer(game);
+      }
+      else 
+      {
+        done = 0;
+      }
+    }
+    else 
+    {
+      reward = envDealer(game);
+    }
+
+    if (done) 
+    {
+      envDeal(game);
+    }
+    rewards[i] = reward;
+    dones[i] = done;
+    envObserve(game, observations + i * OBSERVATION_SIZE);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Frees an environment.
+///
+//
+void destroyEnv(VecEnv* env)
+{
+  free(env->games_);
+  env->games_ = NULL;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Measures environment steps per second with a stand-on-17 policy.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param count The number of games.
+/// @param steps The number of batched steps.
+/// @return zero on success, otherwise error code
+///
+//
+int benchmarkEnv(Card* deck, int seed, int count, long long steps)
+{
+  VecEnv env;
+  float* observations = malloc(sizeof(float) * OBSERVATION_SIZE * count);
+  float* rewards = malloc(sizeof(float) * count);
+  unsigned char* actions = malloc(count);
+  unsigned char* dones = malloc(count);
+  if (observations == NULL || rewards == NULL || actions == NULL ||
+   dones == NULL || createEnv(&env, deck, count, seed) != 0) 
+  {
+    free(observations);
+    free(rewards);
+    free(actions);
+    free(dones);
+    return memoryError();
+  }
+
+  resetEnv(&env, observations);
+  double total_reward = 0.0;
+  long long episodes = 0;
+  long long start = nowNs();
+  for (long long s = 0; s < steps; s++) 
+  {
+    for (int i = 0; i < count; i++) 
+    {
+      actions[i] = observations[i * OBSERVATION_SIZE] < DEFAULT_STAND_ON ?
+       ACTION_HIT : ACTION_STAND;
+    }
+    stepEnv(&env, actions, observations, rewards, dones);
+    for (int i = 0; i < count; i++) 
+    {
+      total_reward += rewards[i];
+      episodes += dones[i];
+    }
+  }
+  double seconds = (nowNs() - start) / 1e9;
+
+  printf("STEPS: %lld\n", steps * count);
+  printf("STEPS PER SECOND: %.0f\n", steps * count / seconds);
+  printf("EPISODES: %lld\n", episodes);
+  printf("REWARD PER EPISODE: %+.5f\n",
+   episodes > 0 ? total_reward / episodes : 0.0);
+
+  destroyEnv(&env);
+  free(observations);
+  free(rewards);
+  free(actions);
+  free(dones);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes a strategy as text: a 'hard' row for every total from 4 to 20 and
+/// a 'soft' row for every total from 12 to 20, each with an H (hit) or S
+/// (stand) per dealer upcard from 2 to 10 and ace. This is the format
+/// 'simulate' reads, so learned strategies can be checked with it.
+///
+/// @param path The file to write.
+/// @param strategy The strategy.
+/// @return zero on success, FILE_ERROR if the file cannot be written
+///
+//
+int saveStrategy(char* path, Strategy* strategy)
+{
+  FILE* file = fopen(path, "w");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+  fprintf(file, "# H = hit, S = stand; dealer upcard 2 3 4 5 6 7 8 9 10 A\n");
+  for (int soft = 0; soft < 2; soft++) 
+  {
+    for (int total = soft ? 12 : 4; total <= 20; total++) 
+    {
+      fprintf(file, "%s %d ", soft ? "soft" : "hard", total);
+      for (int upcard = 2; upcard <= 11; upcard++) 
+      {
+        fputc(strategy->hit_[soft][total][upcard] ? 'H' : 'S', file);
+      }
+      fputc('\n', file);
+    }
+  }
+  if (fclose(file) != 0) 
+  {
+    return fileError();
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Reads a strategy written by saveStrategy. Rows that are missing keep
+/// the decisions of standing on DEFAULT_STAND_ON.
+///
+/// @param path The file to read.
+/// @param strategy The strategy.
+/// @return zero on success, FILE_ERROR if the file is not valid
+///
+//
+int loadStrategy(char* path, Strategy* strategy)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+  thresholdStrategy(strategy, DEFAULT_STAND_ON);
+
+  char line[STRATEGY_LINE_LENGTH];
+  int valid = 1;
+  while (valid && fgets(line, sizeof(line), file) != NULL) 
+  {
+    char kind[5];
+    char decisions[11];
+    int total;
+    if (line[0] == '#' || line[0] == '\n') 
+    {
+      continue;
+    }
+    valid = sscanf(line, "%4s %d %10s", kind, &total, decisions) == 3 &&
+     (strcmp(kind, "hard") == 0 || strcmp(kind, "soft") == 0) &&
+     total >= 2 && total <= 21 && strlen(decisions) == 10;
+    int soft = valid && kind[0] == 's';
+    for (int upcard = 2; valid && upcard <= 11; upcard++) 
+    {
+      char decision = decisions[upcard - 2];
+      valid = decision == 'H' || decision == 'S';
+      strategy->hit_[soft][total][upcard] = decision == 'H';
+    }
+  }
+  fclose(file);
+  return valid ? 0 : fileError();
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Reads the strategy argument of a command: a number is the score to
+/// stand on, anything else a strategy file.
+///
+/// @param argument The argument.
+/// @param strategy The strategy.
+/// @param stand_on The score to stand on, 0 for a strategy file.
+/// @return zero on success, otherwise error code
+///
+//
+int parseStrategy(char* argument, Strategy* strategy, int* stand_on)
+{
+  char* rest;
+  *stand_on = strtol(argument, &rest, 10);
+  if (*rest == '\0') 
+  {
+    thresholdStrategy(strategy, *stand_on);
+    return 0;
+  }
+  *stand_on = 0;
+  return loadStrategy(argument, strategy);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Simulates @rounds rounds of @strategy and returns the net result per
+/// round, or -2 (worse than any strategy) if the simulation fails.
+///
+//
+double evaluateStrategy(Card* deck, int seed, long long rounds, int workers,
+ Strategy* strategy)
+{
+  Stats stats;
+  if (runSimulation(deck, seed, rounds, workers, strategy, NULL, &stats) != 0) 
+  {
+    return -2.0;
+  }
+  return (double)(stats.wins_ - stats.losses_) / stats.rounds_;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Learns a strategy with tabular Q-learning on a vectorized environment
+/// of @count games. Every game explores with probability Q_EXPLORATION
+/// and the values of hit and stand are updated after every step; the
+/// learned strategy takes the better of the two.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param count The number of games stepped together.
+/// @param steps The number of batched steps.
+/// @param strategy The learned strategy.
+/// @return zero on success, otherwise error code
+///
+//
+int learnStrategy(Card* deck, int seed, int count, long long steps,
+ Strategy* strategy)
+{
+  static float q[2][22][12][2];
+  VecEnv env;
+  float* observations = malloc(sizeof(float) * OBSERVATION_SIZE * count);
+  int* states = malloc(sizeof(int) * count);
+  float* rewards = malloc(sizeof(float) * count);
+  unsigned char* actions = malloc(count);
+  unsigned char* dones = malloc(count);
+  if (observations == NULL || states == NULL || rewards == NULL ||
+   actions == NULL || dones == NULL ||
+   createEnv(&env, deck, count, seed) != 0) 
+  {
+    free(observations);
+    free(states);
+    free(rewards);
+    free(actions);
+    free(dones);
+    return memoryError();
+  }
+
+  memset(q, 0, sizeof(q));
+  float* values = &q[0][0][0][0];
+  unsigned long long random = mix64((unsigned)seed);
+  resetEnv(&env, observations);
+  for (long long s = 0; s < steps; s++) 
+  {
+    for (int i = 0; i < count; i++) 
+    {
+      float* observation = observations + i * OBSERVATION_SIZE;
+      int state = (((int)observation[1] * 22 + (int)observation[0]) * 12 +
+       (int)observation[2]) * 2;
+      random = mix64(random);
+      states[i] = state;
+      if ((random >> 40) < Q_EXPLORATION * (1 << 24)) 
+      {
+        actions[i] = random & 1;
+      }
+      else 
+      {
+        actions[i] = values[state + ACTION_HIT] > values[state + ACTION_STAND];
+      }
+    }
+    stepEnv(&env, actions, observations, rewards, dones);
+    for (int i = 0; i < count; i++) 
+    {
+      float* observation = observations + i * OBSERVATION_SIZE;
+      float target = rewards[i];
+      if (!dones[i]) 
+      {
+        int next = (((int)observation[1] * 22 + (int)observation[0]) * 12 +
+         (int)observation[2]) * 2;
+        target = fmaxf(values[next + ACTION_STAND], values[next + ACTION_HIT]);
+      }
+      float* value = &values[states[i] + actions[i]];
+      *value += Q_LEARNING_RATE * (target - *value);
+    }
+  }
+
+  for (int soft = 0; soft < 2; soft++) 
+  {
+    for (int total = 0; total < 22; total++) 
+    {
+      for (int upcard = 0; upcard < 12; upcard++) 
+      {
+        float* value = q[soft][total][upcard];
+        strategy->hit_[soft][total][upcard] =
+         value[ACTION_HIT] > value[ACTION_STAND];
+      }
+    }
+  }
+
+  destroyEnv(&env);
+  free(observations);
+  free(states);
+  free(rewards);
+  free(actions);
+  free(dones);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Flips the decision of a few random cells a player can actually reach.
+///
+//
+void mutateStrategy(Strategy* strategy, unsigned long long* random)
+{
+  for (int i = 0; i < MUTATION_CELLS; i++) 
+  {
+    *random = mix64(*random);
+    int soft = *random & 1;
+    int total = soft ? 12 + (*random >> 8) % 9 : 4 + (*random >> 8) % 17;
+    int upcard = 2 + (*random >> 32) % 10;
+    strategy->hit_[soft][total][upcard] ^= 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Searches for a strategy with a simple evolutionary algorithm. Every
+/// generation plays all candidates on the same rounds (common random
+/// numbers), each spread over @workers processes, keeps the best quarter
+/// and refills the population with mutated copies of it.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param generations The number of generations.
+/// @param population The number of candidates per generation.
+/// @param rounds The number of rounds per candidate.
+/// @param workers The number of worker processes.
+/// @param best The best strategy of the last generation.
+/// @return zero on success, otherwise error code
+///
+//
+int evolveStrategy(Card* deck, int seed, int generations, int population,
+ long long rounds, int workers, Strategy* best)
+{
+  Strategy* candidates = malloc(sizeof(Strategy) * population * 2);
+  double* fitness = malloc(sizeof(double) * population);
+  if (candidates == NULL || fitness == NULL) 
+  {
+    free(candidates);
+    free(fitness);
+    return memoryError();
+  }
+
+  unsigned long long random = mix64((unsigned)seed);
+  for (int c = 0; c < population; c++) 
+  {
+    thresholdStrategy(&candidates[c], SWEEP_MIN_STAND + c % 10);
+    if (c >= 10) 
+    {
+      mutateStrategy(&candidates[c], &random);
+    }
+  }
+
+  int elite = population / ELITE_FRACTION > 0 ?
+   population / ELITE_FRACTION : 1;
+  Strategy* sorted = candidates + population;
+  for (int g = 0; g < generations; g++) 
+  {
+    int generation_seed = roundSeed(seed, g);
+    for (int c = 0; c < population; c++) 
+    {
+      fitness[c] = evaluateStrategy(deck, generation_seed, rounds, workers,
+       &candidates[c]);
+    }
+
+    //selection sort of the elite to the front
+    for (int e = 0; e < elite; e++) 
+    {
+      int top = e;
+      for (int c = e + 1; c < population; c++) 
+      {
+        top = fitness[c] > fitness[top] ? c : top;
+      }
+      double tmp_fitness = fitness[e];
+      fitness[e] = fitness[top];
+      fitness[top] = tmp_fitness;
+      sorted[e] = candidates[top];
+      candidates[top] = candidates[e];
+      candidates[e] = sorted[e];
+    }
+    printf("GENERATION %d: BEST NET PER ROUND %+.5f\n", g, fitness[0]);
+
+    if (g + 1 < generations) 
+    {
+      for (int c = elite; c < population; c++) 
+      {
+        candidates[c] = candidates[c % elite];
+        mutateStrategy(&candidates[c], &random);
+      }
+    }
+  }
+
+  *best = candidates[0];
+  free(candidates);
+  free(fitness);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Range task of runTournament. Every round is shuffled once and played by
+/// every strategy on the same cards.
+///
+/// @return zero
+///
+//
+int tournamentTask(void* context, int worker, long long begin, long long end,
+ void* slot)
+{
+  TournamentTask* task = context;
+  TournamentSlot* results = slot;
+  Card cards[MAX_SHOE_SIZE];
+  Round round;
+  int net[MAX_STRATEGIES];
+  (void)worker;
+
+  for (long long r = begin; r < end; r++) 
+  {
+    roundShoe(cards, task->deck_, task->seed_, r);
+    for (int s = 0; s < task->count_; s++) 
+    {
+      playRound(cards, &task->strategies_[s], &round, NULL);
+      addOutcome(&results->stats_[s], round.outcome_);
+      net[s] = round.outcome_ == OUTCOME_PUSH ? 0 :
+       round.outcome_ == OUTCOME_LOSE ? -1 : 1;
+    }
+    for (int s = 0; s < task->count_; s++) 
+    {
+      for (int t = s + 1; t < task->count_; t++) 
+      {
+        results->products_[s][t] += net[s] * net[t];
+      }
+    }
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Plays @count strategies against the same shoes, spread over @workers
+/// processes, and prints a leaderboard. Every strategy gets the net
+/// result per round with a 95% confidence interval, and the difference to
+/// the leader with a paired interval, which is much tighter because all
+/// strategies saw the same cards.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param rounds The number of rounds.
+/// @param workers The number of worker processes.
+/// @param strategies The strategies.
+/// @param names The names to show for the strategies.
+/// @param count The number of strategies.
+/// @return zero on success, otherwise error code
+///
+//
+int runTournament(Card* deck, int seed, long long rounds, int workers,
+ Strategy* strategies, char** names, int count)
+{
+  size_t region_size = sizeof(TournamentSlot) * workers;
+  TournamentSlot* slots = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (slots == MAP_FAILED) 
+  {
+    return memoryError();
+  }
+
+  TournamentTask task = { deck, seed, count, strategies };
+  int result = runRanges(rounds, workers, tournamentTask, &task,
+   (char*)slots, sizeof(TournamentSlot));
+  if (result != 0) 
+  {
+    munmap(slots, region_size);
+    return result;
+  }
+
+  TournamentSlot total;
+  memset(&total, 0, sizeof(total));
+  for (int w = 0; w < workers; w++) 
+  {
+    for (int s = 0; s < count; s++) 
+    {
+      mergeStats(&total.stats_[s], &slots[w].stats_[s]);
+      for (int t = s + 1; t < count; t++) 
+      {
+        total.products_[s][t] += slots[w].products_[s][t];
+        total.products_[t][s] += slots[w].products_[s][t];
+      }
+    }
+  }
+  munmap(slots, region_size);
+
+  double n = rounds;
+  double mean[MAX_STRATEGIES];
+  double square[MAX_STRATEGIES];
+  int order[MAX_STRATEGIES];
+  for (int s = 0; s < count; s++) 
+  {
+    Stats* stats = &total.stats_[s];
+    mean[s] = (stats->wins_ - stats->losses_) / n;
+    square[s] = (stats->wins_ + stats->losses_) / n;
+    order[s] = s;
+  }
+  for (int i = 1; i < count; i++) 
+  {
+    for (int j = i; j > 0 && mean[order[j]] > mean[order[j - 1]]; j--) 
+    {
+      int tmp = order[j];
+      order[j] = order[j - 1];
+      order[j - 1] = tmp;
+    }
+  }
+
+  int leader = order[0];
+  printf("RANK  STRATEGY              NET      +/-    VS LEADER      +/-\n");
+  for (int i = 0; i < count; i++) 
+  {
+    int s = order[i];
+    double variance = square[s] - mean[s] * mean[s];
+    double difference = mean[s] - mean[leader];
+    double paired = square[s] + square[leader] -
+     2.0 * total.products_[s][leader] / n - difference * difference;
+    if (s == leader) 
+    {
+      paired = 0.0;
+    }
+    printf("%4d  %-16.16s %+9.5f %8.5f %+12.5f %8.5f\n", i + 1, names[s],
+     mean[s], CONFIDENCE_Z * sqrt(variance > 0.0 ? variance / n : 0.0),
+     difference, CONFIDENCE_Z * sqrt(paired > 0.0 ? paired / n : 0.0));
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns a uniform random number in range [0, 1) from a splitmix64 stream.
+///
+//
+double uniformRandom(unsigned long long* random)
+{
+  *random += 0x9e3779b97f4a7c15ULL;
+  return (mix64(*random) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Draws one rank from a shoe composition, without removing it.
+///
+/// @param counts The number of cards of every rank.
+/// @param total The number of cards in the shoe.
+/// @param random The random stream.
+/// @return int The rank.
+///
+//
+int drawRank(int* counts, int total, unsigned long long* random)
+{
+  int target = (int)(uniformRandom(random) * total);
+  int rank = 0;
+  while (rank < definition.ranks_ - 1 && target >= counts[rank]) 
+  {
+    target -= counts[rank];
+    rank++;
+  }
+  return rank;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Checks whether a player's first two cards and the dealer's upcard show
+/// the situation of a drill. Scores follow giveCards.
+///
+//
+int matchesDrill(DrillSpec* spec, int first, int second, int upcard,
+ int first_rank, int second_rank)
+{
+  int score = first + (second == 11 && first > 10 ? 1 : second);
+  int soft = first == 11 || (second == 11 && first <= 10);
+  if (spec->upcard_ != 0 && upcard != spec->upcard_) 
+  {
+    return 0;
+  }
+  switch (spec->kind_) 
+  {
+    case DRILL_HARD:
+      return !soft && score == spec->total_;
+    case DRILL_SOFT:
+      return soft && score == spec->total_;
+    case DRILL_PAIR:
+      return first_rank == second_rank &&
+       (spec->total_ == 0 || first == spec->total_);
+    default:
+      return 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Lists every rank triple matching a drill with the exact probability of
+/// dealing it (without replacement) from the shoe @counts.
+///
+/// @param table The table to fill.
+/// @param spec The drill.
+/// @param counts The number of cards of every rank.
+/// @param points The points of every rank.
+/// @return double The probability that a deal matches the drill.
+///
+//
+double buildDrillTable(DrillTable* table, DrillSpec* spec, int* counts,
+ int* points)
+{
+  int total = 0;
+  for (int r = 0; r < definition.ranks_; r++) 
+  {
+    total += counts[r];
+  }
+  double cumulative = 0.0;
+  table->count_ = 0;
+  for (int a = 0; a < definition.ranks_; a++) 
+  {
+    for (int b = 0; b < definition.ranks_; b++) 
+    {
+      int second_left = counts[b] - (b == a);
+      for (int u = 0; u < definition.ranks_ && counts[a] > 0 &&
+       second_left > 0; u++) 
+      {
+        int upcard_left = counts[u] - (u == a) - (u == b);
+        if (upcard_left <= 0 ||
+         !matchesDrill(spec, points[a], points[b], points[u], a, b)) 
+        {
+          continue;
+        }
+        cumulative += (double)counts[a] * second_left * upcard_left;
+        table->cumulative_[table->count_] = cumulative;
+        table->triple_[table->count_] = (a * MAX_RANKS + b) * MAX_RANKS + u;
+        table->count_++;
+      }
+    }
+  }
+  return cumulative / ((double)total * (total - 1) * (total - 2));
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Picks a triple from a drill table in proportion to its probability.
+///
+/// @return int The triple, as (first * MAX_RANKS + second) * MAX_RANKS + up.
+///
+//
+int sampleDrill(DrillTable* table, unsigned long long* random)
+{
+  double target = uniformRandom(random) *
+   table->cumulative_[table->count_ - 1];
+  int low = 0;
+  int high = table->count_ - 1;
+  while (low < high) 
+  {
+    int middle = (low + high) / 2;
+    if (table->cumulative_[middle] > target) 
+    {
+      high = middle;
+    }
+    else 
+    {
+      low = middle + 1;
+    }
+  }
+  return table->triple_[low];
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns log(n choose k).
+///
+//
+double logChoose(int n, int k)
+{
+  return lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Builds the distribution of the Hi-Lo groups among the @seen cards
+/// already dealt from a shoe, conditioned on a true count of at least
+/// @min_true_count. Entry (low * (seen + 1) + high) gets the cumulative
+/// multivariate hypergeometric probability of that many low (2-6) and
+/// high (tens and aces) cards.
+///
+/// @param groups The number of low, neutral and high cards in the shoe.
+/// @param seen The number of cards already dealt.
+/// @param min_true_count The smallest true count wanted.
+/// @param cumulative (seen + 1)^2 cumulative weights.
+/// @return int 1 if any shoe reaches the true count, otherwise 0
+///
+//
+int buildCountTable(int* groups, int seen, double min_true_count,
+ double* cumulative)
+{
+  int total = groups[0] + groups[1] + groups[2];
+  double decks_left = (double)(total - seen) / DECK_SIZE;
+  double sum = 0.0;
+  for (int low = 0; low <= seen; low++) 
+  {
+    for (int high = 0; high <= seen; high++) 
+    {
+      int neutral = seen - low - high;
+      if (low <= groups[0] && high <= groups[2] && neutral >= 0 &&
+       neutral <= groups[1] && (low - high) / decks_left >= min_true_count) 
+      {
+        sum += exp(logChoose(groups[0], low) + logChoose(groups[1], neutral) +
+         logChoose(groups[2], high) - logChoose(total, seen));
+      }
+      cumulative[low * (seen + 1) + high] = sum;
+    }
+  }
+  return sum > 0.0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Deals @seen cards out of a full shoe so that the true count is at least
+/// the one a count table was built for. The number of low and high cards
+/// comes from the table; which ranks they are is drawn card by card from
+/// each group, so the result is exactly a random shoe at that count.
+///
+/// @param counts The full shoe; receives the cards that are left.
+/// @param points The points of every rank.
+/// @param seen The number of cards already dealt.
+/// @param cumulative The count table.
+/// @param random The random stream.
+/// @return int The running count of the dealt cards.
+///
+//
+int dealCountedShoe(int* counts, int* points, int seen, double* cumulative,
+ unsigned long long* random)
+{
+  int cells = (seen + 1) * (seen + 1);
+  double target = uniformRandom(random) * cumulative[cells - 1];
+  int cell = 0;
+  int last = cells - 1;
+  while (cell < last) 
+  {
+    int middle = (cell + last) / 2;
+    if (cumulative[middle] > target) 
+    {
+      last = middle;
+    }
+    else 
+    {
+      cell = middle + 1;
+    }
+  }
+  int wanted[3] = { cell / (seen + 1), 0, cell % (seen + 1) };
+  wanted[1] = seen - wanted[0] - wanted[2];
+
+  for (int group = 0; group < 3; group++) 
+  {
+    int in_group[MAX_RANKS];
+    int group_total = 0;
+    for (int r = 0; r < definition.ranks_; r++) 
+    {
+      int g = points[r] <= 6 ? 0 : points[r] >= 10 ? 2 : 1;
+      in_group[r] = g == group ? counts[r] : 0;
+      group_total += in_group[r];
+    }
+    for (int i = 0; i < wanted[group]; i++) 
+    {
+      int rank = drawRank(in_group, group_total, random);
+      in_group[rank]--;
+      counts[rank]--;
+      group_total--;
+    }
+  }
+  return wanted[0] - wanted[2];
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Generates @count practice deals that show a drill's situation, sampled
+/// straight from the conditional distribution instead of shuffling and
+/// throwing away deals that do not match. With a minimum true count, the
+/// shoe is first dealt halfway to a random state at that count (see
+/// dealCountedShoe) and DRILLS_PER_SHOE drills are dealt from each such
+/// shoe. Prints the first DRILL_PRINT_LIMIT drills and the rate.
+///
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param spec The drill.
+/// @param count The number of drills.
+/// @param decks The number of definition shoes combined into one.
+/// @param min_true_count The smallest true count, or a very low value.
+/// @return zero on success, otherwise error code
+///
+//
+int runDrills(Card* deck, int seed, DrillSpec* spec, long long count,
+ int decks, double min_true_count)
+{
+  int full[MAX_RANKS] = { 0 };
+  int points[MAX_RANKS] = { 0 };
+  int groups[3] = { 0 };
+  int total = definition.shoe_size_ * decks;
+  for (int i = 0; i < definition.shoe_size_; i++) 
+  {
+    full[deck[i].rank_] += decks;
+    points[deck[i].rank_] = deck[i].points_;
+    groups[deck[i].points_ <= 6 ? 0 : deck[i].points_ >= 10 ? 2 : 1] += decks;
+  }
+
+  int counted = min_true_count > -DECK_SIZE;
+  int seen = counted ? total / 2 : 0;
+  DrillTable* table = malloc(sizeof(DrillTable));
+  double* cumulative = malloc(sizeof(double) * (seen + 1) * (seen + 1));
+  if (table == NULL || cumulative == NULL) 
+  {
+    free(table);
+    free(cumulative);
+    return memoryError();
+  }
+  if (counted && !buildCountTable(groups, seen, min_true_count, cumulative)) 
+  {
+    free(table);
+    free(cumulative);
+    printf("[ERR] No shoe reaches that true count.\n");
+    return ARGUMENTS_ERROR;
+  }
+
+  unsigned long long random = mix64((unsigned)seed);
+  int counts[MAX_RANKS];
+  int running_count = 0;
+  double probability = 0.0;
+  long long start = nowNs();
+  for (long long d = 0; d < count; d++) 
+  {
+    if (d == 0 || (counted && d % DRILLS_PER_SHOE == 0)) 
+    {
+      memcpy(counts, full, sizeof(counts));
+      if (counted) 
+      {
+        running_count = dealCountedShoe(counts, points, seen, cumulative,
+         &random);
+      }
+      probability = buildDrillTable(table, spec, counts, points);
+      if (table->count_ == 0) 
+      {
+        free(table);
+        free(cumulative);
+        printf("[ERR] No deal matches the drill.\n");
+        return ARGUMENTS_ERROR;
+      }
+    }
+
+    int triple = sampleDrill(table, &random);
+    int first = triple / (MAX_RANKS * MAX_RANKS);
+    int second = triple / MAX_RANKS % MAX_RANKS;
+    int upcard = triple % MAX_RANKS;
+    counts[first]--;
+    counts[second]--;
+    counts[upcard]--;
+    int left = total - seen - 3;
+    int hole = drawRank(counts, left, &random);
+    counts[first]++;
+    counts[second]++;
+    counts[upcard]++;
+
+    if (d < DRILL_PRINT_LIMIT) 
+    {
+      printf("YOU: %s %s  DEALER: %s [%s]  TRUE COUNT: %+.2f\n",
+       definition.names_[first], definition.names_[second],
+       definition.names_[upcard], definition.names_[hole],
+       running_count * (double)DECK_SIZE / (total - seen));
+    }
+  }
+  double seconds = (nowNs() - start) / 1e9;
+
+  printf("DRILLS: %lld\n", count);
+  printf("DRILLS PER SECOND: %.0f\n", count / seconds);
+  if (!counted) 
+  {
+    printf("SITUATION PROBABILITY: %.6f\n", probability);
+  }
+  free(table);
+  free(cumulative);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Reads a drill situation: 'hard<total>', 'soft<total>', 'pair',
+/// 'pair<points>' or 'any' for the player, and the points of the upcard
+/// or 'any' for the dealer.
+///
+/// @return 1 on success, 0 if the situation is not valid
+///
+//
+int parseDrill(char* hand, char* upcard, DrillSpec* spec)
+{
+  spec->total_ = 0;
+  spec->upcard_ = strcmp(upcard, "any") == 0 ? 0 : strtol(upcard, NULL, 10);
+  if (strncmp(hand, "hard", 4) == 0 || strncmp(hand, "soft", 4) == 0) 
+  {
+    spec->kind_ = hand[0] == 'h' ? DRILL_HARD : DRILL_SOFT;
+    spec->total_ = strtol(hand + 4, NULL, 10);
+  }
+  else if (strncmp(hand, "pair", 4) == 0) 
+  {
+    spec->kind_ = DRILL_PAIR;
+    spec->total_ = strtol(hand + 4, NULL, 10);
+  }
+  else 
+  {
+    spec->kind_ = DRILL_ANY;
+  }
+  return (spec->kind_ == DRILL_ANY) == (strcmp(hand, "any") == 0) &&
+   (spec->upcard_ == 0 ? strcmp(upcard, "any") == 0 :
+   spec->upcard_ >= 2 && spec->upcard_ <= 11);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Starts counting per stage. The totals live in shared memory, so forked
+/// workers (which open counters of their own, see forkCounters) add to
+/// the same table.
+///
+/// @return zero on success, otherwise MEMORY_ERROR
+///
+//
+int enableCounters(void)
+{
+  perf.totals_ = mmap(NULL, sizeof(StageTotals) * STAGES,
+   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (perf.totals_ == MAP_FAILED) 
+  {
+    return memoryError();
+  }
+  openCounters();
+  perf.stack_[0] = STAGE_OTHER;
+  perf.depth_ = 1;
+  readCounters(perf.last_);
+  perf_enabled = 1;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Prints the counters of every stage: CPU time, IPC, and cache and branch
+/// misses per thousand instructions. Counters the machine could not
+/// provide are shown as n/a.
+///
+//
+void printCounters(void)
+{
+  char* names[STAGES] = { "other", "shuffle", "render", "simulate" };
+  chargeStage();
+  if (perf.fds_[0] < 0) 
+  {
+    printf("[WARN] perf events unavailable; CPU time only.\n");
+  }
+  else if (perf.fds_[1] < 0 || perf.fds_[2] < 0) 
+  {
+    printf("[WARN] Hardware counters unavailable; CPU time only.\n");
+  }
+  printf("%-10s %12s %12s %8s %12s %12s\n", "STAGE", "CALLS", "CPU MS",
+   "IPC", "CACHE MPKI", "BRANCH MPKI");
+  for (int s = 0; s < STAGES; s++) 
+  {
+    long long counts[PERF_COUNTERS];
+    for (int c = 0; c < PERF_COUNTERS; c++) 
+    {
+      counts[c] = atomic_load(&perf.totals_[s].counts_[c]);
+    }
+    char rates[3][16];
+    double per_kilo = counts[2] > 0 ? 1000.0 / counts[2] : 0.0;
+    double values[3] = { counts[1] > 0 ? (double)counts[2] / counts[1] : 0.0,
+     counts[3] * per_kilo, counts[4] * per_kilo };
+    int available[3] = { perf.fds_[1] >= 0 && perf.fds_[2] >= 0,
+     perf.fds_[2] >= 0 && perf.fds_[3] >= 0,
+     perf.fds_[2] >= 0 && perf.fds_[4] >= 0 };
+    for (int r = 0; r < 3; r++) 
+    {
+      if (available[r]) 
+      {
+        snprintf(rates[r], sizeof(rates[r]), "%.2f", values[r]);
+      }
+      else 
+      {
+        strcpy(rates[r], "n/a");
+      }
+    }
+    printf("%-10s %12lld %12.1f %8s %12s %12s\n", names[s],
+     s == STAGE_OTHER ? 1 : atomic_load(&perf.totals_[s].calls_),
+     counts[0] / 1e6, rates[0], rates[1], rates[2]);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Appends a '/' to the folder @input unless it already ends with one.
+///
+/// @param input The folder as given.
+/// @param path The folder path, PATH_LENGTH long.
+///
+//
+void folderPath(char* input, char* path)
+{
+  size_t length = strlen(input);
+  snprintf(path, PATH_LENGTH, "%s%s", input,
+   length > 0 && input[length - 1] != '/' ? "/" : "");
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Names the shared memory segment that publishes the atlas of the cards in
+/// the folder @input_path (see loadSharedAssets).
+///
+/// @param input_path The folder, ending with '/'.
+/// @param name The segment name, FILE_NAME_LENGTH long.
+///
+//
+void sharedAssetsName(char* input_path, char* name)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL; //FNV-1a
+  for (char* c = input_path; *c != '\0'; c++) 
+  {
+    hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+  }
+  snprintf(name, FILE_NAME_LENGTH, SHARED_ASSETS_NAME, hash);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the size of the atlas of @assets and the current definition.
+///
+//
+size_t atlasSize(CardAssets* assets)
+{
+  return sizeof(AtlasHeader) +
+   (size_t)definition.ranks_ * assets->width_ * assets->height_;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the atlas of @assets, except for its magic, which the caller
+/// writes last so that readers never see a partial atlas.
+///
+/// @param assets The card images.
+/// @param atlas Where to write, atlasSize bytes.
+///
+//
+void packAtlas(CardAssets* assets, char* atlas)
+{
+  AtlasHeader header;
+  memset(&header, 0, sizeof(header));
+  header.width_ = assets->width_;
+  header.height_ = assets->height_;
+  header.definition_ = definition;
+  memcpy(atlas, &header, sizeof(header));
+
+  size_t image_size = (size_t)assets->width_ * assets->height_;
+  for (int r = 0; r < definition.ranks_; r++) 
+  {
+    memcpy(atlas + sizeof(header) + r * image_size, assets->images_[r],
+     image_size);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Writes the definition and card images the deck was built from to an
+/// atlas file, which loads with a single mapping (see loadAtlas).
+///
+/// @param path The atlas file, ending with ATLAS_EXTENSION.
+/// @return zero on success, otherwise an error code
+///
+//
+int saveAtlas(char* path)
+{
+  size_t size = atlasSize(&card_assets);
+  char* atlas = malloc(size);
+  if (atlas == NULL) 
+  {
+    return memoryError();
+  }
+  packAtlas(&card_assets, atlas);
+  memcpy(atlas, ATLAS_MAGIC, 4);
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) 
+  {
+    free(atlas);
+    return fileError();
+  }
+  int written = fwrite(atlas, size, 1, file) == 1;
+  free(atlas);
+  if (fclose(file) != 0 || !written) 
+  {
+    return fileError();
+  }
+  printf("ATLAS: %d RANKS, %dx%d, %zu BYTES\n", definition.ranks_,
+   card_assets.width_ - 1, card_assets.height_, size);
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Deals a game and renders its first frame the way startGame does, then
+/// writes the startup marks of this process to stderr as one "MARKS" line
+/// of nanoseconds since @spawn_ns (see benchmarkStartup).
+///
+/// @param deck The unshuffled deck.
+/// @param seed The shuffle seed.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @param spawn_ns The monotonic clock when the process was spawned.
+/// @return zero
+///
+//
+int firstFrame(Card* deck, int seed, int width, int height,
+ long long spawn_ns)
+{
+  Game game;
+  dealGame(&game, deck, seed);
+  startup_marks[MARK_SHUFFLE] = nowNs();
+  showCards(game.dealer_, 1, game.dealer_[0].points_, width, height, 0);
+  showCards(game.player_, game.player_count_, game.player_score_,
+   width, height, 1);
+  fflush(stdout);
+  startup_marks[MARK_FRAME] = nowNs();
+
+  fprintf(stderr, "MARKS");
+  for (int m = 0; m < MARKS; m++) 
+  {
+    fprintf(stderr, " %lld", startup_marks[m] - spawn_ns);
+  }
+  fprintf(stderr, "\n");
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Drops the cached pages of @path from the page cache. Pages that are
+/// mapped somewhere, like those of a running executable, stay cached.
+///
+//
+void evictFile(char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) 
+  {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Drops the executable, the files of the folder @input_path and
+/// @atlas_path from the page cache and removes the shared memory atlas of
+/// the folder, so the next start loads its assets cold.
+///
+//
+void evictAssets(char* input_path, char* atlas_path)
+{
+  evictFile("/proc/self/exe");
+  evictFile(atlas_path);
+
+  DIR* folder = opendir(input_path);
+  if (folder != NULL) 
+  {
+    struct dirent* entry;
+    while ((entry = readdir(folder)) != NULL) 
+    {
+      char path[PATH_LENGTH + sizeof(entry->d_name)];
+      snprintf(path, sizeof(path), "%s%s", input_path, entry->d_name);
+      evictFile(path);
+    }
+    closedir(folder);
+  }
+
+  char name[FILE_NAME_LENGTH];
+  sharedAssetsName(input_path, name);
+  shm_unlink(name);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Runs this executable with @arguments, its stdout discarded, and reads
+/// the startup marks it reports on stderr (see firstFrame).
+///
+/// @param arguments The argument vector, NULL terminated.
+/// @param marks The marks, or NULL when the run reports none.
+/// @return zero if the run succeeds, otherwise an error code
+///
+//
+int runStartup(char** arguments, long long* marks)
+{
+  int channel[2];
+  if (pipe(channel) != 0) 
+  {
+    return SIMULATION_ERROR;
+  }
+  pid_t pid = fork();
+  if (pid == 0) 
+  {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(channel[1], STDERR_FILENO);
+    close(channel[0]);
+    execv("/proc/self/exe", arguments);
+    _exit(127);
+  }
+  close(channel[1]);
+  if (pid < 0) 
+  {
+    close(channel[0]);
+    return SIMULATION_ERROR;
+  }
+
+  char report[SERVER_LINE_LENGTH];
+  size_t length = 0;
+  ssize_t got;
+  while ((got = read(channel[0], report + length,
+   sizeof(report) - 1 - length)) > 0) 
+  {
+    length += got;
+  }
+  report[length] = '\0';
+  close(channel[0]);
+
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+   WEXITSTATUS(status) != 0) 
+  {
+    return SIMULATION_ERROR;
+  }
+  if (marks == NULL) 
+  {
+    return 0;
+  }
+  char* mark = strstr(report, "MARKS");
+  if (mark == NULL) 
+  {
+    return SIMULATION_ERROR;
+  }
+  mark += strlen("MARKS");
+  for (int m = 0; m < MARKS; m++) 
+  {
+    marks[m] = strtoll(mark, &mark, 10);
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Measures the time from spawning a table process to its first rendered
+/// frame for every asset strategy: the text files of @input, an atlas file,
+/// the embedded images and a shared memory atlas. Each is started @runs
+/// times cold, with its files evicted from the page cache and the shared
+/// atlas removed, and @runs times warm, after one unmeasured start. Prints
+/// the median of every phase: spawn to main (fork, exec and dynamic
+/// linking), arguments, asset load, deck build, shuffle and first frame.
+///
+/// @param input The folder with the card files.
+/// @param atlas_path The atlas file to write and load.
+/// @param runs The starts per strategy and cache state.
+/// @return zero if every start succeeds, otherwise an error code
+///
+//
+int benchmarkStartup(char* input, char* atlas_path, int runs)
+{
+  char input_path[PATH_LENGTH];
+  folderPath(input, input_path);
+  char shared[PATH_LENGTH + sizeof(SHARED_ASSETS)];
+  snprintf(shared, sizeof(shared), "%s%s", SHARED_ASSETS, input_path);
+
+  char* atlas_arguments[] = {
+    "blackjack", input_path, STARTUP_SEED, "atlas", atlas_path, NULL
+  };
+  if (runStartup(atlas_arguments, NULL) != 0) 
+  {
+    printf("[ERR] Could not write the atlas %s.\n", atlas_path);
+    return FILE_ERROR;
+  }
+
+  char* inputs[STARTUP_STRATEGIES] = {
+    input_path, atlas_path, EMBEDDED_ASSETS, shared
+  };
+  char* names[STARTUP_STRATEGIES] = { "text", "atlas", "embedded", "shm" };
+  static long long phases[MARKS + 1][MAX_STARTUP_RUNS];
+
+  printf("%-10s %-5s %10s %10s %10s %10s %10s %10s %10s\n", "ASSETS",
+   "CACHE", "EXEC_US", "ARGS_US", "LOAD_US", "DECK_US", "SHUFFLE_US",
+   "FRAME_US", "TOTAL_US");
+  for (int s = 0; s < STARTUP_STRATEGIES; s++) 
+  {
+    for (int warm = 0; warm <= 1; warm++) 
+    {
+      for (int run = -warm; run < runs; run++) 
+      {
+        if (!warm) 
+        {
+          evictAssets(input_path, atlas_path);
+        }
+        char spawn[32];
+        long long marks[MARKS];
+        long long spawn_ns = nowNs();
+        snprintf(spawn, sizeof(spawn), "%lld", spawn_ns);
+        char* arguments[] = {
+          "blackjack", inputs[s], STARTUP_SEED, "firstframe", spawn, NULL
+        };
+        if (runStartup(arguments, marks) != 0) 
+        {
+          printf("[ERR] Startup with %s failed.\n", inputs[s]);
+          return SIMULATION_ERROR;
+        }
+        if (run < 0) 
+        {
+          continue;
+        }
+        phases[0][run] = marks[MARK_MAIN];
+        for (int m = MARK_ARGS; m < MARKS; m++) 
+        {
+          phases[m][run] = marks[m] - marks[m - 1];
+        }
+        phases[MARKS][run] = marks[MARK_FRAME];
+      }
+
+      printf("%-10s %-5s", names[s], warm ? "warm" : "cold");
+      for (int p = 0; p <= MARKS; p++) 
+      {
+        qsort(phases[p], runs, sizeof(long long), compareLongLong);
+        printf(" %10.1f", phases[p][runs / 2] / 1e3);
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Adds a sample to a reservoir; once it is full, every sample seen so far
+/// stays in it with the same probability.
+///
+//
+void addSample(Reservoir* reservoir, long long sample)
+{
+  long long seen = reservoir->count_++;
+  if (seen < reservoir->capacity_) 
+  {
+    reservoir->samples_[seen] = sample;
+    return;
+  }
+  unsigned long long slot = mix64(reservoir->state_++) % (seen + 1);
+  if (slot < (unsigned long long)reservoir->capacity_) 
+  {
+    reservoir->samples_[slot] = sample;
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sorts the samples of a reservoir, so that samplePercentile can read
+/// them.
+///
+//
+void sortSamples(Reservoir* reservoir)
+{
+  long long kept = reservoir->count_ < reservoir->capacity_ ?
+   reservoir->count_ : reservoir->capacity_;
+  qsort(reservoir->samples_, kept, sizeof(long long), compareLongLong);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the @per_mille per mille percentile of the sorted samples of a
+/// reservoir, or 0 if it has none.
+///
+//
+long long samplePercentile(Reservoir* reservoir, int per_mille)
+{
+  long long kept = reservoir->count_ < reservoir->capacity_ ?
+   reservoir->count_ : reservoir->capacity_;
+  return kept > 0 ? reservoir->samples_[kept * per_mille / 1000] : 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the points of the rank called @name, or 0 if there is none.
+///
+//
+int rankPoints(char* name)
+{
+  for (int r = 0; r < definition.ranks_; r++) 
+  {
+    if (strcmp(definition.names_[r], name) == 0) 
+    {
+      return definition.points_[r];
+    }
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Follows one line of the server protocol in a load client's hand (see
+/// sessionDeal and sessionAction). A 'DEALER' line after the player's
+/// action hands the turn back to the player unless the dealer reached 21
+/// or the action was a stand that settles the hand (see applyAction).
+///
+/// @param client The client.
+/// @param line The line, without its '\n'.
+/// @return LOAD_DECISION if the player is on turn, LOAD_HAND for a result,
+///         LOAD_TIMEOUT for a decision the server took, 0 for any other
+///         line, or -1 for a line that is not in the protocol
+///
+//
+int loadLine(LoadClient* client, char* line)
+{
+  char first[RANK_NAME_LENGTH];
+  char second[RANK_NAME_LENGTH];
+  char upcard[RANK_NAME_LENGTH];
+  int score;
+  //before DEAL, which sscanf would also match
+  if (strncmp(line, "DEALER ", 7) == 0) 
+  {
+    int settled = client->again_ && client->acted_ == 's' &&
+     client->dealer_ >= client->score_;
+    client->dealer_ = strtol(strrchr(line, ' ') + 1, NULL, 10);
+    if (client->acted_ == 0 || settled || client->dealer_ >= 21) 
+    {
+      return 0;
+    }
+    client->again_ = 1;
+    return LOAD_DECISION;
+  }
+  if (sscanf(line, "DEAL %7s %7s %d %7s", first, second, &score,
+   upcard) == 4) 
+  {
+    int first_points = rankPoints(first);
+    int second_points = rankPoints(second);
+    client->upcard_ = rankPoints(upcard);
+    if (first_points == 0 || second_points == 0 || client->upcard_ == 0 ||
+     score < 2 || score > 21) 
+    {
+      return -1;
+    }
+    client->soft_ = first_points == 11 ||
+     (second_points == 11 && first_points <= 10);
+    client->score_ = score;
+    client->dealer_ = 0;
+    client->again_ = 0;
+    client->acted_ = 0;
+    return score == 21 ? 0 : LOAD_DECISION;
+  }
+  if (sscanf(line, "CARD %7s %d", first, &score) == 2) 
+  {
+    int points = rankPoints(first);
+    if (points == 0 || score < 2) 
+    {
+      return -1;
+    }
+    client->soft_ |= points == 11 && client->score_ <= 10;
+    client->score_ = score;
+    return score < 21 ? LOAD_DECISION : 0;
+  }
+  if (strncmp(line, "RESULT ", 7) == 0) 
+  {
+    return LOAD_HAND;
+  }
+  if (strcmp(line, "TIMEOUT") == 0) 
+  {
+    client->acted_ = 's';
+    return LOAD_TIMEOUT;
+  }
+  char* known[] = { "SESSION ", "COMMIT ", "REVEAL ", "RESUMED " };
+  for (int k = 0; k < (int)(sizeof(known) / sizeof(char*)); k++) 
+  {
+    if (strncmp(line, known[k], strlen(known[k])) == 0) 
+    {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Sends a load client's decision, taken with @strategy.
+///
+/// @return 1 if it was sent, otherwise 0
+///
+//
+int loadAct(LoadClient* client, Strategy* strategy)
+{
+  client->acted_ =
+   strategy->hit_[client->soft_][client->score_][client->upcard_] ? 'h' : 's';
+  client->sent_ = nowNs();
+  return send(client->socket_, &client->acted_, 1,
+   MSG_NOSIGNAL | MSG_DONTWAIT) == 1;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Generates load on a game server (see runServer): @sessions clients,
+/// connected evenly over the first @ramp seconds, play hands for @seconds
+/// seconds. At every decision a client thinks for a random time of up to
+/// twice @think_ms (in timer wheel ticks; none for 0) and then decides
+/// with @strategy. An action's latency lasts from sending it until the
+/// player is on turn again, which after a stand or a bust includes the
+/// dealer's play and the next deal. Every second the sessions, the rates
+/// and the latency of that second are printed, and at the end the totals,
+/// throughput, p50/p99/p999 latency and the errors: failed connects,
+/// dropped sessions and lines outside the protocol. SIGINT ends the run
+/// early.
+///
+/// @param socket_path Where the server listens.
+/// @param sessions The number of clients.
+/// @param seconds How long to run.
+/// @param think_ms The mean think time.
+/// @param strategy The players' decisions.
+/// @param ramp The seconds over which the clients connect.
+/// @return zero if any client played, otherwise error code
+///
+//
+int runLoad(char* socket_path, int sessions, double seconds, int think_ms,
+ Strategy* strategy, double ramp)
+{
+  raiseFileLimit();
+  LoadClient* clients = calloc(sessions, sizeof(LoadClient));
+  struct pollfd* fds = malloc(sizeof(struct pollfd) * sessions);
+  TimerWheel* wheel = malloc(sizeof(TimerWheel));
+  Reservoir total = { malloc(sizeof(long long) * LOAD_SAMPLES), LOAD_SAMPLES,
+   0, 0 };
+  Reservoir second = { malloc(sizeof(long long) * LOAD_INTERVAL_SAMPLES),
+   LOAD_INTERVAL_SAMPLES, 0, 0 };
+  if (clients == NULL || fds == NULL || wheel == NULL ||
+   total.samples_ == NULL || second.samples_ == NULL) 
+  {
+    free(clients);
+    free(fds);
+    free(wheel);
+    free(total.samples_);
+    free(second.samples_);
+    return memoryError();
+  }
+  initWheel(wheel, nowTick());
+  int think_ticks = (think_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  unsigned long long think_state = 0;
+
+  long long start = nowNs();
+  long long end = start + (long long)(seconds * 1e9);
+  long long next_report = start + 1000000000LL;
+  int opened = 0;
+  int live = 0;
+  long long actions = 0;
+  long long hands = 0;
+  long long errors = 0;
+  long long timeouts = 0;
+  long long second_actions = 0;
+  long long second_hands = 0;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  server_stopped = 0;
+  printf("%8s %8s %10s %10s %10s %10s %8s\n", "SECONDS", "SESSIONS",
+   "ACTIONS/S", "HANDS/S", "P50_US", "P99_US", "ERRORS");
+  fflush(stdout);
+
+  long long now = start;
+  while (now < end && !server_stopped) 
+  {
+    int due = ramp > 0 && now - start < ramp * 1e9 ?
+     (int)(sessions * ((now - start) / (ramp * 1e9))) + 1 : sessions;
+    while (opened < due && opened < sessions) 
+    {
+      LoadClient* client = &clients[opened++];
+      client->socket_ = openUnixSocket(socket_path, 0);
+      if (client->socket_ < 0) 
+      {
+        errors++;
+        continue;
+      }
+      fcntl(client->socket_, F_SETFL, O_NONBLOCK);
+      live++;
+    }
+
+    for (int i = 0; i < opened; i++) 
+    {
+      fds[i].fd = clients[i].socket_;
+      fds[i].events = POLLIN;
+    }
+    int timeout = opened < sessions || wheel->count_ > 0 ? TIMER_TICK_MS :
+     (int)((next_report - now) / 1000000) + 1;
+    if (poll(fds, opened, timeout) < 0 && errno != EINTR) 
+    {
+      break;
+    }
+    now = nowNs();
+
+    Timer* timer;
+    while ((timer = nextExpired(wheel, nowTick())) != NULL) 
+    {
+      LoadClient* client = (LoadClient*)timer;
+      if (client->socket_ >= 0) 
+      {
+        second_actions++;
+        actions++;
+        if (!loadAct(client, strategy)) 
+        {
+          errors++;
+          close(client->socket_);
+          client->socket_ = -1;
+          live--;
+        }
+      }
+    }
+
+    for (int i = 0; i < opened; i++) 
+    {
+      LoadClient* client = &clients[i];
+      if (client->socket_ < 0 ||
+       !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) 
+      {
+        continue;
+      }
+      ssize_t n = recv(client->socket_, client->line_ + client->length_,
+       sizeof(client->line_) - 1 - client->length_, MSG_DONTWAIT);
+      int failed = n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR);
+      if (n > 0) 
+      {
+        client->length_ += n;
+        client->line_[client->length_] = '\0';
+      }
+      char* line = client->line_;
+      char* newline;
+      while (!failed && (newline = strchr(line, '\n')) != NULL) 
+      {
+        *newline = '\0';
+        int kind = loadLine(client, line);
+        line = newline + 1;
+        if (kind < 0) 
+        {
+          failed = 1;
+        }
+        else if (kind == LOAD_HAND) 
+        {
+          second_hands++;
+          hands++;
+        }
+        else if (kind == LOAD_TIMEOUT) 
+        {
+          timeouts++;
+          cancelTimer(wheel, &client->timer_);
+          client->sent_ = 0;
+        }
+        else if (kind == LOAD_DECISION) 
+        {
+          cancelTimer(wheel, &client->timer_);
+          if (client->sent_ != 0) 
+          {
+            addSample(&total, now - client->sent_);
+            addSample(&second, now - client->sent_);
+            client->sent_ = 0;
+          }
+          if (think_ticks > 0) 
+          {
+            addTimer(wheel, &client->timer_,
+             1 + mix64(think_state++) % (2 * think_ticks));
+          }
+          else 
+          {
+            second_actions++;
+            actions++;
+            failed = !loadAct(client, strategy);
+          }
+        }
+      }
+      client->length_ -= line - client->line_;
+      memmove(client->line_, line, client->length_ + 1);
+      if (client->length_ >= (int)sizeof(client->line_) - 1) 
+      {
+        failed = 1;
+      }
+      if (failed) 
+      {
+        errors++;
+        cancelTimer(wheel, &client->timer_);
+        close(client->socket_);
+        client->socket_ = -1;
+        live--;
+      }
+    }
+
+    if (now >= next_report) 
+    {
+      sortSamples(&second);
+      printf("%8.1f %8d %10lld %10lld %10.1f %10.1f %8lld\n",
+       (now - start) / 1e9, live, second_actions, second_hands,
+       samplePercentile(&second, 500) / 1e3,
+       samplePercentile(&second, 990) / 1e3, errors);
+      fflush(stdout);
+      second.count_ = 0;
+      second_actions = 0;
+      second_hands = 0;
+      next_report += 1000000000LL;
+    }
+  }
+
+  for (int i = 0; i < opened; i++) 
+  {
+    if (clients[i].socket_ >= 0) 
+    {
+      close(clients[i].socket_);
+    }
+  }
+  double elapsed = (nowNs() - start) / 1e9;
+  sortSamples(&total);
+  printf("LOAD: %d SESSIONS (%d CONNECTED AT THE END) OVER %.1f s\n", opened,
+   live, elapsed);
+  printf("ACTIONS: %lld (%.0f/s)\n", actions, actions / elapsed);
+  printf("HANDS: %lld (%.0f/s)\n", hands, hands / elapsed);
+  printf("LATENCY P50: %.1f us  P99: %.1f us  P999: %.1f us\n",
+   samplePercentile(&total, 500) / 1e3, samplePercentile(&total, 990) / 1e3,
+   samplePercentile(&total, 999) / 1e3);
+  printf("ERRORS: %lld (%.4f%% OF ACTIONS)  TIMEOUTS: %lld\n", errors,
+   actions > 0 ? 100.0 * errors / actions : 0.0, timeouts);
+  free(clients);
+  free(fds);
+  free(wheel);
+  free(total.samples_);
+  free(second.samples_);
+  return hands > 0 ? 0 : SIMULATION_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Returns the resident set size of the process in KB, or -1 if it cannot
+/// be read. Reads /proc without stdio, so it does not allocate.
+///
+//
+long long residentKb(void)
+{
+  char text[128];
+  int fd = open("/proc/self/statm", O_RDONLY);
+  if (fd < 0) 
+  {
+    return -1;
+  }
+  ssize_t n = read(fd, text, sizeof(text) - 1);
+  close(fd);
+  long long size;
+  long long resident;
+  if (n <= 0) 
+  {
+    return -1;
+  }
+  text[n] = '\0';
+  if (sscanf(text, "%lld %lld", &size, &resident) != 2) 
+  {
+    return -1;
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Soak test: plays rounds of @engine (see checkAllocations) for @seconds
+/// seconds and every @interval seconds prints the rounds, the p50/p99/p999
+/// latency of a round, the resident set size, the heap in use (mallinfo2)
+/// and the blocks allocated and not freed (the interposed malloc and free
+/// counters). The first interval warms up; the second is the baseline the
+/// last one is compared to. The test fails if the resident set or the heap
+/// grew by more than @growth_kb KB, if any block leaked (resizes of live
+/// blocks do not count, see checkCounters), or if the p50 or p99 latency
+/// drifted up by more than @drift percent. SIGINT ends it early, judged on
+/// the intervals so far; before one after the baseline, it fails.
+///
+/// @param engine The rounds to play.
+/// @param context The engines (see openAllocationCheck).
+/// @param seconds How long to run, at least three intervals.
+/// @param interval The seconds between samples.
+/// @param growth_kb The memory growth allowed.
+/// @param drift The latency drift allowed, in percent.
+/// @return zero if it passed, otherwise error code
+///
+//
+int runSoak(AllocationEngine engine, void* context, double seconds,
+ double interval, long long growth_kb, int drift)
+{
+  if (!checkCounters()) 
+  {
+    return SIMULATION_ERROR;
+  }
+  //populated up front, so its pages do not show up as growth
+  size_t samples_size = sizeof(long long) * SOAK_SAMPLES;
+  long long* samples = mmap(NULL, samples_size, PROT_READ | PROT_WRITE,
+   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (samples == MAP_FAILED) 
+  {
+    return memoryError();
+  }
+  Reservoir latencies = { samples, SOAK_SAMPLES, 0, 0 };
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  server_stopped = 0;
+  printf("%9s %12s %9s %9s %9s %9s %9s %9s\n", "SECONDS", "ROUNDS",
+   "P50_NS", "P99_NS", "P999_NS", "RSS_KB", "HEAP_KB", "BLOCKS");
+  fflush(stdout);
+
+  SoakInterval baseline = { 0 };
+  SoakInterval last = { 0 };
+  int intervals = 0;
+  int total = (int)(seconds / interval);
+  long long start = nowNs();
+  long long next = start + (long long)(interval * 1e9);
+  long long round = 0;
+  long long interval_rounds = 0;
+  while (intervals < total && !server_stopped) 
+  {
+    long long before = nowNs();
+    engine(context, round++);
+    long long now = nowNs();
+    addSample(&latencies, now - before);
+    interval_rounds++;
+    if (now < next) 
+    {
+      continue;
+    }
+
+    sortSamples(&latencies);
+    struct mallinfo2 heap = mallinfo2();
+    last.rss_kb_ = residentKb();
+    last.heap_kb_ = heap.uordblks / 1024;
+    last.blocks_ = atomic_load(&allocations) - atomic_load(&frees);
+    last.p50_ = samplePercentile(&latencies, 500);
+    last.p99_ = samplePercentile(&latencies, 990);
+    printf("%9.1f %12lld %9lld %9lld %9lld %9lld %9lld %9lld%s\n",
+     (now - start) / 1e9, interval_rounds, last.p50_, last.p99_,
+     samplePercentile(&latencies, 999), last.rss_kb_, last.heap_kb_,
+     last.blocks_, intervals == 0 ? "  WARMUP" :
+     intervals == 1 ? "  BASELINE" : "");
+    fflush(stdout);
+    if (intervals == 1) 
+    {
+      baseline = last;
+    }
+    intervals++;
+    latencies.count_ = 0;
+    interval_rounds = 0;
+    next += (long long)(interval * 1e9);
+  }
+  munmap(samples, samples_size);
+
+  if (intervals < 3) 
+  {
+    printf("[ERR] Stopped before an interval could be compared to the "
+     "baseline.\n");
+    return SIMULATION_ERROR;
+  }
+  long long rss = last.rss_kb_ - baseline.rss_kb_;
+  long long heap = last.heap_kb_ - baseline.heap_kb_;
+  long long blocks = last.blocks_ - baseline.blocks_;
+  double p50 = baseline.p50_ > 0 ?
+   100.0 * (last.p50_ - baseline.p50_) / baseline.p50_ : 0;
+  double p99 = baseline.p99_ > 0 ?
+   100.0 * (last.p99_ - baseline.p99_) / baseline.p99_ : 0;
+  int memory_passed = rss <= growth_kb && heap <= growth_kb && blocks <= 0;
+  int latency_passed = p50 <= drift && p99 <= drift;
+  printf("MEMORY GROWTH: RSS %+lld KB  HEAP %+lld KB  BLOCKS %+lld  %s\n",
+   rss, heap, blocks, memory_passed ? "PASS" : "FAIL");
+  printf("LATENCY DRIFT: P50 %+.1f%%  P99 %+.1f%%  %s\n", p50, p99,
+   latency_passed ? "PASS" : "FAIL");
+  return memory_passed && latency_passed ? 0 : SIMULATION_ERROR;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Runs the command given after the seed instead of the interactive game.
+///
+/// perf [command] (the command, or the interactive game, with per stage
+///  performance counters printed at exit)
+/// fromcorpus <corpus_file> [command] (the command, or the interactive
+///  game, dealt from a corpus instead of shuffled)
+/// simulate <rounds> <workers> [strategy [results_file [rounds_file]]]
+/// tune
+/// sweep <rounds> <local_workers> <socket_path> [results_file]
+/// worker <socket_path>
+/// rare <dealer6|player7> <rounds> [tilt] [stand_on]
+/// dump <results_file>
+/// resume <snapshot_file>
+/// broadcast <socket_path>
+/// watch <socket_path>
+/// serve <socket_path> <timeout_ms> [max_sessions [journal_file
+///  [audit_file]]]
+/// load <socket_path> <sessions> <seconds> [think_ms [strategy
+///  [ramp_seconds]]]
+/// commitlog <audit_file> <shoes>
+/// audit <audit_file> <workers>
+/// snapbench <iterations>
+/// journalbench <journal_file> <records>
+/// shufflebench <tables> <shoes>
+/// alloccheck <rounds>
+/// soak <interactive|simulator|server> <seconds> [interval_seconds
+///  [growth_kb [drift_percent]]]
+/// corpus <corpus_file> <shoes>
+/// record <history_file> <rounds> [strategy [keyframe_rounds]]
+/// seek <history_file> <round|time> <number|seconds>
+/// atlas <atlas_file>
+/// firstframe <spawn_ns> (startbench's table process)
+/// startbench <card_folder> <atlas_file> <runs>
+/// rlbench <games> <steps>
+/// qlearn <games> <steps> <workers> <strategy_file>
+/// evolve <generations> <population> <rounds> <workers> <strategy_file>
+/// tournament <rounds> <workers> <strategy> [strategy ...]
+/// drill <hand> <upcard> <count> [decks [min_true_count]]
+///
+/// A strategy is either the score to stand on or a strategy file (see
+/// saveStrategy).
+/// Result files ending in ".csv" are written as CSV, all others in the
+/// columnar format (see openExport).
+/// @param deck The unshuffled deck.
+/// @param seed The run seed.
+/// @param width Width of single card image.
+/// @param height Height of single card image.
+/// @param argc Number of command arguments.
+/// @param argv The command name and its arguments.
+/// @return zero if the command succeeds, otherwise an error code
+///
+//
+int runCommand(Card* deck, int seed, int width, int height, int argc,
+ char** argv)
+{
+  if (strcmp(argv[0], "perf") == 0) 
+  {
+    int result = enableCounters();
+    if (result == 0) 
+    {
+      result = argc > 1 ? runCommand(deck, seed, width, height, argc - 1,
+       argv + 1) : startGame(deck, seed, width, height, NULL);
+      if (result != ARGUMENTS_ERROR) 
+      {
+        printCounters();
+      }
+    }
+    return result;
+  }
+  if (strcmp(argv[0], "fromcorpus") == 0 && argc >= 2) 
+  {
+    int result = openCorpus(argv[1]);
+    if (result == 0) 
+    {
+      result = argc > 2 ? runCommand(deck, seed, width, height, argc - 2,
+       argv + 2) : startGame(deck, seed, width, height, NULL);
+      closeCorpus();
+    }
+    return result;
+  }
+  if (strcmp(argv[0], "record") == 0 && argc >= 3 && argc <= 5) 
+  {
+    long long rounds = strtoll(argv[2], NULL, 10);
+    int keyframe_rounds = argc == 5 ? strtol(argv[4], NULL, 10) :
+     DEFAULT_KEYFRAME_ROUNDS;
+    if (rounds < 1 || keyframe_rounds < 1 ||
+     strlen(argv[1]) >= PATH_LENGTH) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    Strategy strategy;
+    int stand_on = DEFAULT_STAND_ON;
+    thresholdStrategy(&strategy, stand_on);
+    if (argc >= 4 && parseStrategy(argv[3], &strategy, &stand_on) != 0) 
+    {
+      return FILE_ERROR;
+    }
+    return recordHistory(deck, seed, argv[1], rounds, &strategy,
+     keyframe_rounds);
+  }
+  if (strcmp(argv[0], "seek") == 0 && argc == 4) 
+  {
+    int by_time = strcmp(argv[2], "time") == 0;
+    double target = strtod(argv[3], NULL);
+    if ((!by_time && strcmp(argv[2], "round") != 0) || target < 0 ||
+     strlen(argv[1]) >= PATH_LENGTH) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return seekHistory(argv[1], by_time, target, width, height);
+  }
+  if (strcmp(argv[0], "corpus") == 0 && argc == 3) 
+  {
+    long long shoes = strtoll(argv[2], NULL, 10);
+    if (shoes < 1) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return writeCorpus(deck, seed, argv[1], shoes);
+  }
+  if (strcmp(argv[0], "simulate") == 0 && argc >= 3 && argc <= 6) 
+  {
+    long long rounds = strtoll(argv[1], NULL, 10);
+    int workers = strtol(argv[2], NULL, 10);
+    char* rounds_path = argc == 6 ? argv[5] : NULL;
+    if (rounds < 1 || workers < 0 || workers > MAX_WORKERS) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    if (!loadProfile() && workers == 0) 
+    {
+      int result = tuneSimulation(deck, seed);
+      if (result != 0) 
+      {
+        return result;
+      }
+    }
+    if (workers == 0) 
+    {
+      workers = tuning.workers_;
+    }
+
+    Strategy strategy;
+    int stand_on = DEFAULT_STAND_ON;
+    thresholdStrategy(&strategy, stand_on);
+    if (argc >= 4 && parseStrategy(argv[3], &strategy, &stand_on) != 0) 
+    {
+      return FILE_ERROR;
+    }
+
+    Stats stats;
+    int result = runSimulation(deck, seed, rounds, workers, &strategy,
+     rounds_path, &stats);
+    if (result == 0) 
+    {
+      printStats(&stats);
+      if (argc >= 5) 
+      {
+        result = exportConfigs(argv[4], stand_on, &stats, 1);
+      }
+    }
+    return result;
+  }
+  if (strcmp(argv[0], "tune") == 0 && argc == 1) 
+  {
+    return tuneSimulation(deck, seed);
+  }
+  if (strcmp(argv[0], "sweep") == 0 && (argc == 4 || argc == 5)) 
+  {
+    long long rounds = strtoll(argv[1], NULL, 10);
+    int workers = strtol(argv[2], NULL, 10);
+    if (rounds < 1 || workers < 0 || workers > MAX_WORKERS) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+
+    Stats results[SWEEP_MAX_STAND - SWEEP_MIN_STAND + 1];
+    int result = runSweep(deck, seed, rounds, workers, argv[3], results);
+    if (result == 0) 
+    {
+      printSweep(results);
+      if (argc == 5) 
+      {
+        result = exportConfigs(argv[4], SWEEP_MIN_STAND, results,
+         SWEEP_MAX_STAND - SWEEP_MIN_STAND + 1);
+      }
+    }
+    return result;
+  }
+  if (strcmp(argv[0], "rare") == 0 && argc >= 3 && argc <= 5) 
+  {
+    int event = strcmp(argv[1], "dealer6") == 0 ? EVENT_DEALER_SIX :
+     strcmp(argv[1], "player7") == 0 ? EVENT_PLAYER_SEVEN : 0;
+    long long rounds = strtoll(argv[2], NULL, 10);
+    double tilt = argc >= 4 ? strtod(argv[3], NULL) : DEFAULT_TILT;
+    int stand_on = argc == 5 ? strtol(argv[4], NULL, 10) : DEFAULT_STAND_ON;
+    if (event == 0 || rounds < 1 || tilt < 1.0) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+
+    runRareEvent(deck, seed, event, rounds, stand_on, tilt);
+    return 0;
+  }
+  if (strcmp(argv[0], "worker") == 0 && argc == 2) 
+  {
+    return runWorker(deck, argv[1]);
+  }
+  if (strcmp(argv[0], "dump") == 0 && argc == 2) 
+  {
+    return dumpExport(argv[1]);
+  }
+  if (strcmp(argv[0], "broadcast") == 0 && argc == 2) 
+  {
+    return broadcastGame(deck, seed, argv[1], width, height);
+  }
+  if (strcmp(argv[0], "watch") == 0 && argc == 2) 
+  {
+    return watchBroadcast(argv[1]);
+  }
+  if (strcmp(argv[0], "load") == 0 && argc >= 4 && argc <= 7) 
+  {
+    int sessions = strtol(argv[2], NULL, 10);
+    double seconds = strtod(argv[3], NULL);
+    int think_ms = argc >= 5 ? strtol(argv[4], NULL, 10) : 0;
+    double ramp = argc == 7 ? strtod(argv[6], NULL) : DEFAULT_RAMP_SECONDS;
+    if (sessions < 1 || seconds <= 0 || think_ms < 0 || ramp < 0) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    Strategy strategy;
+    int stand_on = DEFAULT_STAND_ON;
+    thresholdStrategy(&strategy, stand_on);
+    if (argc >= 6 && parseStrategy(argv[5], &strategy, &stand_on) != 0) 
+    {
+      return FILE_ERROR;
+    }
+    return runLoad(argv[1], sessions, seconds, think_ms, &strategy, ramp);
+  }
+  if (strcmp(argv[0], "serve") == 0 && argc >= 3 && argc <= 6) 
+  {
+    int timeout_ms = strtol(argv[2], NULL, 10);
+    int max_sessions = argc >= 4 ? strtol(argv[3], NULL, 10) :
+     DEFAULT_MAX_SESSIONS;
+    if (timeout_ms < 1 || max_sessions < 1 ||
+     (argc >= 5 && strlen(argv[4]) >= PATH_LENGTH)) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return runServer(deck, seed, argv[1], timeout_ms, max_sessions,
+     argc >= 5 ? argv[4] : NULL, argc == 6 ? argv[5] : NULL);
+  }
+  if (strcmp(argv[0], "commitlog") == 0 && argc == 3) 
+  {
+    long long shoes = strtoll(argv[2], NULL, 10);
+    if (shoes < 1) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return writeCommitLog(deck, argv[1], shoes);
+  }
+  if (strcmp(argv[0], "audit") == 0 && argc == 3) 
+  {
+    int workers = strtol(argv[2], NULL, 10);
+    if (workers < 1 || workers > MAX_WORKERS) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return runAudit(argv[1], workers);
+  }
+  if (strcmp(argv[0], "resume") == 0 && argc == 2) 
+  {
+    return resumeGame(deck, argv[1], width, height);
+  }
+  if (strcmp(argv[0], "snapbench") == 0 && argc == 2) 
+  {
+    long long iterations = strtoll(argv[1], NULL, 10);
+    if (iterations < 1) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    benchmarkSnapshots(deck, seed, iterations);
+    return 0;
+  }
+  if (strcmp(argv[0], "journalbench") == 0 && argc == 3) 
+  {
+    long long records = strtoll(argv[2], NULL, 10);
+    if (records < 1 || strlen(argv[1]) >= PATH_LENGTH) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return benchmarkJournal(argv[1], records);
+  }
+  if (strcmp(argv[0], "alloccheck") == 0 && argc == 2) 
+  {
+    long long rounds = strtoll(argv[1], NULL, 10);
+    if (rounds < 1) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return checkAllocations(deck, seed, rounds, width, height);
+  }
+  if (strcmp(argv[0], "soak") == 0 && argc >= 3 && argc <= 6) 
+  {
+    char* names[] = { "interactive", "simulator", "server" };
+    AllocationEngine engines[] = { interactiveRound, simulatorRound,
+     serverRound };
+    int e = 0;
+    while (e < 3 && strcmp(argv[1], names[e]) != 0) 
+    {
+      e++;
+    }
+    double seconds = strtod(argv[2], NULL);
+    double interval = argc >= 4 ? strtod(argv[3], NULL) :
+     DEFAULT_SOAK_INTERVAL;
+    long long growth_kb = argc >= 5 ? strtoll(argv[4], NULL, 10) :
+     DEFAULT_SOAK_GROWTH_KB;
+    int drift = argc == 6 ? strtol(argv[5], NULL, 10) : DEFAULT_SOAK_DRIFT;
+    if (e == 3 || interval <= 0 || seconds < 3 * interval || growth_kb < 0 ||
+     drift < 0) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    AllocationCheck* check = openAllocationCheck(deck, seed, width, height);
+    if (check == NULL) 
+    {
+      return memoryError();
+    }
+    int result = runSoak(engines[e], check, seconds, interval, growth_kb,
+     drift);
+    closeAllocationCheck(check);
+    return result;
+  }
+  if (strcmp(argv[0], "atlas") == 0 && argc == 2) 
+  {
+    return saveAtlas(argv[1]);
+  }
+  if (strcmp(argv[0], "firstframe") == 0 && argc == 2) 
+  {
+    return firstFrame(deck, seed, width, height, strtoll(argv[1], NULL, 10));
+  }
+  if (strcmp(argv[0], "startbench") == 0 && argc == 4) 
+  {
+    int runs = strtol(argv[3], NULL, 10);
+    if (runs < 1 || runs > MAX_STARTUP_RUNS ||
+     strlen(argv[1]) >= PATH_LENGTH - 1 || strlen(argv[2]) >= PATH_LENGTH) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return benchmarkStartup(argv[1], argv[2], runs);
+  }
+  if (strcmp(argv[0], "shufflebench") == 0 && argc == 3) 
+  {
+    int tables = strtol(argv[1], NULL, 10);
+    long long shoes = strtoll(argv[2], NULL, 10);
+    if (tables < 1 || shoes < 1) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return benchmarkShuffles(deck, seed, tables, shoes);
+  }
+  if (strcmp(argv[0], "qlearn") == 0 && argc == 5) 
+  {
+    int count = strtol(argv[1], NULL, 10);
+    long long steps = strtoll(argv[2], NULL, 10);
+    int workers = strtol(argv[3], NULL, 10);
+    if (count < 1 || steps < 1 || workers < 1 || workers > MAX_WORKERS) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+
+    Strategy strategy;
+    int result = learnStrategy(deck, seed, count, steps, &strategy);
+    if (result == 0) 
+    {
+      printf("LEARNED NET PER ROUND: %+.5f\n", evaluateStrategy(deck,
+       roundSeed(seed, -1), CHUNK_ROUNDS * 16, workers, &strategy));
+      result = saveStrategy(argv[4], &strategy);
+    }
+    return result;
+  }
+  if (strcmp(argv[0], "evolve") == 0 && argc == 6) 
+  {
+    int generations = strtol(argv[1], NULL, 10);
+    int population = strtol(argv[2], NULL, 10);
+    long long rounds = strtoll(argv[3], NULL, 10);
+    int workers = strtol(argv[4], NULL, 10);
+    if (generations < 1 || population < 1 || rounds < 1 || workers < 1 ||
+     workers > MAX_WORKERS) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+
+    Strategy strategy;
+    int result = evolveStrategy(deck, seed, generations, population, rounds,
+     workers, &strategy);
+    if (result == 0) 
+    {
+      printf("EVOLVED NET PER ROUND: %+.5f\n", evaluateStrategy(deck,
+       roundSeed(seed, -1), CHUNK_ROUNDS * 16, workers, &strategy));
+      result = saveStrategy(argv[5], &strategy);
+    }
+    return result;
+  }
+  if (strcmp(argv[0], "tournament") == 0 && argc >= 4 &&
+   argc <= 3 + MAX_STRATEGIES) 
+  {
+    long long rounds = strtoll(argv[1], NULL, 10);
+    int workers = strtol(argv[2], NULL, 10);
+    if (rounds < 1 || workers < 1 || workers > MAX_WORKERS) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+
+    Strategy strategies[MAX_STRATEGIES];
+    int stand_on;
+    for (int s = 0; s < argc - 3; s++) 
+    {
+      if (parseStrategy(argv[3 + s], &strategies[s], &stand_on) != 0) 
+      {
+        return FILE_ERROR;
+      }
+    }
+    return runTournament(deck, seed, rounds, workers, strategies, argv + 3,
+     argc - 3);
+  }
+  if (strcmp(argv[0], "drill") == 0 && argc >= 4 && argc <= 6) 
+  {
+    DrillSpec spec;
+    long long count = strtoll(argv[3], NULL, 10);
+    int decks = argc >= 5 ? strtol(argv[4], NULL, 10) : 1;
+    double min_true_count = argc == 6 ? strtod(argv[5], NULL) : -DECK_SIZE;
+    if (!parseDrill(argv[1], argv[2], &spec) || count < 1 || decks < 1 ||
+     definition.shoe_size_ * decks > MAX_SHOE_SIZE) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return runDrills(deck, seed, &spec, count, decks, min_true_count);
+  }
+  if (strcmp(argv[0], "rlbench") == 0 && argc == 3) 
+  {
+    int count = strtol(argv[1], NULL, 10);
+    long long steps = strtoll(argv[2], NULL, 10);
+    if (count < 1 || steps < 1) 
+    {
+      return ARGUMENTS_ERROR;
+    }
+    return benchmarkEnv(deck, seed, count, steps);
+  }
   return ARGUMENTS_ERROR;
 }
 
 //-----------------------------------------------------------------------------
 ///
-/// Prints error message and terminates the program with error code.
+/// Checks that a compiled definition describes a playable shoe.
 ///
-/// @return int The error code.
+/// @return 1 if it does, otherwise 0
 ///
 //
-int memoryError() 
+int checkDefinition(GameDefinition* game)
 {
-  printf("[ERR] Out of memory.\n");
-  return MEMORY_ERROR;
+  if (game->ranks_ < 1 || game->ranks_ > MAX_RANKS) 
+  {
+    return 0;
+  }
+  int shoe_size = 0;
+  for (int r = 0; r < game->ranks_; r++) 
+  {
+    if (game->points_[r] < 2 || game->points_[r] > 11 ||
+     game->copies_[r] < 0) 
+    {
+      return 0;
+    }
+    game->names_[r][RANK_NAME_LENGTH - 1] = '\0';
+    game->files_[r][FILE_NAME_LENGTH - 1] = '\0';
+    shoe_size += game->copies_[r];
+  }
+  return shoe_size == game->shoe_size_ && shoe_size >= MIN_SHOE_SIZE &&
+   shoe_size <= MAX_SHOE_SIZE;
 }
 
 //-----------------------------------------------------------------------------
 ///
-/// Prints error message and terminates the program with error code.
+/// Compiles a game definition file. Every line is empty, a comment starting
+/// with '#', "decks <count>" or
+/// "rank <name> <image_file> <points> <copies_per_deck>", where 11 points
+/// make the rank an ace. Ranks are numbered in the order they are listed.
 ///
-/// @return int The error code.
+/// @param file The definition file.
+/// @param game The compiled definition.
+/// @return zero on success, FILE_ERROR if the definition is not valid
 ///
 //
-int fileError() 
+int parseDefinition(FILE* file, GameDefinition* game)
 {
-  printf("[ERR] Invalid File(s).\n");
-  return FILE_ERROR;
+  char line[DEFINITION_LINE_LENGTH];
+  int decks = 1;
+  memset(game, 0, sizeof(GameDefinition));
+  while (fgets(line, sizeof(line), file) != NULL) 
+  {
+    char keyword[OPTION_INPUT_LENGTH];
+    if (sscanf(line, "%19s", keyword) != 1 || keyword[0] == '#') 
+    {
+      continue;
+    }
+    if (strcmp(keyword, "decks") == 0 &&
+     sscanf(line, "%*s %d", &decks) == 1 && decks >= 1 && decks <= MAX_DECKS) 
+    {
+      continue;
+    }
+    int r = game->ranks_;
+    if (strcmp(keyword, "rank") != 0 || r == MAX_RANKS ||
+     sscanf(line, "%*s %7s %31s %d %d", game->names_[r], game->files_[r],
+     &game->points_[r], &game->copies_[r]) != 4) 
+    {
+      return FILE_ERROR;
+    }
+    game->ranks_++;
+  }
+  for (int r = 0; r < game->ranks_; r++) 
+  {
+    game->copies_[r] *= decks;
+    game->shoe_size_ += game->copies_[r];
+  }
+  return checkDefinition(game) ? 0 : FILE_ERROR;
 }
 
 //-----------------------------------------------------------------------------
 ///
-/// Frees(deallocates) used space on the heap.
+/// Loads the game definition of an input folder into @definition. Without a
+/// DEFINITION_FILE the classic definition stays. The compiled definition is
+/// cached in DEFINITION_CACHE together with the size and modification time
+/// of the file it came from, so the file is only parsed again after it
+/// changes. Failing to write the cache is not an error.
 ///
-/// @param card_images The allocated memory used for card images.
-/// @param size The allocated space size.
+/// @param input_path The input folder, ending with '/'.
+/// @return zero on success, otherwise error code
 ///
 //
-void deallocateMemory(char** card_images, int size) 
+int loadDefinition(char* input_path)
 {
-  for (int i = 0; i < size; i++) 
+  char path[PATH_LENGTH + FILE_NAME_LENGTH];
+  char cache_path[PATH_LENGTH + FILE_NAME_LENGTH];
+  snprintf(path, sizeof(path), "%s%s", input_path, DEFINITION_FILE);
+  snprintf(cache_path, sizeof(cache_path), "%s%s", input_path,
+   DEFINITION_CACHE);
+  struct stat source;
+  if (stat(path, &source) != 0) 
   {
-    free(card_images[i]);
+    return 0;
   }
-}
+  long long stamp[3] = {
+    source.st_size, source.st_mtim.tv_sec, source.st_mtim.tv_nsec
+  };
 
-//------------------------------------------------------------------------------
-///
-/// The main program.
-/// Reads card images from files conatained in input map(second argument)
-/// and makes a deck. The cards from deck are dealt to dealer and player 
-/// and game of blackjack starts.
-///
-/// @param argc Number of arguments (should be 2 or 3)
-/// @param argv The executable name, input map and number 
-///        for generating random seed(optional)
-/// @return zero if program ends without errors,
-///         for unexpected program end, see error codes on the top
-//
-int main(int argc, char** argv) 
-{
-  if (argc < 2 || argc > 3) 
+  GameDefinition game;
+  char magic[4];
+  long long cached[3];
+  FILE* file = fopen(cache_path, "rb");
+  if (file != NULL) 
   {
-    return argumentsError(argv[0]);
+    int hit = fread(magic, 1, 4, file) == 4 &&
+     memcmp(magic, DEFINITION_MAGIC, 4) == 0 &&
+     fread(cached, sizeof(cached), 1, file) == 1 &&
+     memcmp(cached, stamp, sizeof(stamp)) == 0 &&
+     fread(&game, sizeof(game), 1, file) == 1 && checkDefinition(&game);
+    fclose(file);
+    if (hit) 
+    {
+      definition = game;
+      return 0;
+    }
   }
 
-  char* input_path = argv[1];
-  if (input_path[strlen(input_path) - 1] != '/') 
+  file = fopen(path, "r");
+  if (file == NULL) 
+  {
+    return fileError();
+  }
+  int result = parseDefinition(file, &game);
+  fclose(file);
+  if (result != 0) 
   {
-    strcat(input_path, "/");
+    printf("[ERR] Invalid game definition %s.\n", path);
+    return result;
   }
+  definition = game;
 
-  int seed = time(NULL);
-  char* rest;
-  if (argc == 3) 
+  file = fopen(cache_path, "wb");
+  if (file != NULL) 
   {
-    seed = strtol(argv[2], &rest, 10);
+    fwrite(DEFINITION_MAGIC, 1, 4, file);
+    fwrite(stamp, sizeof(stamp), 1, file);
+    fwrite(&game, sizeof(game), 1, file);
+    fclose(file);
   }
+  return 0;
+}
 
-  Card cards[DECK_SIZE];
-  char* file_names[] = { 
-    "ace.txt", "king.txt", "queen.txt", "jack.txt", "10.txt", 
-    "9.txt", "8.txt", "7.txt", "6.txt", 
-    "5.txt", "4.txt", "3.txt", "2.txt"
-  };
-  int points[] = { 11, 10, 10, 10, 10, 9, 8, 7, 6, 5, 4, 3, 2 };
-  char* card_images[NUM_CARDS] = { NULL };
+//-----------------------------------------------------------------------------
+///
+/// Loads the game definition and the card image files of a folder.
+///
+/// @param input_path The folder, ending with '/'.
+/// @param assets The loaded images.
+/// @return zero on success, otherwise an error code
+///
+//
+int loadTextAssets(char* input_path, CardAssets* assets)
+{
+  int loaded = loadDefinition(input_path);
+  if (loaded != 0) 
+  {
+    return loaded;
+  }
+
+  char** card_images = assets->images_;
 
   FILE* card_file;
   int c; //to read chars from file
@@ -231,18 +10145,17 @@ int main(int argc, char** argv)
   int image_width = 0;
 
   int size = ALLOC_SIZE;
-  int card_count = 0;
 
-  for (int i = 0; i < NUM_CARDS; i++) 
+  for (int i = 0; i < definition.ranks_; i++) 
   { 
     char file_to_open[PATH_LENGTH + FILE_NAME_LENGTH];
     strcpy(file_to_open, file_path);
-    strcat(file_to_open, file_names[i]);
+    strcat(file_to_open, definition.files_[i]);
 
     card_file = fopen(file_to_open, "r");
     if (card_file == NULL) 
     {
-      deallocateMemory(card_images, i + 1);
+      deallocateMemory(card_images, i);
       return fileError();
     }
 
@@ -254,7 +10167,8 @@ int main(int argc, char** argv)
     card_images[i] = malloc(size); //allocate buffer to store file content
     if (card_images[i] == NULL) 
     {
-      deallocateMemory(card_images, i + 1);
+      fclose(card_file);
+      deallocateMemory(card_images, i);
       return memoryError();
     }
     
@@ -262,13 +10176,16 @@ int main(int argc, char** argv)
     {
       if (nch >= size - 1) //time to reallocate
       { 
-        size *= 2;
-        card_images[i] = realloc(card_images[i], size);
-        if (card_images[i] == NULL) 
+        //on failure the old buffer stays in card_images[i] to be freed
+        char* grown = realloc(card_images[i], size * 2);
+        if (grown == NULL) 
         {
+          fclose(card_file);
           deallocateMemory(card_images, i + 1);
           return memoryError();
         } 
+        card_images[i] = grown;
+        size *= 2;
       }
 
       //add new character and update lengths
@@ -283,6 +10200,7 @@ int main(int argc, char** argv)
         }
         else if (currlnlen != lnlen) 
         {
+          fclose(card_file);
           deallocateMemory(card_images, i + 1);
           return fileError();
         }
@@ -290,6 +10208,8 @@ int main(int argc, char** argv)
       }
     }
 
+    fclose(card_file);
+
     if (i == 0) 
     {
       image_height = nln;
@@ -300,119 +10220,324 @@ int main(int argc, char** argv)
       deallocateMemory(card_images, i + 1);
       return fileError();
     }
-    
-    //add 4 cards of current image to the deck
-    for (int k = 0; k < 4; k++) 
+  }
+
+  assets->width_ = image_width;
+  assets->height_ = image_height;
+  assets->owned_ = 1;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Takes the definition and card images from the mapped atlas @atlas if it
+/// is valid (see packAtlas).
+///
+/// @param assets The images, pointing into the atlas.
+/// @param atlas The atlas.
+/// @param size The size of the atlas, at least sizeof(AtlasHeader).
+/// @return 1 if the atlas is valid, otherwise 0
+///
+//
+int useAtlas(CardAssets* assets, char* atlas, size_t size)
+{
+  AtlasHeader header;
+  memcpy(&header, atlas, sizeof(header));
+  if (memcmp(header.magic_, ATLAS_MAGIC, 4) != 0 || header.width_ < 2 ||
+   header.width_ > MAX_IMAGE_SIZE || header.height_ < 1 ||
+   header.height_ > MAX_IMAGE_SIZE || !checkDefinition(&header.definition_)) 
+  {
+    return 0;
+  }
+  size_t image_size = (size_t)header.width_ * header.height_;
+  size_t images_size = header.definition_.ranks_ * image_size;
+  if (size != sizeof(header) + images_size) 
+  {
+    return 0;
+  }
+  //every line must end where renderCards expects it to
+  char* images = atlas + sizeof(header);
+  for (size_t end = header.width_ - 1; end < images_size;
+   end += header.width_) 
+  {
+    if (images[end] != '\n') 
     {
-      Card card = { card_images[i], points[i]};
-      cards[card_count++] = card;
+      return 0;
     }
-
-    fclose(card_file);
   }
 
-  //THE GAME STARTS...
+  definition = header.definition_;
+  for (int r = 0; r < definition.ranks_; r++) 
+  {
+    assets->images_[r] = images + r * image_size;
+  }
+  assets->width_ = header.width_;
+  assets->height_ = header.height_;
+  assets->map_ = atlas;
+  assets->map_size_ = size;
+  return 1;
+}
 
-  //shuffle cards
-  FisherYates(cards, DECK_SIZE, seed);
+//-----------------------------------------------------------------------------
+///
+/// Maps an atlas file (see saveAtlas) and takes the definition and card
+/// images from it.
+///
+/// @param path The atlas file.
+/// @param assets The images, pointing into the mapping.
+/// @return zero on success, otherwise an error code
+///
+//
+int loadAtlas(char* path, CardAssets* assets)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) 
+  {
+    return fileError();
+  }
+  struct stat status;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &status) == 0 &&
+   status.st_size >= (off_t)sizeof(AtlasHeader)) 
+  {
+    map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) 
+  {
+    return fileError();
+  }
+  if (!useAtlas(assets, map, status.st_size)) 
+  {
+    munmap(map, status.st_size);
+    return fileError();
+  }
+  return 0;
+}
 
-  Card dealer[DECK_SIZE];
-  Card player[DECK_SIZE];
-  int dealer_count = 0;
-  int player_count = 0;
-  int dealer_score = 0;
-  int player_score = 0;
-  card_count = 0;
+//-----------------------------------------------------------------------------
+///
+/// Takes the definition and card images of a folder from the atlas that
+/// the first process to load the folder publishes in shared memory (see
+/// sharedAssetsName). That process, and any that starts while the atlas is
+/// being published, loads the text files instead. The atlas lives until
+/// the segment is removed from /dev/shm, so a changed folder needs that.
+///
+/// @param input_path The folder, ending with '/'.
+/// @param assets The loaded images.
+/// @return zero on success, otherwise an error code
+///
+//
+int loadSharedAssets(char* input_path, CardAssets* assets)
+{
+  char name[FILE_NAME_LENGTH];
+  sharedAssetsName(input_path, name);
 
-  giveCards(cards, player, &card_count, &player_count, &player_score, 2);
-  giveCards(cards, dealer, &card_count, &dealer_count, &dealer_score, 2);
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd >= 0) 
+  {
+    struct stat status;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &status) == 0 &&
+     status.st_size >= (off_t)sizeof(AtlasHeader)) 
+    {
+      map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map != MAP_FAILED) 
+    {
+      //the magic is written last
+      int published = memcmp(map, ATLAS_MAGIC, 4) == 0;
+      atomic_thread_fence(memory_order_acquire);
+      if (published && useAtlas(assets, map, status.st_size)) 
+      {
+        return 0;
+      }
+      munmap(map, status.st_size);
+    }
+    return loadTextAssets(input_path, assets);
+  }
 
-  showCards(dealer, 1, dealer[0].points_, image_width, image_height, 0);
-  showCards(player, player_count, player_score, image_width, image_height, 1);
+  int result = loadTextAssets(input_path, assets);
+  if (result != 0) 
+  {
+    return result;
+  }
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) 
+  {
+    return 0; //another process is publishing it
+  }
+  size_t size = atlasSize(assets);
+  void* map = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) 
+  {
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) 
+  {
+    shm_unlink(name);
+    return 0;
+  }
+  packAtlas(assets, map);
+  atomic_thread_fence(memory_order_release);
+  memcpy(map, ATLAS_MAGIC, 4);
+  munmap(map, size);
+  return 0;
+}
 
-  if (player_score == 21) 
+//-----------------------------------------------------------------------------
+///
+/// Loads the definition and card images the deck is built from. @input is
+/// EMBEDDED_ASSETS for the classic cards built into the executable,
+/// SHARED_ASSETS followed by a folder for its atlas in shared memory (see
+/// loadSharedAssets), an atlas file ending with ATLAS_EXTENSION or a folder
+/// with a game definition and card image files.
+///
+/// @param input The assets as given on the command line.
+/// @param assets The loaded images.
+/// @return zero on success, otherwise an error code
+///
+//
+int loadAssets(char* input, CardAssets* assets)
+{
+  char input_path[PATH_LENGTH];
+  size_t length = strlen(input);
+  size_t shared = strlen(SHARED_ASSETS);
+  size_t extension = strlen(ATLAS_EXTENSION);
+  if (strcmp(input, EMBEDDED_ASSETS) == 0) 
   {
-    printf("BLACKJACK! ");
-    showCards(dealer, 2, dealer_score, image_width, image_height, 0);
-    if (dealer_score != 21) 
+    for (int r = 0; r < definition.ranks_; r++) 
     {
-      printf("YOU WIN!");
+      assets->images_[r] = (char*)embedded_cards[r];
     }
-    else 
+    assets->width_ = EMBEDDED_WIDTH;
+    assets->height_ = EMBEDDED_HEIGHT;
+    return 0;
+  }
+  if (strncmp(input, SHARED_ASSETS, shared) == 0) 
+  {
+    folderPath(input + shared, input_path);
+    return loadSharedAssets(input_path, assets);
+  }
+  if (length > extension &&
+   strcmp(input + length - extension, ATLAS_EXTENSION) == 0) 
+  {
+    return loadAtlas(input, assets);
+  }
+  folderPath(input, input_path);
+  return loadTextAssets(input_path, assets);
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Frees the card images of @assets or unmaps their atlas.
+///
+//
+void releaseAssets(CardAssets* assets)
+{
+  if (assets->owned_) 
+  {
+    deallocateMemory(assets->images_, definition.ranks_);
+  }
+  if (assets->map_ != NULL) 
+  {
+    munmap(assets->map_, assets->map_size_);
+  }
+}
+
+//-----------------------------------------------------------------------------
+///
+/// Builds the unshuffled shoe: the copies of every rank, in rank order.
+///
+/// @param assets The card images.
+/// @param cards The shoe, definition.shoe_size_ cards.
+///
+//
+void buildDeck(CardAssets* assets, Card* cards)
+{
+  int card_count = 0;
+  for (int i = 0; i < definition.ranks_; i++) 
+  {
+    //add the copies of current image to the shoe
+    for (int k = 0; k < definition.copies_[i]; k++) 
     {
-      printf("BLACKJACK! PUSH!");
+      Card card = { assets->images_[i], definition.points_[i], i };
+      cards[card_count++] = card;
     }
-    deallocateMemory(card_images, NUM_CARDS);
-    return 0;
   }
+}
 
-  int players_turn = 1; //player starts first
+//------------------------------------------------------------------------------
+///
+/// The main program.
+/// Reads card images from files conatained in input map(second argument)
+/// and makes a deck. The cards from deck are dealt to dealer and player 
+/// and game of blackjack starts.
+///
+/// @param argc Number of arguments (2 or more)
+/// @param argv The executable name, input map, number 
+///        for generating random seed(optional) and a command(optional)
+/// @return zero if program ends without errors,
+///         for unexpected program end, see error codes on the top
+//
+int main(int argc, char** argv) 
+{
+  startup_marks[MARK_MAIN] = nowNs();
+  if (argc < 2) 
+  {
+    return argumentsError(argv[0]);
+  }
 
-  while(1) 
+  int seed = time(NULL);
+  char* rest;
+  if (argc >= 3 && strcmp(argv[2], SECURE_SEED) == 0) 
   {
-    if (!players_turn) 
+    if (enableSecureShuffle() != 0) 
     {
-      printf("DEALERS TURN\n");
-      showCards(dealer, 2, dealer_score, image_width, image_height, 0);
-      if (dealer_score == 21 && dealer_count == 2) 
-      {
-        printf("BLACKJACK! YOU LOOSE!");
-        break;
-      }
-      while (dealer_score < player_score) 
-      {
-        printf("DEALER GETS ANOTHER CARD..\n");
-        giveCards(cards, dealer, &card_count, &dealer_count, &dealer_score, 1);
-        showCards(dealer, dealer_count, dealer_score,
-         image_width, image_height, 0);
-      }
-      if (dealer_score == 21) 
-      {
-        if (player_score == 21) 
-        {
-          printf("PUSH!");
-        }
-        else 
-        {
-          printf("YOU LOOSE!");
-        }
-        break;
-      }
-      if (dealer_score > 21) 
-      {
-        printf("BUST! YOU WIN!");
-        break;
-      }
-      players_turn = 1;
+      return SIMULATION_ERROR;
     }
-    else //players turn
+  }
+  else if (argc >= 3) 
+  {
+    seed = strtol(argv[2], &rest, 10);
+  }
+  if (strlen(argv[1]) >= PATH_LENGTH - 1) 
+  {
+    return argumentsError(argv[0]);
+  }
+  startup_marks[MARK_ARGS] = nowNs();
+
+  int loaded = loadAssets(argv[1], &card_assets);
+  if (loaded != 0) 
+  {
+    return loaded;
+  }
+  startup_marks[MARK_LOAD] = nowNs();
+
+  Card cards[MAX_SHOE_SIZE];
+  buildDeck(&card_assets, cards);
+  startup_marks[MARK_DECK] = nowNs();
+
+  int image_width = card_assets.width_;
+  int image_height = card_assets.height_;
+
+  if (argc > 3) 
+  {
+    int result = runCommand(cards, seed, image_width, image_height,
+     argc - 3, argv + 3);
+    releaseAssets(&card_assets);
+    if (result == ARGUMENTS_ERROR) 
     {
-      char option[OPTION_INPUT_LENGTH];
-      printf("HIT (h) or STAND (s)\n");
-      scanf("%s", option);
-      if (strcmp(option, "h") == 0) 
-      {
-        giveCards(cards, player, &card_count, &player_count, &player_score, 1);
-        showCards(player, player_count, player_score,
-         image_width, image_height, 1);
-        if (player_score == 21) 
-        {
-          players_turn = 0;
-        }
-        else if (player_score > 21) 
-        {
-          printf("BUST! YOU LOOSE!");
-          break;
-        }
-      }
-      else if (strcmp(option, "s") == 0) 
-      {
-        players_turn = 0;
-      }
+      return argumentsError(argv[0]);
     }
+    return result;
   }
 
-  deallocateMemory(card_images, NUM_CARDS);
+  int result = startGame(cards, seed, image_width, image_height, NULL);
 
-  return 0;
+  releaseAssets(&card_assets);
+
+  return result;
 }
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Builds the game and runs its end to end checks against the embedded card
+# images. Exits non-zero on the first failing check.
+#
+#   tests/run_tests.sh [rounds]
+
+set -u
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+ROUNDS=${1:-300000}
+WORK=$(mktemp -d)
+BIN="$WORK/blackjack"
+PIDS=""
+
+cleanup()
+{
+  for pid in $PIDS; do
+    kill -9 "$pid" 2>/dev/null
+  done
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  exit 1
+}
+
+# waits up to 10 s for the coordinator to listen on socket $1
+wait_socket()
+{
+  tries=0
+  while [ ! -S "$1" ]; do
+    tries=$((tries + 1))
+    [ $tries -le 100 ] || fail "nobody listens on $1"
+    sleep 0.1
+  done
+}
+
+${CC:-gcc} -std=gnu11 -Wall -Wextra -O2 -pthread "$ROOT/src.c" -o "$BIN" -lm ||
+  fail "build"
+
+# sweep: the same rounds merged from one local worker, and from two forked
+# workers plus extra 'worker' processes, one killed mid-chunk (its chunk
+# is requeued) and one stopped (its chunk is stolen by an idle worker or
+# requeued when its heartbeat times out)
+"$BIN" @embedded 7 sweep "$ROUNDS" 1 "$WORK/reference.sock" \
+  "$WORK/reference.csv" > "$WORK/reference.out" ||
+  fail "sweep with one worker exited with $?"
+
+"$BIN" @embedded 7 sweep "$ROUNDS" 2 "$WORK/sweep.sock" "$WORK/sweep.csv" \
+  > "$WORK/sweep.out" &
+SWEEP=$!
+PIDS="$PIDS $SWEEP"
+wait_socket "$WORK/sweep.sock"
+"$BIN" @embedded 7 worker "$WORK/sweep.sock" > /dev/null &
+KILLED=$!
+"$BIN" @embedded 7 worker "$WORK/sweep.sock" > /dev/null &
+STOPPED=$!
+"$BIN" @embedded 7 worker "$WORK/sweep.sock" > /dev/null &
+EXTRA=$!
+PIDS="$PIDS $KILLED $STOPPED $EXTRA"
+sleep 1
+kill -9 "$KILLED" 2>/dev/null || fail "the worker to kill already exited"
+kill -STOP "$STOPPED" 2>/dev/null ||
+  fail "the worker to stop already exited"
+
+wait "$SWEEP" || fail "distributed sweep exited with $?"
+wait "$EXTRA" || fail "extra worker exited with $?"
+cmp -s "$WORK/reference.csv" "$WORK/sweep.csv" || {
+  diff "$WORK/reference.csv" "$WORK/sweep.csv"
+  fail "distributed sweep does not match the single worker sweep"
+}
+echo "PASS: sweep"
+
+# alloccheck: no engine may allocate or free memory once warmed up
+"$BIN" @embedded 7 alloccheck 2000 > "$WORK/alloccheck.out" || {
+  status=$?
+  cat "$WORK/alloccheck.out"
+  fail "alloccheck exited with $status"
+}
+echo "PASS: alloccheck"